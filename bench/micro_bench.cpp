@@ -0,0 +1,556 @@
+// Microbenchmarks for the hot kernels, fed from pre-generated ray and primitive sets.
+// Build once normally and once with -DRT_SCALAR_MATH to compare the SIMD and scalar vec3.
+//
+//   micro_bench [--filter substring] [--samples N] [--counters]
+//
+// Each kernel is run over its whole input set per sample; the median sample is reported as
+// ns and TSC cycles per call. --counters adds hardware counters (cycles, instructions, cache
+// misses) through perf_event_open on Linux. Before timing, the optimized kernels are checked
+// against straightforward double-precision reference versions; any mismatch fails the run.
+
+#include "../src/common.h"
+#include "../src/arena.h"
+#include "../src/bvh_node.h"
+#include "../src/hittable_list.h"
+#include "../src/material.h"
+#include "../src/sphere.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <print>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define HAVE_PERF_EVENT 1
+#endif
+
+[[nodiscard]] static uint64_t read_tsc()
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Hardware counters for the calling thread. Unavailable (all zero) when the kernel refuses
+// access, e.g. with a restrictive perf_event_paranoid or inside most containers.
+class hw_counters
+{
+public:
+    static constexpr int count = 3;
+    static constexpr const char *names[count] = {"cycles", "instr", "LLC-miss"};
+
+    explicit hw_counters(bool enable)
+    {
+#ifdef HAVE_PERF_EVENT
+        if (!enable)
+            return;
+        const uint64_t configs[count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                         PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i < count; i++)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#else
+        (void)enable;
+#endif
+    }
+
+    ~hw_counters()
+    {
+#ifdef HAVE_PERF_EVENT
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    [[nodiscard]] bool available() const
+    {
+        return std::any_of(std::begin(fds), std::end(fds), [](int fd)
+                           { return fd >= 0; });
+    }
+
+    void start()
+    {
+#ifdef HAVE_PERF_EVENT
+        for (int fd : fds)
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+    }
+
+    void stop(uint64_t (&values)[count])
+    {
+        for (int i = 0; i < count; i++)
+        {
+            values[i] = 0;
+#ifdef HAVE_PERF_EVENT
+            if (fds[i] >= 0)
+            {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+                    values[i] = 0;
+            }
+#endif
+        }
+    }
+
+private:
+    int fds[count] = {-1, -1, -1};
+};
+
+struct bench_options
+{
+    std::string filter;
+    int samples = 15;
+    int warmup = 3;
+    bool counters = false;
+};
+
+// Keeps results observable so the compiler cannot drop the measured work
+static volatile double sink = 0.0;
+
+class micro_bench
+{
+public:
+    explicit micro_bench(const bench_options &options)
+        : options(options), counters(options.counters)
+    {
+        if (options.counters && !counters.available())
+            std::println(stderr, "Hardware counters unavailable (perf_event_open failed)");
+
+        std::print("{:<22} {:>10} {:>10}", "kernel", "ns/call", "tsc/call");
+        if (counters.available())
+            for (auto name : hw_counters::names)
+                std::print(" {:>10}", name);
+        std::println("");
+    }
+
+    // Runs `body` (which makes `calls` kernel calls and returns a checksum) and reports per-call cost
+    template <class Body>
+    void run(std::string_view name, size_t calls, Body &&body)
+    {
+        if (!options.filter.empty() && name.find(options.filter) == std::string_view::npos)
+            return;
+
+        for (int i = 0; i < options.warmup; i++)
+            sink = sink + body();
+
+        std::vector<double> ns(options.samples), tsc(options.samples);
+        std::vector<uint64_t> hw[hw_counters::count];
+        for (int i = 0; i < options.samples; i++)
+        {
+            uint64_t values[hw_counters::count];
+            counters.start();
+            auto t0 = std::chrono::steady_clock::now();
+            auto c0 = read_tsc();
+            sink = sink + body();
+            auto c1 = read_tsc();
+            auto t1 = std::chrono::steady_clock::now();
+            counters.stop(values);
+
+            ns[i] = std::chrono::duration<double, std::nano>(t1 - t0).count() / calls;
+            tsc[i] = static_cast<double>(c1 - c0) / calls;
+            for (int k = 0; k < hw_counters::count; k++)
+                hw[k].push_back(values[k]);
+        }
+
+        std::print("{:<22} {:>10.2f} {:>10.1f}", name, median(ns), median(tsc));
+        if (counters.available())
+        {
+            for (auto &values : hw)
+            {
+                std::vector<double> per_call;
+                for (auto v : values)
+                    per_call.push_back(static_cast<double>(v) / calls);
+                std::print(" {:>10.2f}", median(per_call));
+            }
+        }
+        std::println("");
+    }
+
+private:
+    bench_options options;
+    hw_counters counters;
+
+    [[nodiscard]] static double median(std::vector<double> v)
+    {
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    }
+};
+
+// Pre-generated inputs shared by all kernels
+struct data_set
+{
+    std::vector<ray> rays;
+    std::vector<std::shared_ptr<sphere>> spheres;
+    std::vector<point3> centers;
+    std::vector<real> radii;
+    std::vector<aabb> boxes;
+    hittable_list world;
+    std::shared_ptr<bvh_node> bvh;
+    std::vector<hit_record> hits;
+    std::vector<color> colors;
+    std::shared_ptr<material> lambert, shiny, glass;
+
+    explicit data_set(size_t ray_count = 4096, size_t sphere_count = 1024)
+    {
+        seed_random(12345);
+        lambert = std::make_shared<lambertian>(color(0.5f, 0.5f, 0.5f));
+        shiny = std::make_shared<metal>(color(0.8f, 0.8f, 0.8f), 0.2f);
+        glass = std::make_shared<dielectric>(1.5f);
+
+        for (size_t i = 0; i < sphere_count; i++)
+        {
+            point3 center(random_real(-20, 20), random_real(-20, 20), random_real(-20, 20));
+            real radius = random_real(0.2f, 1.5f);
+            auto s = std::make_shared<sphere>(center, radius, lambert);
+            spheres.push_back(s);
+            centers.push_back(center);
+            radii.push_back(radius);
+            boxes.push_back(s->bounding_box());
+            world.add(s);
+        }
+        bvh = std::make_shared<bvh_node>(world);
+
+        for (size_t i = 0; i < ray_count; i++)
+        {
+            point3 origin(random_real(-25, 25), random_real(-25, 25), random_real(-25, 25));
+            // Aim near a primitive so a realistic fraction of the tests hit
+            auto target = centers[i % centers.size()] + vec3::random(-2, 2);
+            rays.emplace_back(origin, target - origin);
+
+            hit_record rec;
+            rec.p = origin;
+            rec.set_face_normal(rays.back(), random_unit_vector());
+            rec.t = 1.0f;
+            hits.push_back(rec);
+
+            colors.push_back(color::random(0, 1.2f));
+        }
+    }
+};
+
+// Straightforward double-precision versions of the kernels, used as the correctness reference
+
+[[nodiscard]] static bool reference_sphere_hit(const ray &r, const point3 &center, real radius,
+                                               double tmin, double tmax, double &t)
+{
+    double ox = r.origin().x - center.x, oy = r.origin().y - center.y, oz = r.origin().z - center.z;
+    double dx = r.direction().x, dy = r.direction().y, dz = r.direction().z;
+    double a = dx * dx + dy * dy + dz * dz;
+    double b = 2.0 * (ox * dx + oy * dy + oz * dz);
+    double c = ox * ox + oy * oy + oz * oz - static_cast<double>(radius) * radius;
+    double disc = b * b - 4 * a * c;
+    if (disc < 0)
+        return false;
+    for (double root : {(-b - std::sqrt(disc)) / (2 * a), (-b + std::sqrt(disc)) / (2 * a)})
+    {
+        if (tmin < root && root < tmax)
+        {
+            t = root;
+            return true;
+        }
+    }
+    return false;
+}
+
+[[nodiscard]] static bool reference_box_hit(const ray &r, const aabb &box, double tmin, double tmax)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double inv = 1.0 / r.direction()[axis];
+        double t0 = (box.axis(axis).min - r.origin()[axis]) * inv;
+        double t1 = (box.axis(axis).max - r.origin()[axis]) * inv;
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1));
+    }
+    return tmin < tmax;
+}
+
+// Returns the number of mismatches between the engine kernels and the references
+static int cross_check(const data_set &data)
+{
+    int failures = 0;
+    auto report = [&failures](std::string_view kernel, int mismatches, size_t total)
+    {
+        std::println("check {:<18} {:>6} / {:<6} {}", kernel, mismatches, total, mismatches ? "FAIL" : "ok");
+        failures += mismatches;
+    };
+
+    // Rays grazing a surface may legitimately disagree between float and double,
+    // so hit/miss mismatches only count when the reference is clearly inside or outside.
+    int bad = 0;
+    size_t total = 0;
+    for (const auto &r : data.rays)
+    {
+        for (size_t i = 0; i < 64; i++)
+        {
+            hit_record rec;
+            double t_ref = 0;
+            bool hit = data.spheres[i]->hit(r, interval(0.001f, infinity), rec);
+            bool hit_ref = reference_sphere_hit(r, data.centers[i], data.radii[i], 0.001, 1e30, t_ref);
+            total++;
+            if (hit && hit_ref)
+                bad += std::abs(rec.t - t_ref) > 1e-3 * std::max(1.0, t_ref);
+            else if (hit != hit_ref)
+            {
+                double grazing = hit ? rec.t : t_ref;
+                bad += (grazing > 0.01); // Only a near-origin root may flip
+            }
+        }
+    }
+    report("sphere::hit", bad, total);
+
+    bad = 0, total = 0;
+    for (const auto &r : data.rays)
+    {
+        for (size_t i = 0; i < 64; i++)
+        {
+            bool hit = data.boxes[i].hit(r, interval(0.001f, infinity));
+            bool hit_ref = reference_box_hit(r, data.boxes[i], 0.001, 1e30);
+            // Float slabs may only differ from double ones for rays that touch an edge
+            if (hit != hit_ref)
+            {
+                aabb grown(interval(data.boxes[i].x.min - 1e-3f, data.boxes[i].x.max + 1e-3f),
+                             interval(data.boxes[i].y.min - 1e-3f, data.boxes[i].y.max + 1e-3f),
+                             interval(data.boxes[i].z.min - 1e-3f, data.boxes[i].z.max + 1e-3f));
+                aabb shrunk(interval(data.boxes[i].x.min + 1e-3f, data.boxes[i].x.max - 1e-3f),
+                            interval(data.boxes[i].y.min + 1e-3f, data.boxes[i].y.max - 1e-3f),
+                            interval(data.boxes[i].z.min + 1e-3f, data.boxes[i].z.max - 1e-3f));
+                bad += reference_box_hit(r, shrunk, 0.001, 1e30) || !reference_box_hit(r, grown, 0.001, 1e30);
+            }
+            total++;
+        }
+    }
+    report("aabb::hit", bad, total);
+
+    // The BVH must find exactly the closest hit that a linear scan finds
+    bad = 0, total = 0;
+    for (const auto &r : data.rays)
+    {
+        hit_record a{}, b{};
+        bool hit_a = data.bvh->hit(r, interval(0.001f, infinity), a);
+        bool hit_b = data.world.hit(r, interval(0.001f, infinity), b);
+        bad += (hit_a != hit_b) || (hit_a && a.t != b.t);
+        total++;
+    }
+    report("bvh_node::hit", bad, total);
+
+    bad = 0, total = 0;
+    for (const auto &c : data.colors)
+    {
+        auto p = to_pixel(c);
+        auto expect = [](double v)
+        {
+            return static_cast<int>(256.0 * std::clamp(v > 0 ? std::sqrt(v) : 0.0, 0.0, 0.999));
+        };
+        bad += std::abs(p.r - expect(c.x)) > 1 || std::abs(p.g - expect(c.y)) > 1 || std::abs(p.b - expect(c.z)) > 1;
+        total++;
+    }
+    report("to_pixel", bad, total);
+
+    // vec3 operations (SIMD unless built with RT_SCALAR_MATH) against plain scalar arithmetic
+    bad = 0, total = 0;
+    for (size_t i = 0; i + 1 < data.colors.size(); i++)
+    {
+        const auto &a = data.rays[i].direction();
+        const auto &b = data.rays[i + 1].direction();
+        // Tolerance relative to the operand magnitudes, since cross and dot may cancel
+        const double scale = std::max(1.0, double(a.length()) * b.length() + a.length() + b.length());
+        auto near = [scale](real got, double expect)
+        {
+            return std::abs(got - expect) <= 1e-6 * scale;
+        };
+        auto sum = a + b, diff = a - b, prod = a * b, c = cross(a, b), u = unit_vector(a);
+        auto lo = min(a, b), hi = max(a, b);
+        double len = std::sqrt(double(a.x) * a.x + double(a.y) * a.y + double(a.z) * a.z);
+        bool ok = near(dot(a, b), double(a.x) * b.x + double(a.y) * b.y + double(a.z) * b.z) &&
+                  near(sum.x, a.x + b.x) && near(sum.y, a.y + b.y) && near(sum.z, a.z + b.z) &&
+                  near(diff.x, a.x - b.x) && near(diff.y, a.y - b.y) && near(diff.z, a.z - b.z) &&
+                  near(prod.x, a.x * b.x) && near(prod.y, a.y * b.y) && near(prod.z, a.z * b.z) &&
+                  near(c.x, double(a.y) * b.z - double(a.z) * b.y) &&
+                  near(c.y, double(a.z) * b.x - double(a.x) * b.z) &&
+                  near(c.z, double(a.x) * b.y - double(a.y) * b.x) &&
+                  std::abs(u.x - a.x / len) < 1e-6 && std::abs(u.y - a.y / len) < 1e-6 && std::abs(u.z - a.z / len) < 1e-6 &&
+                  lo.x == std::min(a.x, b.x) && lo.y == std::min(a.y, b.y) && lo.z == std::min(a.z, b.z) &&
+                  hi.x == std::max(a.x, b.x) && hi.y == std::max(a.y, b.y) && hi.z == std::max(a.z, b.z) &&
+                  sum._pad == 0 && c._pad == 0 && u._pad == 0 && data.rays[i].inverse_direction()._pad == 0;
+        bad += !ok;
+        total++;
+    }
+    report("vec3 ops", bad, total);
+
+    bad = 0, total = 0;
+    for (int i = 0; i < 100'000; i++)
+    {
+        auto v = random_unit_vector();
+        bad += std::abs(v.length() - 1.0f) > 1e-4f;
+        total++;
+    }
+    report("random_unit_vector", bad, total);
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--counters")
+            options.counters = true;
+        else if (arg == "--filter" && i + 1 < argc)
+            options.filter = argv[++i];
+        else if (arg == "--samples" && i + 1 < argc)
+        {
+            std::string_view value = argv[++i];
+            std::from_chars(value.data(), value.data() + value.size(), options.samples);
+            options.samples = std::max(options.samples, 1);
+        }
+        else
+        {
+            std::println(stderr, "Usage: micro_bench [--filter substring] [--samples N] [--counters]");
+            return 2;
+        }
+    }
+
+    data_set data;
+    if (cross_check(data) > 0)
+    {
+        std::println(stderr, "Correctness check failed");
+        return 1;
+    }
+    std::println("");
+
+    micro_bench bench(options);
+    const interval ray_t(0.001f, infinity);
+
+    bench.run("sphere::hit", data.rays.size() * 16, [&]
+              {
+                  double sum = 0;
+                  hit_record rec;
+                  for (const auto &r : data.rays)
+                      for (size_t i = 0; i < 16; i++)
+                          if (data.spheres[i]->hit(r, ray_t, rec))
+                              sum += rec.t;
+                  return sum; });
+
+    bench.run("aabb::hit", data.rays.size() * 16, [&]
+              {
+                  double sum = 0;
+                  for (const auto &r : data.rays)
+                      for (size_t i = 0; i < 16; i++)
+                          sum += data.boxes[i].hit(r, ray_t);
+                  return sum; });
+
+    bench.run("bvh_node::hit", data.rays.size(), [&]
+              {
+                  double sum = 0;
+                  hit_record rec;
+                  for (const auto &r : data.rays)
+                      if (data.bvh->hit(r, ray_t, rec))
+                          sum += rec.t;
+                  return sum; });
+
+    bench.run("vec3 dot", data.rays.size(), [&]
+              {
+                  real sum = 0;
+                  for (size_t i = 1; i < data.rays.size(); i++)
+                      sum += dot(data.rays[i].direction(), data.rays[i - 1].direction());
+                  return static_cast<double>(sum); });
+
+    bench.run("vec3 cross", data.rays.size(), [&]
+              {
+                  vec3 sum;
+                  for (size_t i = 1; i < data.rays.size(); i++)
+                      sum += cross(data.rays[i].direction(), data.rays[i - 1].direction());
+                  return static_cast<double>(sum.x); });
+
+    bench.run("unit_vector", data.rays.size(), [&]
+              {
+                  vec3 sum;
+                  for (const auto &r : data.rays)
+                      sum += unit_vector(r.direction());
+                  return static_cast<double>(sum.x); });
+
+    bench.run("random_unit_vector", 65536, []
+              {
+                  vec3 sum;
+                  for (int i = 0; i < 65536; i++)
+                      sum += random_unit_vector();
+                  return static_cast<double>(sum.x); });
+
+    bench.run("to_pixel", data.colors.size(), [&]
+              {
+                  double sum = 0;
+                  for (const auto &c : data.colors)
+                      sum += to_pixel(c).g;
+                  return sum; });
+
+    auto scatter_bench = [&](std::string_view name, const material &mat)
+    {
+        bench.run(name, data.rays.size(), [&]
+                  {
+                      double sum = 0;
+                      color attenuation;
+                      ray scattered;
+                      for (size_t i = 0; i < data.rays.size(); i++)
+                          if (mat.scatter(data.rays[i], data.hits[i], attenuation, scattered))
+                              sum += scattered.direction().x;
+                      return sum; });
+    };
+    scatter_bench("lambertian::scatter", *data.lambert);
+    scatter_bench("metal::scatter", *data.shiny);
+    scatter_bench("dielectric::scatter", *data.glass);
+
+    // Scene construction and teardown: per sphere, a world built and then destroyed
+    bench.run("build world (heap)", data.centers.size(), [&]
+              {
+                  hittable_list world;
+                  for (size_t i = 0; i < data.centers.size(); i++)
+                      world.add(std::make_shared<sphere>(data.centers[i], data.radii[i], data.lambert));
+                  return static_cast<double>(world.objects.size()); });
+
+    bench.run("build world (arena)", data.centers.size(), [&]
+              {
+                  hittable_list world;
+                  scene_arena arena;
+                  for (size_t i = 0; i < data.centers.size(); i++)
+                      world.add(arena.make<sphere>(data.centers[i], data.radii[i], data.lambert));
+                  return static_cast<double>(world.objects.size()); });
+
+    bench.run("bvh_node build", data.centers.size(), [&]
+              {
+                  auto objects = data.world.objects;
+                  bvh_node tree(objects, 0, objects.size());
+                  return static_cast<double>(tree.bounding_box().x.max); });
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+// Renders every bundled scene at fixed, reduced settings and reports throughput.
+//
+//   scene_bench [--scenes a,b] [--repeats N] [--warmup N] [--width W] [--spp N] [--depth N]
+//               [--seed N] [--tuning FILE|off] [--json FILE] [--baseline FILE] [--threshold PCT]
+//
+// Renders use the built-in tile size, thread count and BVH leaf size unless --tuning names a
+// machine profile (src/tuning.h), so results do not depend on what autotune left behind. The
+// values used are recorded per scene in the JSON.
+//
+// With --baseline, every scene is compared against a previous --json result and the process
+// exits with status 1 if any scene got significantly slower (one-sided Mann-Whitney U test on
+// the MRays/s samples, p < 0.05, and a median slowdown above --threshold percent).
+
+#include "../scenes/registry.h"
+#include "../src/build_info.h"
+#include "../src/cpu_dispatch.h"
+#include "../src/json.h"
+#include "../src/tuning.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct bench_settings
+{
+    std::vector<std::string> scenes; // Empty means all
+    int repeats = 5;
+    int warmup = 1;
+    int width = 320;
+    int spp = 8;
+    int max_depth = 0; // 0 keeps each scene's own depth
+    uint64_t seed = 1;
+    std::string tuning = "off"; // Machine profile, see machine_profile::select()
+    std::string json_path = "bench_results.json";
+    std::string baseline_path;
+    double threshold_pct = 3.0;
+};
+
+struct scene_result
+{
+    std::string name;
+    int width = 0, height = 0, spp = 0, max_depth = 0;
+    int tile_size = 0, threads = 0, bvh_leaf_size = 0; // As rendered; 0 threads is all of them
+    std::vector<double> seconds;
+    std::vector<double> mrays_s;
+    std::vector<double> build_seconds;
+};
+
+[[nodiscard]] static double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0.0;
+    std::sort(v.begin(), v.end());
+    auto n = v.size();
+    return (n % 2) ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// Median absolute deviation, a spread estimate that ignores the odd outlier run
+[[nodiscard]] static double mad(const std::vector<double> &v)
+{
+    auto m = median(v);
+    std::vector<double> deviations;
+    for (double x : v)
+        deviations.push_back(std::abs(x - m));
+    return median(deviations);
+}
+
+// Exact one-sided Mann-Whitney U test: probability, under the null hypothesis of identical
+// distributions, of at least `u` (current < baseline) pairs. Ties count as half a pair and
+// are rounded down, which makes the test slightly conservative.
+[[nodiscard]] static double mann_whitney_p(const std::vector<double> &baseline, const std::vector<double> &current)
+{
+    const size_t m = baseline.size(), n = current.size();
+    double u_obs = 0.0;
+    for (double b : baseline)
+        for (double c : current)
+            u_obs += (c < b) ? 1.0 : (c == b) ? 0.5
+                                              : 0.0;
+
+    // counts[i][j][u]: orderings of i baseline and j current samples with statistic u
+    const size_t max_u = m * n;
+    std::vector<std::vector<std::vector<double>>> counts(
+        m + 1, std::vector<std::vector<double>>(n + 1, std::vector<double>(max_u + 1, 0.0)));
+    for (size_t i = 0; i <= m; i++)
+    {
+        for (size_t j = 0; j <= n; j++)
+        {
+            if (i == 0 || j == 0)
+            {
+                counts[i][j][0] = 1.0;
+                continue;
+            }
+            for (size_t u = 0; u <= i * j; u++)
+            {
+                // The largest sample is either a baseline one (beats all j current samples)...
+                double c = (u >= j) ? counts[i - 1][j][u - j] : 0.0;
+                // ...or a current one (beats nothing)
+                c += counts[i][j - 1][u];
+                counts[i][j][u] = c;
+            }
+        }
+    }
+
+    double total = 0.0, tail = 0.0;
+    for (size_t u = 0; u <= max_u; u++)
+    {
+        total += counts[m][n][u];
+        if (u >= static_cast<size_t>(std::floor(u_obs)))
+            tail += counts[m][n][u];
+    }
+    return tail / total;
+}
+
+[[nodiscard]] static std::vector<double> numbers(const json_value *array)
+{
+    std::vector<double> out;
+    if (array)
+        for (const auto &v : array->array)
+            out.push_back(v.number);
+    return out;
+}
+
+static void write_json(const bench_settings &settings, const std::vector<scene_result> &results)
+{
+    std::ofstream out(settings.json_path);
+    auto list = [](const std::vector<double> &v)
+    {
+        std::string s = "[";
+        for (size_t i = 0; i < v.size(); i++)
+            s += (i ? ", " : "") + std::to_string(v[i]);
+        return s + "]";
+    };
+
+    out << "{\n";
+    out << "  \"machine\": {\"host\": " << json_quote(host_name())
+        << ", \"cpu\": " << json_quote(cpu_model())
+        << ", \"threads\": " << hardware_threads() << "},\n";
+    out << "  \"build\": {\"compiler\": " << json_quote(compiler_info())
+        << ", \"flags\": " << json_quote(build_flags())
+        << ", \"kernels\": " << json_quote(std::string(cpu_dispatch::name(cpu_dispatch::active()))) << "},\n";
+    out << "  \"settings\": {\"repeats\": " << settings.repeats
+        << ", \"warmup\": " << settings.warmup
+        << ", \"seed\": " << settings.seed
+        << ", \"tuning\": " << json_quote(settings.tuning) << "},\n";
+    out << "  \"scenes\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto &r = results[i];
+        out << "    {\"name\": " << json_quote(r.name)
+            << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"spp\": " << r.spp << ", \"max_depth\": " << r.max_depth
+            << ", \"tile_size\": " << r.tile_size << ", \"threads\": " << r.threads
+            << ", \"bvh_leaf_size\": " << r.bvh_leaf_size
+            << ",\n     \"median_mrays_s\": " << median(r.mrays_s)
+            << ", \"mad_mrays_s\": " << mad(r.mrays_s)
+            << ", \"median_seconds\": " << median(r.seconds)
+            << ", \"mad_seconds\": " << mad(r.seconds)
+            << ",\n     \"mrays_s\": " << list(r.mrays_s)
+            << ",\n     \"seconds\": " << list(r.seconds)
+            << ",\n     \"build_seconds\": " << list(r.build_seconds) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Returns the number of scenes that regressed, or -1 if the baseline cannot be read
+static int compare_with_baseline(const bench_settings &settings, const std::vector<scene_result> &results)
+{
+    std::ifstream file(settings.baseline_path);
+    if (!file)
+    {
+        std::println(stderr, "Cannot open baseline {}", settings.baseline_path);
+        return -1;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    auto baseline = parse_json(buffer.str());
+
+    std::println("\nBaseline: {}", settings.baseline_path);
+    std::println("{:<12} {:>10} {:>10} {:>8} {:>8}  {}", "scene", "base", "now", "delta", "p", "verdict");
+
+    int regressions = 0;
+    const auto *scenes = baseline.find("scenes");
+    for (const auto &r : results)
+    {
+        const json_value *entry = nullptr;
+        if (scenes)
+            for (const auto &s : scenes->array)
+                if (const auto *name = s.find("name"); name && name->string == r.name)
+                    entry = &s;
+
+        if (!entry)
+        {
+            std::println("{:<12} {:>10} {:>10} {:>8} {:>8}  {}", r.name, "-", "-", "-", "-", "not in baseline");
+            continue;
+        }
+
+        const auto *spp = entry->find("spp");
+        const auto *width = entry->find("width");
+        if ((spp && spp->number != r.spp) || (width && width->number != r.width))
+        {
+            std::println("{:<12} {:>10} {:>10} {:>8} {:>8}  {}", r.name, "-", "-", "-", "-", "settings differ");
+            continue;
+        }
+
+        auto base_samples = numbers(entry->find("mrays_s"));
+        double base = median(base_samples);
+        double now = median(r.mrays_s);
+        double delta_pct = (now - base) / base * 100.0;
+        double p = mann_whitney_p(base_samples, r.mrays_s);
+
+        bool regressed = (-delta_pct > settings.threshold_pct) && (p < 0.05);
+        regressions += regressed;
+        std::println("{:<12} {:>10.3f} {:>10.3f} {:>7.1f}% {:>8.3f}  {}", r.name, base, now, delta_pct, p,
+                     regressed ? "REGRESSION" : "ok");
+    }
+    return regressions;
+}
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+int main(int argc, char **argv)
+{
+    bench_settings settings;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        std::string_view value = (i + 1 < argc) ? argv[i + 1] : "";
+        bool ok = true;
+
+        if (arg == "--scenes")
+        {
+            std::stringstream list{std::string(value)};
+            for (std::string name; std::getline(list, name, ',');)
+                settings.scenes.push_back(name);
+        }
+        else if (arg == "--repeats")
+            ok = parse_number(value, settings.repeats) && settings.repeats > 0;
+        else if (arg == "--warmup")
+            ok = parse_number(value, settings.warmup) && settings.warmup >= 0;
+        else if (arg == "--width")
+            ok = parse_number(value, settings.width) && settings.width > 0;
+        else if (arg == "--spp")
+            ok = parse_number(value, settings.spp) && settings.spp > 0;
+        else if (arg == "--depth")
+            ok = parse_number(value, settings.max_depth);
+        else if (arg == "--seed")
+            ok = parse_number(value, settings.seed);
+        else if (arg == "--tuning")
+            settings.tuning = value;
+        else if (arg == "--json")
+            settings.json_path = value;
+        else if (arg == "--baseline")
+            settings.baseline_path = value;
+        else if (arg == "--threshold")
+            ok = parse_number(value, settings.threshold_pct);
+        else
+            ok = false;
+
+        if (!ok || value.empty())
+        {
+            std::println(stderr, "Invalid argument: {} {}", arg, value);
+            return 2;
+        }
+        i++;
+    }
+
+    for (const auto &name : settings.scenes)
+    {
+        if (!find_scene(name))
+        {
+            std::println(stderr, "Unknown scene: {}", name);
+            return 2;
+        }
+    }
+
+    machine_profile::select(settings.tuning);
+
+    std::println("Host: {} | CPU: {} | {} threads", host_name(), cpu_model(), hardware_threads());
+    std::println("Build: {} | {} | kernels {}", compiler_info(), build_flags(), cpu_dispatch::describe());
+    std::println("Settings: width {} | {} spp | {} repeats (+{} warmup) | seed {} | tuning {}\n",
+                 settings.width, settings.spp, settings.repeats, settings.warmup, settings.seed, settings.tuning);
+    std::println("{:<12} {:>10} {:>8} {:>10} {:>8} {:>10}", "scene", "MRays/s", "+/-", "seconds", "+/-", "build ms");
+
+    std::vector<scene_result> results;
+    for (const auto &entry : scene_registry)
+    {
+        if (!settings.scenes.empty() &&
+            std::find(settings.scenes.begin(), settings.scenes.end(), entry.name) == settings.scenes.end())
+            continue;
+
+        // Same seed, same scene layout and same image on every run
+        seed_random(settings.seed);
+        auto [world, cam] = entry.generate();
+        cam.image_width = settings.width;
+        cam.samples_per_pixel = settings.spp;
+        cam.seed = settings.seed;
+        if (settings.max_depth > 0)
+            cam.max_depth = settings.max_depth;
+
+        scene_result result;
+        result.name = entry.name;
+        result.width = cam.image_width;
+        result.spp = cam.samples_per_pixel;
+        result.max_depth = cam.max_depth;
+        result.tile_size = cam.tile_pixels();
+        result.threads = cam.worker_threads();
+        result.bvh_leaf_size = static_cast<int>(cam.leaf_objects());
+
+        std::vector<Pixel> pixels;
+        for (int run = 0; run < settings.warmup + settings.repeats; run++)
+        {
+            auto stats = cam.render_pixels(world, pixels);
+            if (run < settings.warmup)
+                continue;
+            result.seconds.push_back(stats.render_seconds);
+            result.mrays_s.push_back(stats.mrays_s());
+            result.build_seconds.push_back(stats.build_seconds);
+        }
+        result.height = static_cast<int>(pixels.size()) / cam.image_width;
+
+        std::println("{:<12} {:>10.3f} {:>8.3f} {:>10.3f} {:>8.3f} {:>10.2f}", result.name,
+                     median(result.mrays_s), mad(result.mrays_s),
+                     median(result.seconds), mad(result.seconds),
+                     median(result.build_seconds) * 1000.0);
+        results.push_back(std::move(result));
+    }
+
+    write_json(settings, results);
+    std::println("\nResults: {}", settings.json_path);
+
+    if (settings.baseline_path.empty())
+        return 0;
+
+    int regressions = compare_with_baseline(settings, results);
+    return (regressions < 0) ? 2 : (regressions > 0) ? 1
+                                                     : 0;
+}
@@ -5,10 +5,11 @@
 inline scene generate_scene()
 {
     hittable_list world;
+    scene_arena arena; // Spheres and materials are bump-allocated together (see src/arena.h)
 
     // Ground
-    auto ground_material = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+    auto ground_material = arena.make<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
 
     // Random small spheres
     for (int a = -11; a < 11; a++)
@@ -26,36 +27,36 @@ inline scene generate_scene()
                 {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<lambertian>(albedo);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
                 else if (choose_mat < 0.95)
                 {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_real(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
                 else
                 {
                     // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<dielectric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
     // Three large spheres
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = arena.make<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = arena.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
 
     camera cam;
     cam.aspect_ratio = 16.0 / 9.0;
@@ -2,29 +2,30 @@
 
 #include "../src/scene.h"
 
+// Fixed layout, so it is described at compile time: camera::render_static(cornell_box, ...)
+// renders it with a compiler-built BVH and no virtual calls
+inline constexpr static_scene cornell_box{
+    std::array{
+        static_sphere{point3(-1010, 0, 0), 1000, 1}, // Left wall
+        static_sphere{point3(1010, 0, 0), 1000, 2},  // Right wall
+        static_sphere{point3(0, -1000, 0), 1000, 0}, // Floor
+        static_sphere{point3(0, 0, -1015), 1000, 0}, // Back wall
+        // Objects
+        static_sphere{point3(-3, 2, -5), 2.0, 0},
+        static_sphere{point3(3, 2, -2), 2.0, 3},
+        static_sphere{point3(0, 1, 2), 1.0, 4},
+    },
+    std::array{
+        material_params{material_type::lambertian, color(0.73, 0.73, 0.73)}, // White
+        material_params{material_type::lambertian, color(0.65, 0.05, 0.05)}, // Red
+        material_params{material_type::lambertian, color(0.12, 0.45, 0.15)}, // Green
+        material_params{material_type::dielectric, color(), 1.5},            // Glass
+        material_params{material_type::metal, color(0.8, 0.8, 0.8), 0.1},    // Metal
+    }};
+
 inline scene generate_scene()
 {
-    hittable_list world;
-
-    auto mat_white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
-    auto mat_red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    auto mat_green = std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
-    auto mat_glass = std::make_shared<dielectric>(1.5);
-    auto mat_metal = std::make_shared<metal>(color(0.8, 0.8, 0.8), 0.1);
-
-    // Left wall
-    world.add(std::make_shared<sphere>(point3(-1010, 0, 0), 1000, mat_red));
-    // Right wall
-    world.add(std::make_shared<sphere>(point3(1010, 0, 0), 1000, mat_green));
-    // Floor
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, mat_white));
-    // Back wall
-    world.add(std::make_shared<sphere>(point3(0, 0, -1015), 1000, mat_white));
-
-    // Objects
-    world.add(std::make_shared<sphere>(point3(-3, 2, -5), 2.0, mat_white));
-    world.add(std::make_shared<sphere>(point3(3, 2, -2), 2.0, mat_glass));
-    world.add(std::make_shared<sphere>(point3(0, 1, 2), 1.0, mat_metal));
+    hittable_list world = cornell_box.world();
 
     camera cam;
     cam.aspect_ratio = 1.0;
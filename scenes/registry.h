@@ -0,0 +1,81 @@
+#pragma once
+
+// Every bundled scene, for tools that render more than one scene per binary.
+//
+// Each scene header defines its own `generate_scene()`, so they are wrapped in one namespace
+// each. The engine headers are included first so their include guards keep them global.
+// Add new scenes to both lists below.
+
+#include "../src/scene.h"
+
+#include <array>
+#include <string_view>
+
+namespace scene_bokeh
+{
+#include "bokeh.h"
+}
+namespace scene_bokeh_motion
+{
+#include "bokeh_motion.h"
+}
+namespace scene_book_cover
+{
+#include "book_cover.h"
+}
+namespace scene_cornell_box
+{
+#include "cornell_box.h"
+}
+namespace scene_dna
+{
+#include "dna.h"
+}
+namespace scene_lab
+{
+#include "lab.h"
+}
+namespace scene_light
+{
+#include "light.h"
+}
+namespace scene_snowflake
+{
+#include "snowflake.h"
+}
+namespace scene_wave
+{
+#include "wave.h"
+}
+namespace scene_wave_motion
+{
+#include "wave_motion.h"
+}
+
+struct scene_entry
+{
+    std::string_view name;
+    scene (*generate)();
+};
+
+inline constexpr std::array scene_registry = {
+    scene_entry{"bokeh", scene_bokeh::generate_scene},
+    scene_entry{"bokeh_motion", scene_bokeh_motion::generate_scene},
+    scene_entry{"book_cover", scene_book_cover::generate_scene},
+    scene_entry{"cornell_box", scene_cornell_box::generate_scene},
+    scene_entry{"dna", scene_dna::generate_scene},
+    scene_entry{"lab", scene_lab::generate_scene},
+    scene_entry{"light", scene_light::generate_scene},
+    scene_entry{"snowflake", scene_snowflake::generate_scene},
+    scene_entry{"wave", scene_wave::generate_scene},
+    scene_entry{"wave_motion", scene_wave_motion::generate_scene},
+};
+
+// Returns nullptr if no scene has that name
+[[nodiscard]] inline const scene_entry *find_scene(std::string_view name)
+{
+    for (const auto &entry : scene_registry)
+        if (entry.name == name)
+            return &entry;
+    return nullptr;
+}
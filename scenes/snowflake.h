@@ -2,9 +2,9 @@
 
 #include "../src/scene.h"
 
-void add_sphere_flake(hittable_list &world, point3 center, real radius, int depth, std::shared_ptr<material> mat)
+void add_sphere_flake(hittable_list &world, const scene_arena &arena, point3 center, real radius, int depth, std::shared_ptr<material> mat)
 {
-    world.add(std::make_shared<sphere>(center, radius, mat));
+    world.add(arena.make<sphere>(center, radius, mat));
     if (depth <= 0)
         return;
 
@@ -12,26 +12,27 @@ void add_sphere_flake(hittable_list &world, point3 center, real radius, int dept
     real offset = radius + new_radius;
 
     // Recursive branches
-    add_sphere_flake(world, center + vec3(offset, 0, 0), new_radius, depth - 1, mat);
-    add_sphere_flake(world, center + vec3(-offset, 0, 0), new_radius, depth - 1, mat);
-    add_sphere_flake(world, center + vec3(0, offset, 0), new_radius, depth - 1, mat);
-    add_sphere_flake(world, center + vec3(0, -offset, 0), new_radius, depth - 1, mat);
-    add_sphere_flake(world, center + vec3(0, 0, offset), new_radius, depth - 1, mat);
-    add_sphere_flake(world, center + vec3(0, 0, -offset), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(offset, 0, 0), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(-offset, 0, 0), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(0, offset, 0), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(0, -offset, 0), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(0, 0, offset), new_radius, depth - 1, mat);
+    add_sphere_flake(world, arena, center + vec3(0, 0, -offset), new_radius, depth - 1, mat);
 }
 
 inline scene generate_scene()
 {
     hittable_list world;
+    scene_arena arena; // Spheres and materials are bump-allocated together (see src/arena.h)
 
     // 1. The Fractal "Monument" (Centerpiece)
-    auto fractal_mat = std::make_shared<metal>(color(0.9, 0.9, 0.9), 0.05);
+    auto fractal_mat = arena.make<metal>(color(0.9, 0.9, 0.9), 0.05);
     // Depth 5 = ~9,331 spheres. This is a true BVH stress test.
-    add_sphere_flake(world, point3(0, 1.5, 0), 1.5f, 5, fractal_mat);
+    add_sphere_flake(world, arena, point3(0, 1.5, 0), 1.5f, 5, fractal_mat);
 
     // 2. The Reflective Floor
-    auto floor_mat = std::make_shared<metal>(color(0.5, 0.5, 0.5), 0.1);
-    world.add(std::make_shared<sphere>(point3(0, -1000, 0), 1000, floor_mat));
+    auto floor_mat = arena.make<metal>(color(0.5, 0.5, 0.5), 0.1);
+    world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, floor_mat));
 
     // 3. Scattering colored "Book Cover" spheres on the floor
     // Using a loop to place them around the monument
@@ -44,13 +45,13 @@ inline scene generate_scene()
         // Vary the materials: some matte, some metal, some glass
         std::shared_ptr<material> sphere_mat;
         if (i % 3 == 0)
-            sphere_mat = std::make_shared<dielectric>(1.5);
+            sphere_mat = arena.make<dielectric>(1.5);
         else if (i % 3 == 1)
-            sphere_mat = std::make_shared<metal>(color(random_real(0.5, 1), random_real(0.5, 1), random_real(0.5, 1)), 0.1);
+            sphere_mat = arena.make<metal>(color(random_real(0.5, 1), random_real(0.5, 1), random_real(0.5, 1)), 0.1);
         else
-            sphere_mat = std::make_shared<lambertian>(color(random_real(), random_real(), random_real()));
+            sphere_mat = arena.make<lambertian>(color(random_real(), random_real(), random_real()));
 
-        world.add(std::make_shared<sphere>(point3(x, 0.3, z), 0.3, sphere_mat));
+        world.add(arena.make<sphere>(point3(x, 0.3, z), 0.3, sphere_mat));
     }
 
     camera cam;
@@ -5,6 +5,7 @@
 inline scene generate_scene()
 {
     hittable_list world;
+    scene_arena arena; // Spheres and materials are bump-allocated together (see src/arena.h)
 
     int grid_size = 40;
     real spacing = 1.1f;
@@ -33,18 +34,18 @@ inline scene generate_scene()
             real mat_roll = random_real();
             if (mat_roll < 0.1)
             {
-                sphere_mat = std::make_shared<dielectric>(1.5);
+                sphere_mat = arena.make<dielectric>(1.5);
             }
             else if (mat_roll < 0.2)
             {
-                sphere_mat = std::make_shared<metal>(sphere_color, 0.05);
+                sphere_mat = arena.make<metal>(sphere_color, 0.05);
             }
             else
             {
-                sphere_mat = std::make_shared<lambertian>(sphere_color);
+                sphere_mat = arena.make<lambertian>(sphere_color);
             }
 
-            world.add(std::make_shared<sphere>(center, 0.5f, std::move(sphere_mat)));
+            world.add(arena.make<sphere>(center, 0.5f, std::move(sphere_mat)));
         }
     }
 
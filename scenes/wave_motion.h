@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../src/scene.h"
+
+// wave.h caught mid-ripple: every sphere rises or falls with the wave during the exposure
+inline scene generate_scene()
+{
+    hittable_list world;
+    scene_arena arena; // Spheres and materials are bump-allocated together (see src/arena.h)
+
+    int grid_size = 40;
+    real spacing = 1.1f;
+    real phase_step = 0.6f; // How far the wave travels while the shutter is open, in radians
+
+    for (int i = 0; i < grid_size; i++)
+    {
+        for (int j = 0; j < grid_size; j++)
+        {
+            real x = (i - grid_size / 2.0f) * spacing;
+            real z = (j - grid_size / 2.0f) * spacing;
+
+            real dist = std::sqrt(x * x + z * z);
+            real y = std::sin(dist * 0.5f) * 2.5f;
+            real y_end = std::sin(dist * 0.5f - phase_step) * 2.5f;
+
+            point3 center(x, y, z);
+
+            real color_weight = (y + 2.5f) / 5.0f;
+            color sphere_color = (1.0 - color_weight) * color(0.1, 0.2, 0.8) + color_weight * color(0.1, 0.9, 0.9);
+
+            std::shared_ptr<material> sphere_mat;
+
+            real mat_roll = random_real();
+            if (mat_roll < 0.1)
+            {
+                sphere_mat = arena.make<dielectric>(1.5);
+            }
+            else if (mat_roll < 0.2)
+            {
+                sphere_mat = arena.make<metal>(sphere_color, 0.05);
+            }
+            else
+            {
+                sphere_mat = arena.make<lambertian>(sphere_color);
+            }
+
+            world.add(arena.make<sphere>(center, point3(x, y_end, z), 0.5f, std::move(sphere_mat)));
+        }
+    }
+
+    camera cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 1200;
+    cam.samples_per_pixel = 500;
+    cam.max_depth = 50;
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(20, 18, 20);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.8;
+    cam.focus_dist = std::sqrt(20 * 20 + 18 * 18 + 20 * 20);
+
+    cam.shutter_open = 0;
+    cam.shutter_close = 1;
+
+    return {world, cam};
+}
@@ -1,6 +1,31 @@
 #pragma once
 #include "common.h"
 
+#if RT_SIMD_SSE
+namespace simd_detail
+{
+    // Slab test of the box [lo, hi] in lanes 0-2 (lane 3 is ignored) against `r` within `ray_t`
+    [[nodiscard]] inline bool slab_hit(__m128 lo, __m128 hi, const ray &r, const interval &ray_t) noexcept
+    {
+        __m128 orig = r.origin().simd(), adinv = r.inverse_direction().simd();
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, orig), adinv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, orig), adinv);
+        __m128 near = _mm_min_ps(t0, t1);
+        __m128 far = _mm_max_ps(t0, t1);
+
+        // Reduce lanes 0-2: entry is the latest near plane, exit the earliest far plane
+        __m128 near_y = _mm_shuffle_ps(near, near, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 far_y = _mm_shuffle_ps(far, far, _MM_SHUFFLE(1, 1, 1, 1));
+        near = _mm_max_ss(_mm_max_ss(near, near_y), _mm_movehl_ps(near, near));
+        far = _mm_min_ss(_mm_min_ss(far, far_y), _mm_movehl_ps(far, far));
+
+        real t_enter = std::max(ray_t.min, _mm_cvtss_f32(near));
+        real t_exit = std::min(ray_t.max, _mm_cvtss_f32(far));
+        return t_enter < t_exit;
+    }
+}
+#endif
+
 class aabb
 {
 public:
@@ -26,6 +51,14 @@ public:
         z = interval(box0.z, box1.z);
     }
 
+    // The box `t` of the way from `a` to `b`, corner by corner
+    [[nodiscard]] static aabb lerp(const aabb &a, const aabb &b, real t)
+    {
+        auto mix = [t](const interval &from, const interval &to)
+        { return interval(from.min + t * (to.min - from.min), from.max + t * (to.max - from.max)); };
+        return aabb(mix(a.x, b.x), mix(a.y, b.y), mix(a.z, b.z));
+    }
+
     const interval &axis(int n) const
     {
         if (n == 1)
@@ -39,15 +72,24 @@ public:
     [[nodiscard]] constexpr bool hit(const ray &r, interval ray_t) const
     {
         const point3 &ray_orig = r.origin();
-        const vec3 &ray_dir = r.direction();
+        const vec3 &adinv = r.inverse_direction();
+
+#if RT_SIMD_SSE
+        if !consteval
+        {
+            // All three slabs at once; lane 3 is never reduced
+            __m128 lo, hi;
+            corners(lo, hi);
+            return simd_detail::slab_hit(lo, hi, r, ray_t);
+        }
+#endif
 
         for (int axis = 0; axis < 3; axis++)
         {
             const interval &ax = this->axis(axis);
-            const real adinv = 1.0f / ray_dir[axis];
 
-            auto t0 = (ax.min - ray_orig[axis]) * adinv;
-            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+            auto t0 = (ax.min - ray_orig[axis]) * adinv[axis];
+            auto t1 = (ax.max - ray_orig[axis]) * adinv[axis];
 
             if (t0 < t1)
             {
@@ -70,6 +112,29 @@ public:
         return true;
     }
 
+    // Ray-box intersection test against the box `t` of the way from this box to `end`
+    [[nodiscard]] bool hit_at(const aabb &end, real t, const ray &r, interval ray_t) const
+    {
+#if RT_SIMD_SSE
+        // Interpolated in registers: building the box in memory first would stall the loads
+        __m128 lo0, hi0, lo1, hi1;
+        corners(lo0, hi0);
+        end.corners(lo1, hi1);
+        __m128 weight = _mm_set1_ps(t);
+        __m128 lo = _mm_add_ps(lo0, _mm_mul_ps(weight, _mm_sub_ps(lo1, lo0)));
+        __m128 hi = _mm_add_ps(hi0, _mm_mul_ps(weight, _mm_sub_ps(hi1, hi0)));
+        return simd_detail::slab_hit(lo, hi, r, ray_t);
+#else
+        return lerp(*this, end, t).hit(r, ray_t);
+#endif
+    }
+
+    // Half the surface area, which is proportional to the chance a random ray hits the box
+    [[nodiscard]] real half_area() const
+    {
+        return x.size() * y.size() + y.size() * z.size() + z.size() * x.size();
+    }
+
     // Returns the index of the longest side (0:x, 1:y, 2:z)
     int longest_axis() const
     {
@@ -80,6 +145,20 @@ public:
     }
 
     static const aabb empty, universe;
+
+private:
+#if RT_SIMD_SSE
+    // The min and max corners in lanes 0-2. The intervals are laid out as
+    // [x.min x.max y.min y.max z.min z.max], so two loads and two shuffles gather them.
+    void corners(__m128 &lo, __m128 &hi) const noexcept
+    {
+        static_assert(sizeof(aabb) == 6 * sizeof(float));
+        __m128 xy = _mm_loadu_ps(&x.min);
+        __m128 zz = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(&z.min)));
+        lo = _mm_shuffle_ps(xy, zz, _MM_SHUFFLE(1, 0, 2, 0));
+        hi = _mm_shuffle_ps(xy, zz, _MM_SHUFFLE(0, 1, 3, 1));
+    }
+#endif
 };
 
 // Define the static constants
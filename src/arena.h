@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+
+// Monotonic arena for scene objects, materials and BVH nodes. make<T>() returns an ordinary
+// std::shared_ptr, so objects mix freely with heap-allocated ones, but the object and its
+// control block come from a bump allocator: construction is a pointer increment, freeing an
+// object only runs its destructor, and the arena's blocks are released in one go once the
+// arena handle and every object made from it are gone (each object keeps the arena alive).
+// Objects made one after another sit next to each other in memory, which helps traversal.
+//
+//   scene_arena arena;
+//   auto mat = arena.make<lambertian>(color(0.5, 0.5, 0.5));
+//   world.add(arena.make<sphere>(point3(0, 0, 0), 1, mat));
+//
+// An arena is not thread-safe; build each one from a single thread. Memory of destroyed
+// objects is not reused, so an arena suits data that lives and dies together.
+
+class scene_arena
+{
+public:
+    explicit scene_arena(size_t initial_block = 1 << 20) : state(new arena_state(initial_block)) {}
+    scene_arena(const scene_arena &other) noexcept : state(other.state) { state->retain(); }
+    scene_arena &operator=(const scene_arena &other) noexcept
+    {
+        other.state->retain();
+        state->release();
+        state = other.state;
+        return *this;
+    }
+    ~scene_arena() { state->release(); }
+
+    template <typename T, typename... Args>
+    [[nodiscard]] std::shared_ptr<T> make(Args &&...args) const
+    {
+        return std::allocate_shared<T>(allocator<T>{state}, std::forward<Args>(args)...);
+    }
+
+    // Bytes taken from the system for the arena's blocks, and the number of objects made
+    [[nodiscard]] size_t reserved_bytes() const noexcept { return state->upstream.bytes; }
+    [[nodiscard]] size_t object_count() const noexcept { return state->objects; }
+
+private:
+    // Counts what the monotonic resource asks of the heap
+    struct counting_resource : std::pmr::memory_resource
+    {
+        size_t bytes = 0;
+
+        void *do_allocate(size_t size, size_t alignment) override
+        {
+            bytes += size;
+            return std::pmr::new_delete_resource()->allocate(size, alignment);
+        }
+        void do_deallocate(void *p, size_t size, size_t alignment) override
+        {
+            bytes -= size;
+            std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+        }
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+    };
+
+    // Freed when the last handle and the last object are gone: every handle and every object
+    // holds one reference. Objects take theirs in allocate() and drop it in deallocate(), which
+    // run once per object, so copies of the allocator inside allocate_shared cost nothing.
+    struct arena_state
+    {
+        counting_resource upstream;
+        std::pmr::monotonic_buffer_resource resource;
+        std::atomic<size_t> references{1};
+        size_t objects = 0;
+
+        explicit arena_state(size_t initial_block) : resource(initial_block, &upstream) {}
+
+        void retain() noexcept { references.fetch_add(1, std::memory_order_relaxed); }
+        void release() noexcept
+        {
+            if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+    };
+
+    template <typename T>
+    struct allocator
+    {
+        using value_type = T;
+        arena_state *state;
+
+        explicit allocator(arena_state *state) noexcept : state(state) {}
+        template <typename U>
+        allocator(const allocator<U> &other) noexcept : state(other.state) {}
+
+        T *allocate(size_t n)
+        {
+            auto p = static_cast<T *>(state->resource.allocate(n * sizeof(T), alignof(T)));
+            state->objects++;
+            state->retain();
+            return p;
+        }
+        // The memory itself is only returned with the whole arena
+        void deallocate(T *, size_t) noexcept { state->release(); }
+
+        template <typename U>
+        bool operator==(const allocator<U> &other) const noexcept { return state == other.state; }
+    };
+
+    arena_state *state;
+};
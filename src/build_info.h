@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+// Describes the machine and build configuration, for performance logs and benchmark reports
+
+[[nodiscard]] inline std::string compiler_info()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// Reconstructs the relevant compiler flags from the macros they define
+[[nodiscard]] inline std::string build_flags()
+{
+    std::string flags;
+    auto add = [&flags](const char *flag)
+    {
+        if (!flags.empty())
+            flags += ' ';
+        flags += flag;
+    };
+
+#if defined(__OPTIMIZE__)
+    add("-O");
+#else
+    add("-O0");
+#endif
+#if defined(__FAST_MATH__)
+    add("-ffast-math");
+#endif
+#if defined(NDEBUG)
+    add("-DNDEBUG");
+#endif
+#if defined(RT_PRECISION_DOUBLE)
+    add("-DRT_PRECISION_DOUBLE");
+#elif defined(RT_PRECISION_MIXED)
+    add("-DRT_PRECISION_MIXED");
+#endif
+#if defined(__AVX512F__)
+    add("avx512f");
+#elif defined(__AVX2__)
+    add("avx2");
+#elif defined(__AVX__)
+    add("avx");
+#elif defined(__SSE4_2__)
+    add("sse4.2");
+#elif defined(__SSE2__)
+    add("sse2");
+#endif
+#if defined(__FMA__)
+    add("fma");
+#endif
+    return flags;
+}
+
+[[nodiscard]] inline unsigned hardware_threads()
+{
+    return std::thread::hardware_concurrency();
+}
+
+[[nodiscard]] inline std::string host_name()
+{
+    for (const char *var : {"HOSTNAME", "COMPUTERNAME"})
+        if (const char *name = std::getenv(var))
+            return name;
+
+    // Not exported by most shells, fall back to the kernel's view on Linux
+    std::ifstream file("/proc/sys/kernel/hostname");
+    std::string name;
+    if (std::getline(file, name) && !name.empty())
+        return name;
+    return "unknown";
+}
+
+[[nodiscard]] inline std::string cpu_model()
+{
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    for (std::string line; std::getline(cpuinfo, line);)
+    {
+        if (line.starts_with("model name"))
+        {
+            auto colon = line.find(':');
+            if (colon != std::string::npos)
+                return line.substr(line.find_first_not_of(' ', colon + 1));
+        }
+    }
+    return "unknown";
+}
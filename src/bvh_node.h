@@ -1,28 +1,96 @@
 #pragma once
 
 #include "common.h"
+#include "arena.h"
 #include "hittable.h"
 #include "hittable_list.h"
 
 #include <algorithm>
 
+// Leaf of more than two objects, tested one after another behind a single box test. Trees
+// built with a leaf size above 2 end in these instead of splitting down to pairs.
+class bvh_leaf final : public hittable
+{
+public:
+    bvh_leaf(const std::vector<std::shared_ptr<hittable>> &objects, size_t start, size_t end)
+        : objects(objects.begin() + start, objects.begin() + end)
+    {
+        bbox = aabb::empty;
+        for (const auto &object : this->objects)
+        {
+            bbox = aabb(bbox, object->bounding_box());
+            motion = motion || object->moving();
+        }
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (!bbox.hit(r, ray_t))
+            return false;
+        bool hit_anything = false;
+        for (const auto &object : objects)
+            if (object->hit(r, ray_t, rec))
+            {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool moving() const override { return motion; }
+    aabb bounding_box_at(real time) const override
+    {
+        aabb box = aabb::empty;
+        for (const auto &object : objects)
+            box = aabb(box, object->bounding_box_at(time));
+        return box;
+    }
+
+private:
+    std::vector<std::shared_ptr<hittable>> objects;
+    aabb bbox;
+    bool motion = false;
+};
+
+// Inner nodes are allocated from an arena of their own (see arena.h), in depth-first order,
+// and all freed together with the tree. Subtrees holding moving objects are motion_bvh_nodes,
+// which interpolate their box by ray time, so a fast object only widens the nodes above it
+// as far as it moves within a ray's time rather than over the whole shutter. Spans of at most
+// `leaf_size` objects become one bvh_leaf; the default of 2 splits down to pairs.
 class bvh_node : public hittable
 {
 public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {}
+    bvh_node(hittable_list list, size_t leaf_size = 2) : bvh_node(list.objects, 0, list.objects.size(), leaf_size) {}
+
+    bvh_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start, size_t end, size_t leaf_size = 2)
+        : bvh_node(objects, start, end, scene_arena(node_block_bytes(end - start)), leaf_size) {}
 
-    bvh_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start, size_t end)
+    bvh_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start, size_t end, const scene_arena &arena,
+             size_t leaf_size = 2)
     {
         // Build the bounding box of the span of objects
         bbox = aabb::empty; // You might need to define aabb::empty in aabb.h
+        bool motion = false;
         for (size_t i = start; i < end; i++)
+        {
             bbox = aabb(bbox, objects[i]->bounding_box());
+            motion = motion || objects[i]->moving();
+        }
 
-        int axis = bbox.longest_axis(); // Get the best axis to split on
-        auto comparator = (axis == 0)   ? box_x_compare
-                          : (axis == 1) ? box_y_compare
-                                        : box_z_compare;
+        // Moving objects are split by where they are halfway through the shutter
+        auto split_box = [motion](const hittable &object)
+        { return motion ? object.bounding_box_at(0.5f) : object.bounding_box(); };
+        aabb extent = bbox;
+        if (motion)
+        {
+            extent = aabb::empty;
+            for (size_t i = start; i < end; i++)
+                extent = aabb(extent, split_box(*objects[i]));
+        }
 
+        int axis = extent.longest_axis(); // Get the best axis to split on
         size_t object_span = end - start;
 
         if (object_span == 1)
@@ -36,10 +104,12 @@ public:
         }
         else
         {
-            std::sort(objects.begin() + start, objects.begin() + end, comparator);
+            std::sort(objects.begin() + start, objects.begin() + end,
+                      [&](const std::shared_ptr<hittable> &a, const std::shared_ptr<hittable> &b)
+                      { return split_box(*a).axis(axis).min < split_box(*b).axis(axis).min; });
             auto mid = start + object_span / 2;
-            left = std::make_shared<bvh_node>(objects, start, mid);
-            right = std::make_shared<bvh_node>(objects, mid, end);
+            left = make_node(objects, start, mid, arena, motion, leaf_size);
+            right = make_node(objects, mid, end, arena, motion, leaf_size);
         }
     }
 
@@ -47,39 +117,93 @@ public:
     {
         if (!bbox.hit(r, ray_t))
             return false;
+        return hit_children(r, ray_t, rec);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // Nodes in this subtree, this one and its leaves included
+    [[nodiscard]] size_t node_count() const
+    {
+        size_t count = 1;
+        for (const auto *child : {left.get(), right.get()})
+            if (auto node = dynamic_cast<const bvh_node *>(child))
+                count += node->node_count();
+            else if (dynamic_cast<const bvh_leaf *>(child))
+                count++;
+        return count;
+    }
 
+protected:
+    [[nodiscard]] bool hit_children(const ray &r, interval ray_t, hit_record &rec) const
+    {
         bool hit_left = left->hit(r, ray_t, rec);
         bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
 
         return hit_left || hit_right;
     }
 
-    aabb bounding_box() const override { return bbox; }
-
 private:
     std::shared_ptr<hittable> left;
     std::shared_ptr<hittable> right;
-    aabb bbox;
-
-    static bool box_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis_index)
+    aabb bbox; // Over the whole shutter interval
+
+    // A bvh_leaf over [start, end) if it has more than two objects but no more than
+    // `leaf_size`, else a motion_bvh_node if the objects there sweep out much more than they
+    // cover at either end of the shutter (only possible if `motion` is set for the parent's
+    // span), a bvh_node otherwise
+    static constexpr real motion_threshold = 1.25f;
+    static std::shared_ptr<hittable> make_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start,
+                                               size_t end, const scene_arena &arena, bool motion, size_t leaf_size);
+
+    // Room for the inner nodes of a tree over `objects` primitives (fewer than one per
+    // primitive) with their shared_ptr control blocks, so one block usually holds the tree
+    [[nodiscard]] static size_t node_block_bytes(size_t objects)
     {
-        auto a_axis_interval = a->bounding_box().axis(axis_index);
-        auto b_axis_interval = b->bounding_box().axis(axis_index);
-        return a_axis_interval.min < b_axis_interval.min;
+        return std::max<size_t>(objects, 1) * (sizeof(bvh_node) + 48);
     }
+};
 
-    static bool box_x_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
-    {
-        return box_compare(a, b, 0);
-    }
+// Inner node over moving objects: its box at a ray's time is interpolated between the boxes of
+// its objects at times 0 and 1, which contains every object moving linearly in between
+class motion_bvh_node final : public bvh_node
+{
+public:
+    motion_bvh_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start, size_t end, const scene_arena &arena,
+                    size_t leaf_size, const aabb &start_box, const aabb &end_box)
+        : bvh_node(objects, start, end, arena, leaf_size), start_box(start_box), end_box(end_box) {}
 
-    static bool box_y_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
-        return box_compare(a, b, 1);
+        if (!start_box.hit_at(end_box, r.time(), r, ray_t))
+            return false;
+        return hit_children(r, ray_t, rec);
     }
 
-    static bool box_z_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
+    bool moving() const override { return true; }
+    aabb bounding_box_at(real time) const override { return aabb::lerp(start_box, end_box, time); }
+
+private:
+    aabb start_box, end_box;
+};
+
+inline std::shared_ptr<hittable> bvh_node::make_node(std::vector<std::shared_ptr<hittable>> &objects, size_t start,
+                                                     size_t end, const scene_arena &arena, bool motion, size_t leaf_size)
+{
+    if (end - start > 2 && end - start <= leaf_size)
+        return arena.make<bvh_leaf>(objects, start, end);
+    if (motion)
     {
-        return box_compare(a, b, 2);
+        aabb sweep = aabb::empty, start_box = aabb::empty, end_box = aabb::empty;
+        for (size_t i = start; i < end; i++)
+        {
+            sweep = aabb(sweep, objects[i]->bounding_box());
+            start_box = aabb(start_box, objects[i]->bounding_box_at(0));
+            end_box = aabb(end_box, objects[i]->bounding_box_at(1));
+        }
+        // Interpolating costs a little per test, so only where the sweep is much larger
+        if (sweep.half_area() > motion_threshold * std::max(start_box.half_area(), end_box.half_area()))
+            return arena.make<motion_bvh_node>(objects, start, end, arena, leaf_size, start_box, end_box);
     }
-};
\ No newline at end of file
+    return arena.make<bvh_node>(objects, start, end, arena, leaf_size);
+}
@@ -1,11 +1,21 @@
 #pragma once
 
-#include "../external/stb_image_write.h"
+#include "image_writer.h"
 
 #include "common.h"
 #include "hittable.h"
 #include "material.h"
 #include "bvh_node.h"
+#include "flat_bvh.h"
+#include "environment.h"
+#include "photon_map.h"
+#include "path_guide.h"
+#include "texture.h"
+#include "memory.h"
+#include "tuning.h"
+#include "cpu_dispatch.h"
+#include "trace.h"
+#include "build_info.h"
 
 #include <vector>
 #include <execution>
@@ -13,6 +23,10 @@
 #include <print>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <atomic>
+#include <future>
+#include <numeric>
 
 class camera
 {
@@ -30,36 +44,549 @@ public:
     real defocus_angle = 0; // Variation angle of rays through each pixel
     real focus_dist = 10;   // Distance from camera lookfrom point to plane of perfect focus
 
+    // Shutter interval in scene time, within [0, 1] over which moving spheres travel. Each
+    // camera ray gets a random time in it; equal values (the default) freeze motion. Renders
+    // throw std::invalid_argument unless 0 <= shutter_open <= shutter_close <= 1.
+    real shutter_open = 0;
+    real shutter_close = 0;
+
+    std::uint64_t seed = 0; // Base seed of the per-sample random streams (same seed, same image)
+
+    // Wall-clock seconds for the tile render (0 = no limit). Samples are then added in rounds
+    // over the whole image, up to samples_per_pixel, until the budget runs out.
+    double time_budget = 0;
+
+    std::string trace_file = "";    // Chrome trace JSON output path (empty disables tracing)
+    std::string bvh_cache_dir = ""; // Reuse BVHs saved by earlier runs from here (empty disables caching)
+    int band_rows = 0;              // Stream the image to disk in bands of this many rows (0 keeps the whole frame)
+
+    // Machine-dependent settings. At 0 they come from this host's tuning profile (see
+    // tuning.h and tools/autotune.cpp), or the default in brackets when it has none.
+    int tile_size = 0;     // Pixels per side of a render tile [16]
+    int threads = 0;       // Worker threads [every hardware thread]
+    int bvh_leaf_size = 0; // Most objects per BVH leaf [2]
+
+    std::shared_ptr<const environment_map> environment; // Image-based lighting in place of the sky gradient
+
+    // Bytes the render may use (0 = no limit). Renders estimate their memory before building
+    // anything and pick cheaper representations until it fits: a compact flat BVH, a smaller
+    // texture cache, streaming the image in bands. Failing that they throw memory_budget_error
+    // with the breakdown, instead of running out of memory halfway.
+    size_t memory_budget = 0;
+
+    // Caustics from a photon map (see photon_map.h): photons traced per pass (0 = path tracing
+    // alone), the initial gather radius in scene units, and the number of passes
+    // samples_per_pixel is spread over. The radius shrinks after every pass.
+    int caustic_photons = 0;
+    real caustic_radius = 0.05f;
+    int caustic_passes = 4;
+
+    // Learn where light comes from while rendering and steer diffuse bounces there (see
+    // path_guide.h). Samples are then taken in rounds of doubling size, each training the guide
+    // the next one samples from.
+    bool path_guiding = false;
+
+    // Relative RMS error to estimate the samples per pixel for, from the variance of the last
+    // round of samples (0 = no estimate), e.g. 0.01 for 1%
+    real target_error = 0;
+
+    struct tile_event
+    {
+        int x, y, width, height; // Pixel rectangle that was just finished
+        int done, total;         // Tiles finished so far, out of all tiles
+    };
+
+    // Hooks for services embedding the renderer. on_tile runs on the worker thread that
+    // finished the tile; once *cancel is set, remaining tiles are skipped.
+    std::function<void(const tile_event &)> on_tile;
+    const std::atomic<bool> *cancel = nullptr;
+
+    struct render_stats
+    {
+        double build_seconds = 0;  // BVH construction
+        double render_seconds = 0; // Tile rendering
+        uint64_t rays = 0;         // Camera rays traced
+        bool cancelled = false;    // Stopped through `cancel` before all tiles were done
+        double spp = 0;            // Mean samples per pixel taken, when a time budget was set
+        uint64_t photons = 0;      // Caustic photons stored, over all passes
+        double spp_for_target = 0; // Samples per pixel estimated to reach target_error
+        tile_cache::statistics textures; // Texture tile lookups during the render, and cache use after it
+        memory_report memory;            // Bytes per subsystem, peak RSS and heap allocations
+
+        [[nodiscard]] double mrays_s() const { return (rays / render_seconds) / 1'000'000.0; }
+    };
+
+    // Renders and saves to images/<filename>; the extension picks the format (see image_writer.h)
     void render(const hittable_list &world, std::string_view filename = "render.png")
+    {
+        std::vector<Pixel> pixels;
+        render(world, filename, pixels);
+    }
+
+    // Same as above, reusing `pixels` as the framebuffer (handy when rendering many images).
+    // Float formats, band_rows and budgets too small for the whole frame stream the image in
+    // bands instead (render_streamed), leaving `pixels` untouched.
+    void render(const hittable_list &world, std::string_view filename, std::vector<Pixel> &pixels)
+    {
+        // A budget too small for the whole frame streams it in bands instead, when it can
+        int rows = band_rows;
+        if (memory_budget > 0 && rows == 0 && !is_float_image(filename) && !renders_in_rounds())
+        {
+            initialize();
+            rows = fit_memory_budget(world, 0, true).rows;
+        }
+
+        if (!trace_file.empty())
+            trace::start();
+        if (rows > 0 || is_float_image(filename))
+        {
+            render_streamed(world, filename, rows);
+            finish_trace();
+            return;
+        }
+        finish(render_pixels(world, pixels), pixels, filename);
+    }
+
+    // Builds the BVH and renders the image into `pixels`, without saving or logging anything.
+    // Throws memory_budget_error if the whole frame does not fit memory_budget; render() streams
+    // such images in bands instead.
+    render_stats render_pixels(const hittable_list &world, std::vector<Pixel> &pixels)
     {
         initialize();
-        auto world_bvh = std::make_shared<bvh_node>(world);
-        std::vector<Pixel> pixels(image_width * image_height);
+        tile_cache::capacity_scope cache_capacity(tile_cache::shared());
+        apply_plan(fit_memory_budget(world, 0, false));
+        auto allocations_before = allocation_totals();
+        auto build_start = std::chrono::high_resolution_clock::now();
+        std::shared_ptr<hittable> world_bvh;
+        {
+            trace::scope phase("build_bvh");
+            world_bvh = build_acceleration(world);
+        }
+        auto build_end = std::chrono::high_resolution_clock::now();
 
-        // Generate tiles for parallel rendering
-        const int tile_size = 16;
-        auto tiles = generate_tiles(tile_size);
+        caustic_sources = (caustic_photons > 0) ? photon_sources::gather(world) : photon_sources{};
+        auto stats = render_built(*world_bvh, pixels);
+        stats.build_seconds = std::chrono::duration<double>(build_end - build_start).count();
+        stats.memory = measure_memory(world, *world_bvh, 0, allocations_before);
+        plan = {};
+        return stats;
+    }
 
+    // Renders an already built acceleration structure, e.g. a flat_bvh::open()ed file. Caustic
+    // photons need the scene's lights: render_pixels() gathers them, other callers must pass
+    // them to set_caustic_sources() first, or this throws std::invalid_argument. The structure
+    // is already built, so a memory_budget cannot be planned for and throws too.
+    render_stats render_prebuilt(const hittable &world_bvh, std::vector<Pixel> &pixels)
+    {
+        if (caustic_photons > 0 && !caustic_sources.gathered)
+            throw std::invalid_argument("render_prebuilt: caustic photons need the scene's lights; call set_caustic_sources() first");
+        if (memory_budget > 0)
+            throw std::invalid_argument("render_prebuilt: memory_budget needs render() or render_pixels(), which build the scene to fit it");
+        return render_built(world_bvh, pixels);
+    }
+
+    // The lights and specular spheres render_prebuilt() traces caustic photons between, from
+    // photon_sources::gather() on the world the BVH was built from
+    void set_caustic_sources(photon_sources sources) { caustic_sources = std::move(sources); }
+
+    // Renders band by band straight into the writer for `filename`, so only two bands of
+    // linear colors are ever held: one being rendered while the previous one is encoded.
+    // Float formats get unclamped values, 8-bit ones the same pixels render() produces.
+    // Bands are `rows` rows high, band_rows when 0 (the whole image when that is 0 too).
+    // Round-based renders (see renders_in_rounds) need the whole frame, so they throw
+    // std::invalid_argument.
+    render_stats render_streamed(const hittable_list &world, std::string_view filename, int rows = 0)
+    {
+        if (renders_in_rounds())
+            throw std::invalid_argument("render_streamed: time budgets, caustic photons, path guiding and target errors need the whole frame; render an 8-bit format without band_rows");
+        thread_limit limit(worker_threads());
+        initialize();
+        if (rows <= 0)
+            rows = band_rows > 0 ? std::min(band_rows, image_height) : image_height;
+        tile_cache::capacity_scope cache_capacity(tile_cache::shared());
+        apply_plan(fit_memory_budget(world, rows, false));
+        auto allocations_before = allocation_totals();
+        auto build_start = std::chrono::high_resolution_clock::now();
+        std::shared_ptr<hittable> world_bvh;
+        {
+            trace::scope phase("build_bvh");
+            world_bvh = build_acceleration(world);
+        }
+        auto build_end = std::chrono::high_resolution_clock::now();
+
+        initialize();
+        render_stats stats;
+        stats.build_seconds = std::chrono::duration<double>(build_end - build_start).count();
+        auto textures_before = tile_cache::shared().stats();
+
+        auto full_path = image_path(filename);
+        auto writer = open_image_writer(full_path, image_width, image_height);
+        rows = std::min(rows, image_height);
+        const int tile_side = tile_pixels();
+        const int total_tiles = ((image_width + tile_side - 1) / tile_side) *
+                                ((image_height + tile_side - 1) / tile_side);
+
+        std::vector<color> bands[2];
+        std::future<void> encoding;
         std::atomic<uint64_t> total_rays{0};
+        std::atomic<int> tiles_done{0};
         auto start_time = std::chrono::high_resolution_clock::now();
 
-        // Core render loop
-        std::for_each(std::execution::par, tiles.begin(), tiles.end(),
-                      [this, &world_bvh, &pixels, &total_rays](const Tile &tile)
+        for (int y0 = 0, b = 0; y0 < image_height && !stats.cancelled; y0 += rows, b ^= 1)
+        {
+            const int height = std::min(rows, image_height - y0);
+            auto &band = bands[b];
+            band.resize(static_cast<size_t>(image_width) * height);
+
+            std::vector<Tile> tiles;
+            for (int y = 0; y < height; y += tile_side)
+                for (int x = 0; x < image_width; x += tile_side)
+                    tiles.push_back({x, y, std::min(tile_side, image_width - x), std::min(tile_side, height - y)});
+
+            {
+                trace::scope phase("render_band", y0);
+                std::for_each(std::execution::par, tiles.begin(), tiles.end(),
+                              [&](const Tile &tile)
+                              {
+                                  if (cancel && cancel->load(std::memory_order_relaxed))
+                                      return;
+                                  for (int j = tile.y_start; j < tile.y_start + tile.height; ++j)
+                                      for (int i = tile.x_start; i < tile.x_start + tile.width; ++i)
+                                          band[j * image_width + i] = sample_pixel(i, y0 + j, *world_bvh) * (1.0f / samples_per_pixel);
+                                  total_rays += static_cast<uint64_t>(tile.width) * tile.height * samples_per_pixel;
+                                  int done = ++tiles_done;
+                                  if (on_tile)
+                                      on_tile({tile.x_start, y0 + tile.y_start, tile.width, tile.height, done, total_tiles});
+                              });
+            }
+
+            // The previous band must be on disk before its buffer is reused for the next one
+            if (encoding.valid())
+                encoding.get();
+            stats.cancelled = cancel && cancel->load();
+            if (!stats.cancelled)
+                encoding = std::async(std::launch::async, [&writer, finished = std::span<const color>(band)]
+                                      {
+                                          trace::scope phase("encode_band");
+                                          writer->write_rows(finished); });
+        }
+        if (encoding.valid())
+            encoding.get();
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        stats.render_seconds = std::chrono::duration<double>(end_time - start_time).count();
+        stats.rays = total_rays.load();
+        stats.textures = texture_use_since(textures_before);
+        stats.memory = measure_memory(world, *world_bvh, rows, allocations_before);
+        plan = {};
+
+        if (stats.cancelled)
+        {
+            writer.reset();
+            std::filesystem::remove(full_path);
+            std::println(stderr, "Cancelled: {} not saved", filename);
+            return stats;
+        }
+        writer->finish();
+        report_results(full_path, stats);
+        return stats;
+    }
+
+    struct preview_stage
+    {
+        int index;      // 0 for the first, coarsest image
+        int block;      // Pixels are shown as block x block squares (1 = full resolution)
+        int spp;        // Samples per pixel so far
+        double seconds; // Since the render started
+    };
+
+    // Renders coarse to fine and publishes an image after every stage: first one sample on a
+    // grid of every 16th pixel in each direction, then every 8th, 4th, 2nd and every pixel,
+    // then doubling samples per pixel up to samples_per_pixel. No sample is ever thrown away;
+    // the last stage is exactly the image render() produces. Round-based settings (see
+    // renders_in_rounds) would change that image, so they throw std::invalid_argument.
+    //
+    // Each stage replaces images/<filename> atomically (written aside, then renamed), or is
+    // passed to `on_stage` instead when given. Stages are 8-bit pixels, so saving them to a
+    // float format throws std::invalid_argument too, as does a memory_budget, which only
+    // render() plans for. Stops between stages once *cancel is set.
+    render_stats render_progressive(const hittable_list &world, std::string_view filename,
+                                    const std::function<void(const preview_stage &, const std::vector<Pixel> &)> &on_stage = {})
+    {
+        if (renders_in_rounds())
+            throw std::invalid_argument("render_progressive: time budgets, caustic photons, path guiding and target errors need render()");
+        if (!on_stage && is_float_image(filename))
+            throw std::invalid_argument("render_progressive: " + std::string(filename) + ": float formats need render()");
+        if (memory_budget > 0)
+            throw std::invalid_argument("render_progressive: memory_budget needs render()");
+
+        thread_limit limit(worker_threads());
+        if (!trace_file.empty())
+            trace::start();
+        auto start_time = std::chrono::high_resolution_clock::now();
+        auto elapsed = [&]
+        { return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count(); };
+
+        std::shared_ptr<hittable> world_bvh;
+        {
+            trace::scope phase("build_bvh");
+            world_bvh = build_acceleration(world);
+        }
+        initialize();
+        render_stats stats;
+        stats.build_seconds = elapsed();
+        auto textures_before = tile_cache::shared().stats();
+
+        std::vector<color> sums(static_cast<size_t>(image_width) * image_height);
+        std::vector<Pixel> pixels(sums.size());
+        std::vector<int> rows(image_height);
+        std::iota(rows.begin(), rows.end(), 0);
+        std::atomic<uint64_t> total_rays{0};
+        int index = 0;
+
+        auto publish = [&](int block, int spp)
+        {
+            // Every pixel shows the sample sum of the top-left pixel of its block
+            real scale = 1.0f / spp;
+            std::for_each(std::execution::par, rows.begin(), rows.end(),
+                          [&](int j)
+                          {
+                              int source_row = j - j % block;
+                              for (int i = 0; i < image_width; i++)
+                                  pixels[j * image_width + i] = to_pixel(sums[source_row * image_width + i - i % block] * scale);
+                          });
+            preview_stage stage{index++, block, spp, elapsed()};
+            if (on_stage)
+                on_stage(stage, pixels);
+            else
+            {
+                std::filesystem::path partial(filename);
+                partial.replace_filename(partial.filename().string() + ".partial" + partial.extension().string());
+                auto path = image_path(filename);
+                std::filesystem::rename(save_image(pixels, partial.string()), path);
+                std::println(stderr, "Preview {}: {} | {}x{} blocks, {} spp | {:.3f}s",
+                             stage.index, path.string(), block, block, spp, stage.seconds);
+            }
+        };
+        auto cancelled = [this]
+        { return cancel && cancel->load(std::memory_order_relaxed); };
+
+        // Resolution stages: one sample on each pixel of the grid not sampled by a coarser one
+        for (int block = 16; block >= 1 && !cancelled(); block /= 2)
+        {
+            trace::scope phase("preview_grid", block);
+            std::for_each(std::execution::par, rows.begin(), rows.end(),
+                          [&](int j)
+                          {
+                              if (j % block != 0)
+                                  return;
+                              bool coarse_row = block < 16 && j % (block * 2) == 0;
+                              uint64_t rays = 0;
+                              for (int i = 0; i < image_width; i += block)
+                              {
+                                  if (coarse_row && i % (block * 2) == 0)
+                                      continue; // Sampled in an earlier stage
+                                  accumulate_samples(i, j, *world_bvh, 0, 1, sums[j * image_width + i]);
+                                  rays++;
+                              }
+                              total_rays += rays;
+                          });
+            publish(block, 1);
+        }
+
+        // Sample stages: double the samples of every pixel until samples_per_pixel is reached
+        int spp = 1;
+        while (spp < samples_per_pixel && !cancelled())
+        {
+            int next = std::min(spp * 2, samples_per_pixel);
+            trace::scope phase("preview_samples", next);
+            std::for_each(std::execution::par, rows.begin(), rows.end(),
+                          [&](int j)
+                          {
+                              if (cancelled())
+                                  return;
+                              for (int i = 0; i < image_width; i++)
+                                  accumulate_samples(i, j, *world_bvh, spp, next, sums[j * image_width + i]);
+                              total_rays += static_cast<uint64_t>(image_width) * (next - spp);
+                          });
+            if (cancelled())
+                break;
+            spp = next;
+            publish(1, spp);
+        }
+
+        stats.render_seconds = elapsed() - stats.build_seconds;
+        stats.rays = total_rays.load();
+        stats.cancelled = spp < samples_per_pixel || cancelled();
+        stats.textures = texture_use_since(textures_before);
+        if (!stats.cancelled && !on_stage)
+            report_results(image_path(filename), stats);
+        finish_trace();
+        return stats;
+    }
+
+    // Renders a compile-time scene (static_scene.h) through its own kernel, with no virtual
+    // calls or allocation per ray; the image matches render() of scene.world() (see
+    // static_scene.h). It renders whole frames of plain samples to 8-bit files, so environment
+    // maps, memory budgets, band_rows, float formats and round-based settings (see
+    // renders_in_rounds) throw std::invalid_argument before anything is rendered.
+    template <typename Scene>
+    render_stats render_static(const Scene &scene, std::string_view filename)
+    {
+        if (environment)
+            throw std::invalid_argument("render_static: static scenes use the sky background, not an environment map");
+        if (memory_budget > 0)
+            throw std::invalid_argument("render_static: static scenes are not planned against a memory_budget");
+        if (renders_in_rounds())
+            throw std::invalid_argument("render_static: time budgets, caustic photons, path guiding and target errors need render()");
+        if (band_rows != 0)
+            throw std::invalid_argument("render_static: static scenes render the whole frame; band_rows needs render()");
+        if (is_float_image(filename))
+            throw std::invalid_argument("render_static: " + std::string(filename) + ": float formats need render()");
+        if (!trace_file.empty())
+            trace::start();
+
+        thread_limit limit(worker_threads());
+        initialize();
+        render_stats stats;
+        std::vector<Pixel> pixels(image_width * image_height);
+        auto tiles = generate_tiles(tile_pixels());
+        std::atomic<bool> stopped{false};
+        auto start_time = std::chrono::high_resolution_clock::now();
+        {
+            trace::scope phase("render");
+            std::for_each(std::execution::par, tiles.begin(), tiles.end(),
+                          [&](const Tile &tile)
+                          {
+                              if (cancel && cancel->load(std::memory_order_relaxed))
+                              {
+                                  stopped = true;
+                                  return;
+                              }
+                              for (int j = tile.y_start; j < tile.y_start + tile.height; ++j)
+                                  for (int i = tile.x_start; i < tile.x_start + tile.width; ++i)
+                                  {
+                                      color sum(0, 0, 0);
+                                      auto pixel_seed = hash_seed(seed, static_cast<uint64_t>(j) * image_width + i);
+                                      for (int s = 0; s < samples_per_pixel; ++s)
+                                      {
+                                          seed_random(pixel_seed, s);
+                                          sum += scene.ray_color(get_ray(i, j), max_depth);
+                                      }
+                                      pixels[j * image_width + i] = resolve(sum);
+                                  }
+                          });
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        stats.render_seconds = std::chrono::duration<double>(end_time - start_time).count();
+        stats.rays = static_cast<uint64_t>(image_width) * image_height * samples_per_pixel;
+        stats.cancelled = stopped.load();
+        finish(stats, pixels, filename);
+        return stats;
+    }
+
+    // Whether the settings sample the whole frame in rounds (render_rounds), which streamed,
+    // region and distributed renders cannot do
+    [[nodiscard]] bool renders_in_rounds() const
+    {
+        return time_budget > 0 || caustic_photons > 0 || path_guiding || target_error > 0;
+    }
+
+    // Renders the rectangle at (x, y) of size width x height in parallel and stores the sample
+    // sum of every pixel in `sums` (row-major, resized to fit). Resolving the sums with
+    // resolve() gives exactly the pixels a full render produces. Returns the rays traced.
+    // Round-based renders (see renders_in_rounds) need the whole frame, so they throw
+    // std::invalid_argument.
+    uint64_t render_region(const hittable &world_bvh, int x, int y, int width, int height, std::vector<color> &sums)
+    {
+        if (renders_in_rounds())
+            throw std::invalid_argument("render_region: time budgets, caustic photons, path guiding and target errors need a whole-frame render");
+        thread_limit limit(worker_threads());
+        initialize();
+        sums.resize(static_cast<size_t>(width) * height);
+
+        std::vector<int> rows(height);
+        for (int r = 0; r < height; r++)
+            rows[r] = r;
+        std::for_each(std::execution::par, rows.begin(), rows.end(),
+                      [&](int r)
                       {
-                          total_rays += render_tile(tile, *world_bvh, pixels);
+                          for (int c = 0; c < width; c++)
+                              sums[r * width + c] = sample_pixel(x + c, y + r, world_bvh);
                       });
+        return static_cast<uint64_t>(width) * height * samples_per_pixel;
+    }
 
-        auto end_time = std::chrono::high_resolution_clock::now();
+    // Converts a pixel's sample sum to its final value, as the renderer does
+    [[nodiscard]] Pixel resolve(const color &sum) const
+    {
+        return to_pixel(sum * (1.0f / samples_per_pixel));
+    }
 
-        // Save the image, then report and log results
+    // Saves a finished render under images/, then reports and logs it like render() does
+    std::filesystem::path save(const std::vector<Pixel> &pixels, std::string_view filename, const render_stats &stats) const
+    {
         auto full_path = save_image(pixels, filename);
-        report_results(full_path, start_time, end_time, total_rays.load());
+        report_results(full_path, stats);
+        return full_path;
+    }
+
+    // Writes the image under images/ without reporting or logging, sized by output_height() so
+    // cameras that only merge pixels (e.g. a distributed coordinator) can save too.
+    // Only 8-bit formats (.png, .ppm) can be saved from pixels; render() float formats directly.
+    std::filesystem::path save_image(const std::vector<Pixel> &pixels, std::string_view filename) const
+    {
+        trace::scope phase("save_image");
+        auto full_path = image_path(filename);
+        auto writer = open_image_writer(full_path, image_width, output_height());
+        auto *pixel_output = dynamic_cast<pixel_writer *>(writer.get());
+        if (!pixel_output)
+            throw std::runtime_error(std::string(filename) + ": float formats need render(), not 8-bit pixels");
+        pixel_output->write_pixels(pixels);
+        pixel_output->finish();
+        return full_path;
+    }
+
+    // The acceleration structure render_pixels() renders: a flat BVH from bvh_cache_dir when
+    // caching is enabled or the memory budget asks for it and the scene allows it, a bvh_node otherwise
+    [[nodiscard]] std::shared_ptr<hittable> build_acceleration(const hittable_list &world) const
+    {
+        if (!bvh_cache_dir.empty())
+        {
+            if (auto flat = cached_bvh(world, bvh_cache_dir))
+                return flat;
+        }
+        if (plan.compact_bvh)
+        {
+            if (auto flat = flat_bvh::build(world))
+                return flat;
+        }
+        return std::make_shared<bvh_node>(world, leaf_objects());
+    }
+
+    // Image height implied by image_width and aspect_ratio (at least 1)
+    [[nodiscard]] int output_height() const
+    {
+        return std::max(1, static_cast<int>(image_width / aspect_ratio));
     }
 
+    // tile_size, threads and bvh_leaf_size as renders use them: the camera's, else the profile's
+    [[nodiscard]] static int tuned(int setting, int machine_profile::*field, int fallback)
+    {
+        if (setting > 0)
+            return setting;
+        auto profile = machine_profile::current();
+        return profile ? profile->*field : fallback;
+    }
+    [[nodiscard]] int tile_pixels() const { return tuned(tile_size, &machine_profile::tile_size, 16); }
+    [[nodiscard]] int worker_threads() const { return tuned(threads, &machine_profile::threads, 0); }
+    [[nodiscard]] size_t leaf_objects() const { return tuned(bvh_leaf_size, &machine_profile::bvh_leaf_size, 2); }
+
 private:
+    friend class look_dev_session; // Re-shades from cached primary hits
+    friend class render_session;   // Interleaves the tiles of many cameras
+
     int image_height;         // Rendered image height
-    real pixel_samples_scale; // Color scale factor for a sum of pixel samples
     point3 center;            // Camera center
     point3 pixel00_loc;       // Location of pixel 0, 0
     vec3 pixel_delta_u;       // Offset to pixel to the right
@@ -67,6 +594,20 @@ private:
     vec3 u, v, w;             // Camera frame basis vectors
     vec3 defocus_disk_u;      // Defocus disk horizontal radius
     vec3 defocus_disk_v;      // Defocus disk vertical radius
+    real pixel_spread;        // Angle between neighbouring camera rays, for ray cones
+
+    photon_sources caustic_sources;              // Lights and specular spheres of the scene being rendered
+    std::shared_ptr<const photon_map> caustics;  // Photon map of the current pass, if any
+    std::shared_ptr<path_guide> guide;           // Sampled and trained in the current round, if any
+
+    // Representations picked to fit memory_budget, for the render in progress
+    struct memory_plan
+    {
+        bool compact_bvh = false;
+        int rows = 0;             // Band height when streaming, 0 for the whole frame in memory
+        size_t texture_cache = 0; // Tile cache capacity to shrink to (0 = leave as is)
+    };
+    memory_plan plan;
 
     struct Tile
     {
@@ -75,12 +616,10 @@ private:
 
     void initialize()
     {
-        // Calculate height and ensure it's at least 1
-        image_height = static_cast<int>(image_width / aspect_ratio);
-        image_height = (image_height < 1) ? 1 : image_height;
-
-        // Precompute the multiplier for averaging samples
-        pixel_samples_scale = 1.0f / samples_per_pixel;
+        if (!(0 <= shutter_open && shutter_open <= shutter_close && shutter_close <= 1))
+            throw std::invalid_argument(std::format("camera: the shutter interval [{}, {}] is not within [0, 1]",
+                                                    shutter_open, shutter_close));
+        image_height = output_height();
 
         // Camera positioning
         center = lookfrom;
@@ -113,19 +652,21 @@ private:
         auto defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle / 2.0f));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
+
+        pixel_spread = pixel_delta_u.length() / focus_dist;
     }
 
-    std::vector<Tile> generate_tiles(const int tile_size) const
+    std::vector<Tile> generate_tiles(const int size) const
     {
         // Generate tiles for parallel rendering
         std::vector<Tile> tiles;
-        for (int y = 0; y < image_height; y += tile_size)
+        for (int y = 0; y < image_height; y += size)
         {
-            for (int x = 0; x < image_width; x += tile_size)
+            for (int x = 0; x < image_width; x += size)
             {
                 tiles.push_back({x, y,
-                                 std::min(tile_size, image_width - x),
-                                 std::min(tile_size, image_height - y)});
+                                 std::min(size, image_width - x),
+                                 std::min(size, image_height - y)});
             }
         }
         return tiles;
@@ -134,72 +675,455 @@ private:
     uint64_t render_tile(const Tile &tile, const hittable &world, std::vector<Pixel> &pixels) const
     {
         // Render a single tile and return the number of rays traced
-        uint64_t rays_traced = 0;
         for (int j = tile.y_start; j < tile.y_start + tile.height; ++j)
-        {
             for (int i = tile.x_start; i < tile.x_start + tile.width; ++i)
+                pixels[j * image_width + i] = resolve(sample_pixel(i, j, world));
+        return static_cast<uint64_t>(tile.width) * tile.height * samples_per_pixel;
+    }
+
+    // Tile lookups since `before`, with the cache's current size
+    [[nodiscard]] static tile_cache::statistics texture_use_since(const tile_cache::statistics &before)
+    {
+        auto now = tile_cache::shared().stats();
+        now.hits -= before.hits;
+        now.misses -= before.misses;
+        return now;
+    }
+
+    // What rendering `world` takes with the choices in `p`: the scene as it stands, then the
+    // BVH, texture cache and buffers the render will allocate. Needs initialize().
+    [[nodiscard]] memory_report estimate_memory(const hittable_list &world, const memory_plan &p) const
+    {
+        memory_report report;
+        account_scene(world, report);
+        report.add(p.compact_bvh ? "bvh (compact)" : "bvh", acceleration_bytes(world.objects.size(), p.compact_bvh));
+        if (report.find("textures"))
+            report.add("texture cache", p.texture_cache ? p.texture_cache : tile_cache::shared().stats().capacity);
+        if (environment)
+            report.add("environment", environment->size_bytes());
+        add_buffers(report, p.rows);
+        if (p.rows == 0 && caustic_photons > 0)
+            report.add("photon map", photon_map::peak_bytes(caustic_photons));
+        if (p.rows == 0 && path_guiding)
+            report.add("path guide", path_guide::max_size_bytes());
+        return report;
+    }
+
+    // Framebuffers: two bands of linear colors when streaming `rows` rows at a time, else (0)
+    // the pixels plus the sums and moments of round-based renders
+    void add_buffers(memory_report &report, int rows) const
+    {
+        const size_t pixels = static_cast<size_t>(image_width) * image_height;
+        if (rows > 0)
+            report.add("framebuffer", 2 * static_cast<size_t>(image_width) * rows * sizeof(color));
+        else
+        {
+            report.add("framebuffer", pixels * sizeof(Pixel));
+            if (renders_in_rounds())
+                report.add("sample sums", pixels * (sizeof(color) + (target_error > 0 ? 2 * sizeof(real) : 0)));
+        }
+    }
+
+    // Cheapest plan within memory_budget, trying representations that leave the image as it
+    // is: a compact BVH where it is smaller, a smaller texture cache, then (if `may_stream`)
+    // ever thinner bands.
+    // Throws memory_budget_error if nothing fits.
+    [[nodiscard]] memory_plan fit_memory_budget(const hittable_list &world, int rows, bool may_stream) const
+    {
+        memory_plan p{false, rows, 0};
+        auto fits = [&]
+        { return memory_budget == 0 || estimate_memory(world, p).total() <= memory_budget; };
+        if (fits())
+            return p;
+
+        const size_t spheres = world.objects.size();
+        if (acceleration_bytes(spheres, true) < acceleration_bytes(spheres, false) && flat_bvh_detail::gather(world))
+        {
+            p.compact_bvh = true;
+            if (fits())
+                return p;
+        }
+
+        auto estimate = estimate_memory(world, p);
+        if (auto cache = estimate.find("texture cache"))
+        {
+            const size_t others = estimate.total() - cache->bytes, floor = 4u << 20;
+            if (others + floor <= memory_budget)
             {
-                color pixel_color(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; ++s)
-                {
-                    pixel_color += ray_color(get_ray(i, j), max_depth, world);
-                    rays_traced++;
-                }
-                pixels[j * image_width + i] = to_pixel(pixel_color * pixel_samples_scale);
+                p.texture_cache = memory_budget - others;
+                return p;
             }
+            p.texture_cache = floor;
         }
-        return rays_traced;
+
+        if (may_stream)
+            for (int r = image_height / 2; r >= 16; r /= 2)
+            {
+                p.rows = r;
+                if (fits())
+                    return p;
+            }
+        throw memory_budget_error(estimate_memory(world, p), memory_budget);
     }
 
-    std::filesystem::path save_image(const std::vector<Pixel> &pixels, std::string_view filename) const
+    // Makes `p` the plan of the render in progress, and says what the budget changed. A smaller
+    // texture cache lasts as long as the caller's tile_cache::capacity_scope.
+    void apply_plan(const memory_plan &p)
     {
-        // Ensure images directory exists
-        std::filesystem::path dir("images");
-        if (!std::filesystem::exists(dir))
-            std::filesystem::create_directory(dir);
+        plan = p;
+        if (p.texture_cache > 0)
+            tile_cache::shared().set_capacity(p.texture_cache);
+        const bool banded = band_rows == 0 && p.rows > 0 && p.rows < image_height;
+        if (p.compact_bvh || p.texture_cache > 0 || banded)
+            std::println(stderr, "Memory budget {}:{}{}{}", memory_detail::format_bytes(memory_budget),
+                         p.compact_bvh ? " compact BVH" : "",
+                         p.texture_cache ? std::format(" {} texture cache", memory_detail::format_bytes(p.texture_cache)) : "",
+                         banded ? std::format(" {}-row bands", p.rows) : "");
+    }
 
-        // Save image using stb_image_write
-        auto full_path = dir / filename;
-        stbi_write_png(full_path.string().c_str(), image_width, image_height, 3,
-                       pixels.data(), image_width * 3);
-        return full_path;
+    // The report for a finished render of `world` through `bvh`, with `rows`-row bands if
+    // streamed, and the heap allocations since `before`
+    [[nodiscard]] memory_report measure_memory(const hittable_list &world, const hittable &bvh, int rows,
+                                               std::pair<uint64_t, uint64_t> before) const
+    {
+        memory_report report;
+        account_scene(world, report);
+        report.add(dynamic_cast<const flat_bvh *>(&bvh) ? "bvh (compact)" : "bvh", acceleration_bytes(bvh));
+        if (report.find("textures"))
+            report.add("texture cache", tile_cache::shared().stats().bytes);
+        if (environment)
+            report.add("environment", environment->size_bytes());
+        add_buffers(report, rows);
+        auto [count, bytes] = allocation_totals();
+        report.allocations = count - before.first;
+        report.allocated_bytes = bytes - before.second;
+        report.peak_rss = peak_rss_bytes();
+        return report;
+    }
+
+    [[nodiscard]] bool use_photons() const
+    {
+        return caustic_photons > 0 && !caustic_sources.empty();
+    }
+
+    // render_prebuilt() once the settings are checked, and render_pixels() under its plan
+    render_stats render_built(const hittable &world_bvh, std::vector<Pixel> &pixels)
+    {
+        thread_limit limit(worker_threads());
+        initialize();
+        pixels.resize(image_width * image_height);
+        auto textures_before = tile_cache::shared().stats();
+        if (time_budget > 0 || use_photons() || path_guiding || target_error > 0)
+        {
+            auto stats = render_rounds(world_bvh, pixels);
+            stats.textures = texture_use_since(textures_before);
+            return stats;
+        }
+
+        render_stats stats;
+
+        // Generate tiles for parallel rendering
+        auto tiles = generate_tiles(tile_pixels());
+
+        std::atomic<uint64_t> total_rays{0};
+        std::atomic<int> tiles_done{0};
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        // Core render loop
+        {
+            trace::scope phase("render");
+            std::for_each(std::execution::par, tiles.begin(), tiles.end(),
+                          [this, &tiles, &world_bvh, &pixels, &total_rays, &tiles_done](const Tile &tile)
+                          {
+                              if (cancel && cancel->load(std::memory_order_relaxed))
+                                  return;
+                              trace::scope tile_span("tile", static_cast<int>(&tile - tiles.data()));
+                              total_rays += render_tile(tile, world_bvh, pixels);
+                              int done = ++tiles_done;
+                              if (on_tile)
+                                  on_tile({tile.x_start, tile.y_start, tile.width, tile.height,
+                                           done, static_cast<int>(tiles.size())});
+                          });
+        }
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        stats.render_seconds = std::chrono::duration<double>(end_time - start_time).count();
+        stats.rays = total_rays.load();
+        stats.cancelled = tiles_done.load() < static_cast<int>(tiles.size());
+        stats.textures = texture_use_since(textures_before);
+        return stats;
+    }
+
+    // Time-budgeted rendering: every round adds samples to all tiles, so when the deadline hits
+    // the image is uniformly converged (tiles differ by at most the interrupted round). Rounds
+    // grow as long as the measured cost per sample says the next one fits in the remaining time.
+    // The first round always completes, so there is an image however small the budget.
+    //
+    // Without a budget, rounds double in size under path guiding (the guide is retrained after
+    // each), there are caustic_passes equal rounds with caustic photons, and one otherwise. With
+    // caustic photons, every round is a photon pass with a fresh map and a smaller radius
+    // (progressive photon mapping).
+    render_stats render_rounds(const hittable &world_bvh, std::vector<Pixel> &pixels)
+    {
+        render_stats stats;
+        auto tiles = generate_tiles(tile_pixels());
+        std::vector<color> sums(pixels.size());
+        std::vector<int> tile_spp(tiles.size(), 0);
+        // Per pixel luminance sum and sum of squares of the current round, for target_error
+        std::vector<std::array<real, 2>> moments(target_error > 0 ? pixels.size() : 0);
+        if (path_guiding)
+            guide = std::make_shared<path_guide>(world_bvh.bounding_box());
+
+        using clock = std::chrono::steady_clock;
+        auto start_time = clock::now();
+        auto deadline = start_time + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(time_budget));
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> total_rays{0};
+
+        const bool budgeted = time_budget > 0;
+        const int passes = std::clamp(caustic_passes, 1, samples_per_pixel);
+        int spp = 0, pass = 0;
+        int round = (budgeted || path_guiding) ? 1 : use_photons() ? (samples_per_pixel + passes - 1) / passes : samples_per_pixel;
+        while (spp < samples_per_pixel && !stop.load())
+        {
+            const int next = std::min(samples_per_pixel, spp + round);
+            const bool first = spp == 0;
+            if (use_photons())
+            {
+                trace::scope photon_phase("photon_pass", pass);
+                caustics = photon_map::trace(world_bvh, caustic_sources, environment.get(), caustic_photons,
+                                             photon_map::progressive_radius(caustic_radius, pass),
+                                             max_depth, hash_seed(seed, pass));
+                stats.photons += caustics->size();
+                pass++;
+            }
+            std::fill(moments.begin(), moments.end(), std::array<real, 2>{});
+            std::atomic<int> tiles_done{0};
+            auto round_start = clock::now();
+            trace::scope phase("render_round", next);
+            std::for_each(std::execution::par, tiles.begin(), tiles.end(),
+                          [&](const Tile &tile)
+                          {
+                              // Checked once per tile: a relaxed load and a clock read
+                              if (stop.load(std::memory_order_relaxed))
+                                  return;
+                              if ((cancel && cancel->load(std::memory_order_relaxed)) ||
+                                  (budgeted && !first && clock::now() >= deadline))
+                              {
+                                  stop.store(true, std::memory_order_relaxed);
+                                  return;
+                              }
+                              for (int j = tile.y_start; j < tile.y_start + tile.height; ++j)
+                                  for (int i = tile.x_start; i < tile.x_start + tile.width; ++i)
+                                  {
+                                      auto &sum = sums[j * image_width + i];
+                                      accumulate_samples(i, j, world_bvh, spp, next, sum,
+                                                         moments.empty() ? nullptr : moments[j * image_width + i].data());
+                                      pixels[j * image_width + i] = to_pixel(sum * (1.0f / next));
+                                  }
+                              tile_spp[&tile - tiles.data()] = next;
+                              total_rays += static_cast<uint64_t>(tile.width) * tile.height * (next - spp);
+                              int done = ++tiles_done;
+                              if (on_tile)
+                                  on_tile({tile.x_start, tile.y_start, tile.width, tile.height,
+                                           done, static_cast<int>(tiles.size())});
+                          });
+            if (stop.load())
+                break;
+
+            std::chrono::duration<double> round_time = clock::now() - round_start;
+            std::chrono::duration<double> remaining = deadline - clock::now();
+            double per_sample = round_time.count() / (next - spp);
+            if (!moments.empty() && next - spp > 1)
+                stats.spp_for_target = spp_for_error(moments, next - spp);
+            spp = next;
+            if (guide)
+            {
+                trace::scope guide_phase("guide_update", spp);
+                guide->update();
+            }
+            // At most double the samples taken so far, so one bad estimate cannot overshoot much
+            if (budgeted)
+                round = std::clamp(static_cast<int>(remaining.count() / per_sample), 1, spp);
+            else if (path_guiding)
+                round = spp;
+        }
+        caustics.reset();
+        guide.reset();
+
+        std::chrono::duration<double> elapsed = clock::now() - start_time;
+        stats.render_seconds = elapsed.count();
+        stats.rays = total_rays.load();
+        stats.cancelled = cancel && cancel->load();
+
+        double weighted = 0;
+        for (size_t t = 0; t < tiles.size(); t++)
+            weighted += static_cast<double>(tile_spp[t]) * tiles[t].width * tiles[t].height;
+        if (budgeted)
+            stats.spp = weighted / pixels.size();
+        return stats;
+    }
+
+    // Samples per pixel for a relative RMS error of target_error over the image, from the
+    // luminance moments of a round of `samples` samples per pixel
+    [[nodiscard]] double spp_for_error(const std::vector<std::array<real, 2>> &moments, int samples) const
+    {
+        double variance = 0, mean = 0;
+        for (const auto &m : moments)
+        {
+            double pixel_mean = m[0] / samples;
+            variance += std::max(0.0, (m[1] - m[0] * pixel_mean) / (samples - 1));
+            mean += pixel_mean;
+        }
+        variance /= moments.size();
+        mean /= moments.size();
+        if (mean <= 0)
+            return 0;
+        return variance / (target_error * mean * target_error * mean);
     }
 
-    void report_results(const std::filesystem::path &path,
-                        auto start, auto end, uint64_t total_rays) const
+    // Sum of all samples of pixel (i, j), before averaging
+    [[nodiscard]] color sample_pixel(int i, int j, const hittable &world) const
     {
-        // Calculate elapsed time and rays per second
-        std::chrono::duration<float> elapsed = end - start;
-        double mrays_s = (total_rays / elapsed.count()) / 1'000'000.0;
+        color pixel_color(0, 0, 0);
+        accumulate_samples(i, j, world, 0, samples_per_pixel, pixel_color);
+        return pixel_color;
+    }
 
+    // Adds samples [first, last) of pixel (i, j) to `sum`, in order, so a pixel accumulated
+    // over several calls ends up bit-identical to sample_pixel(). `moments`, if given, receives
+    // the sum of the samples' luminances and of their squares.
+    void accumulate_samples(int i, int j, const hittable &world, int first, int last, color &sum,
+                            real *moments = nullptr) const
+    {
+        auto pixel_seed = hash_seed(seed, static_cast<uint64_t>(j) * image_width + i);
+        for (int s = first; s < last; ++s)
+        {
+            // Every sample gets its own stream, independent of which thread renders it
+            seed_random(pixel_seed, s);
+            color sample = ray_color(get_ray(i, j), max_depth, world, 0, path_kind::camera, {0, pixel_spread});
+            sum += sample;
+            if (moments)
+            {
+                real luminance = environment_detail::luminance(sample);
+                moments[0] += luminance;
+                moments[1] += luminance * luminance;
+            }
+        }
+    }
+
+    // images/<filename>, creating its directories if needed (filename may have some, e.g. out/a.png)
+    static std::filesystem::path image_path(std::string_view filename)
+    {
+        auto path = std::filesystem::path("images") / filename;
+        std::filesystem::create_directories(path.parent_path());
+        return path;
+    }
+
+    void finish(const render_stats &stats, const std::vector<Pixel> &pixels, std::string_view filename) const
+    {
+        if (stats.cancelled)
+            std::println(stderr, "Cancelled: {} not saved", filename);
+        else
+            save(pixels, filename, stats);
+        finish_trace();
+    }
+
+    void finish_trace() const
+    {
+        if (!trace_file.empty())
+        {
+            trace::stop();
+            trace::write(trace_file);
+            std::println(stderr, "Trace: {}", trace_file);
+        }
+    }
+
+    void report_results(const std::filesystem::path &path, const render_stats &stats) const
+    {
         // Print results to console
-        std::println(stderr, "Done: {} | {:.2f}s | {:.2f} MRays/s",
-                     path.string(), elapsed.count(), mrays_s);
+        std::println(stderr, "Done: {} | {:.2f}s | {:.2f} MRays/s{}{}",
+                     path.string(), stats.render_seconds, stats.mrays_s(),
+                     stats.spp > 0 ? std::format(" | {:.1f} of {} spp in budget", stats.spp, samples_per_pixel) : "",
+                     stats.photons > 0 ? std::format(" | {} caustic photons", stats.photons) : "");
+        if (stats.spp_for_target > 0)
+            std::println(stderr, "  ~{:.0f} spp for {:g}% relative error", std::ceil(stats.spp_for_target), target_error * 100);
+        if (!stats.memory.entries.empty())
+        {
+            const auto &m = stats.memory;
+            std::println(stderr, "  Memory: {} ({}) | {} B/primitive{}{}", memory_detail::format_bytes(m.total()), m.breakdown(),
+                         m.bytes_per_primitive(),
+                         m.peak_rss ? " | peak RSS " + memory_detail::format_bytes(m.peak_rss) : "",
+                         m.allocations ? std::format(" | {} allocations ({})", m.allocations, memory_detail::format_bytes(m.allocated_bytes)) : "");
+        }
+        if (stats.textures.hits + stats.textures.misses > 0)
+            std::println(stderr, "  Texture cache: {:.1f}% of {} tile lookups hit | {:.1f} of {:.1f} MiB",
+                         stats.textures.hit_rate() * 100, stats.textures.hits + stats.textures.misses,
+                         stats.textures.bytes / 1048576.0, stats.textures.capacity / 1048576.0);
 
         // Log performance data to CSV
-        log_performance(path, elapsed.count(), total_rays, mrays_s);
+        log_performance(path, stats);
     }
 
-    void log_performance(const std::filesystem::path &path, float elapsed, uint64_t rays, double mrays_s) const
+    void log_performance(const std::filesystem::path &path, const render_stats &stats) const
     {
-        std::ofstream log("perf_log.csv", std::ios::app);
+        trace::scope phase("log_performance");
+        const std::filesystem::path log_path = "perf_log.csv";
+        constexpr std::string_view header = "Timestamp,File,Seconds,TotalRays,MRays_s,Width,Height,SPP,MaxDepth,Threads,Seed,Build";
 
-        // Check if file is empty
-        if (std::filesystem::exists("perf_log.csv") && std::filesystem::file_size("perf_log.csv") == 0)
+        // A log with other columns is moved aside to perf_log.N.csv, so rows always match
+        // the header above them
+        std::error_code error;
+        auto size = std::filesystem::file_size(log_path, error);
+        bool fresh = error || size == 0;
+        if (!fresh)
         {
-            log << "Timestamp,File,Seconds,TotalRays,MRays_s\n";
+            std::string first;
+            std::getline(std::ifstream(log_path), first);
+            if (first.ends_with('\r'))
+                first.pop_back();
+            if (first != header)
+            {
+                std::filesystem::path aside;
+                for (int n = 1; aside.empty() || std::filesystem::exists(aside); n++)
+                    aside = std::format("perf_log.{}.csv", n);
+                std::filesystem::rename(log_path, aside, error);
+                fresh = !error;
+                if (fresh)
+                    std::println(stderr, "{} had other columns; moved to {}", log_path.string(), aside.string());
+            }
         }
 
+        std::ofstream log(log_path, std::ios::app);
+        if (fresh)
+            log << header << "\n";
+
         // Write performance data to log
         auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
         log << std::put_time(std::localtime(&now), "%Y-%m-%d %H:%M:%S") << ","
             << path.string() << ","
-            << elapsed << ","
-            << rays << ","
-            << mrays_s << "\n";
+            << stats.render_seconds << ","
+            << stats.rays << ","
+            << stats.mrays_s() << ","
+            << image_width << ","
+            << image_height << ","
+            << (stats.spp > 0 ? stats.spp : samples_per_pixel) << ","
+            << max_depth << ","
+            << (worker_threads() > 0 ? static_cast<unsigned>(worker_threads()) : hardware_threads()) << ","
+            << seed << ","
+            << '"' << compiler_info() << ' ' << build_flags() << " kernels " << cpu_dispatch::name(cpu_dispatch::active()) << '"' << "\n";
+    }
+
+    // Out of line, like shade() and background(), so that look-dev re-shading (look_dev.h)
+    // computes samples bit for bit as the renders here do; camera_ray() compiled for each CPU
+    // level
+    [[nodiscard]] RT_NOINLINE ray get_ray(int i, int j) const
+    {
+        return cpu_dispatch::run([&]
+                                 { return camera_ray(i, j); });
     }
 
-    [[nodiscard]] ray get_ray(int i, int j) const
+    [[nodiscard]] ray camera_ray(int i, int j) const
     {
         // Construct a camera ray originating from the defocus disk and directed at a randomly
         // sampled point around the pixel location i, j.
@@ -208,8 +1132,10 @@ private:
 
         auto ray_origin = (defocus_angle <= 0.0f) ? center : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
+        auto ray_time = (shutter_close > shutter_open) ? shutter_open + random_real() * (shutter_close - shutter_open)
+                                                       : shutter_open;
 
-        return ray(ray_origin, ray_direction);
+        return ray(ray_origin, ray_direction, ray_time);
     }
 
     [[nodiscard]] vec3 sample_square() const
@@ -225,28 +1151,171 @@ private:
         return center + (p.x * defocus_disk_u) + (p.y * defocus_disk_v);
     }
 
-    [[nodiscard]] constexpr color ray_color(const ray &r, int depth, const hittable &world) const
+    // How a ray came about, for leaving caustics to the photon map: rays leaving a diffuse
+    // surface, and rays that went on through glass or mirrors since (caustic paths)
+    enum class path_kind : uint8_t
+    {
+        camera,
+        after_diffuse,
+        caustic
+    };
+
+    // Width of a ray's footprint where it starts, and how fast it grows per unit of distance
+    // (Akenine-Möller et al., "Texture Level of Detail Strategies for Real-Time Ray Tracing",
+    // 2019). Surface curvature is ignored; diffuse bounces widen the cone to diffuse_spread.
+    struct ray_cone
+    {
+        real width, spread;
+    };
+    static constexpr real diffuse_spread = 0.1f; // Texture seen through diffuse bounces is blurred anyway
+
+    // `scatter_pdf` is the density with which the previous bounce chose this ray, 0 for camera
+    // rays and single-direction scattering; it weights the environment against light sampling.
+    // `touched`, if given, collects the material_bit() of every material the path hits.
+    [[nodiscard]] constexpr color ray_color(const ray &r, int depth, const hittable &world, real scatter_pdf = 0,
+                                            path_kind kind = path_kind::camera, ray_cone cone = {0, 0},
+                                            uint64_t *touched = nullptr) const
     {
         // If we've exceeded the ray bounce limit, no more light is gathered.
         if (depth <= 0)
             return color(0.0f, 0.0f, 0.0f);
 
         hit_record rec;
-        if (world.hit(r, interval(0.001f, infinity), rec))
+        if (world.hit(r, interval::positive, rec))
+            return shade(r, rec, depth, world, kind, cone, touched);
+        return background(r, scatter_pdf, kind);
+    }
+
+    // Light leaving the hit `rec` of `r` back along it, by shade_hit() compiled for each CPU
+    // level (cpu_dispatch.h)
+    [[nodiscard]] RT_NOINLINE color shade(const ray &r, hit_record &rec, int depth, const hittable &world,
+                              path_kind kind, ray_cone cone, uint64_t *touched) const
+    {
+        return cpu_dispatch::run([&]
+                                 { return shade_hit(r, rec, depth, world, kind, cone, touched); });
+    }
+
+    [[nodiscard]] color shade_hit(const ray &r, hit_record &rec, int depth, const hittable &world,
+                                  path_kind kind, ray_cone cone, uint64_t *touched) const
+    {
+        // Light found at the end of a caustic path is already in the photon map
+        const bool lit = !caustics || kind != path_kind::caustic;
+        if (touched)
+            *touched |= material_bit(rec.mat.get());
+
+        ray scattered;
+        color attenuation;
+        color color_from_emission = lit ? rec.mat->emitted() : color(0, 0, 0);
+        rec.footprint = cone.width + cone.spread * rec.t * r.direction().length();
+
+        if (!rec.mat->scatter(r, rec, attenuation, scattered))
+            return color_from_emission;
+
+        ray_cone next_cone{rec.footprint, rec.mat->diffuse(rec) ? std::max(cone.spread, diffuse_spread) : cone.spread};
+        // A guided bounce draws from the guide instead of the BSDF part of the time, and
+        // is weighted by the density of the mix
+        const bool guided = guide && rec.mat->diffuse(rec);
+        const uint32_t cell = guided ? guide->find(rec.p) : 0;
+        const uint32_t *guide_cell = (guided && guide->trained(cell)) ? &cell : nullptr;
+        color weight = attenuation;
+        if (guide_cell)
         {
-            ray scattered;
-            color attenuation;
-            color color_from_emission = rec.mat->emitted();
+            if (random_real() >= path_guide::bsdf_fraction)
+            {
+                real u1 = random_real(), u2 = random_real();
+                scattered = rec.spawn_ray(guide->sample(cell, rec.normal, u1, u2), r.time());
+            }
+            real material_pdf = rec.mat->scattering_pdf(rec, scattered.direction());
+            if (material_pdf <= 0)
+                return color_from_emission; // Grazing the surface
+            weight = attenuation * (material_pdf / sampling_pdf(rec, scattered.direction(), guide_cell));
+        }
 
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return color_from_emission + (attenuation * ray_color(scattered, depth - 1, world));
-            else
-                return color_from_emission;
+        if (environment)
+            color_from_emission += attenuation * sample_environment(rec, r.time(), world, guide_cell);
+        real pdf = (environment || guided) ? sampling_pdf(rec, scattered.direction(), guide_cell) : 0;
+        path_kind next = kind;
+        if (caustics)
+        {
+            if (rec.mat->diffuse(rec))
+            {
+                color_from_emission += attenuation * caustics->radiance(rec);
+                next = path_kind::after_diffuse;
+            }
+            else if (kind == path_kind::after_diffuse)
+                next = path_kind::caustic;
         }
+        if (!guided)
+            return color_from_emission + (attenuation * ray_color(scattered, depth - 1, world, pdf, next, next_cone, touched));
+
+        // Teach the guide what this direction contributed: the light arriving from it,
+        // times the cosine-weighted BSDF (material pdf), so the guide learns the product
+        color incoming = ray_color(scattered, depth - 1, world, environment ? pdf : 0, next, next_cone, touched);
+        if (pdf > 0)
+            guide->record(cell, rec.p, scattered.direction(),
+                          environment_detail::luminance(incoming) * rec.mat->scattering_pdf(rec, scattered.direction()) / pdf);
+        return color_from_emission + (weight * incoming);
+    }
+
+    // Light arriving along `r` from beyond the scene
+    [[nodiscard]] RT_NOINLINE color background(const ray &r, real scatter_pdf, path_kind kind) const
+    {
+        if (caustics && kind == path_kind::caustic)
+            return color(0.0f, 0.0f, 0.0f);
+        if (environment)
+        {
+            color radiance = environment->radiance(r.direction());
+            if (scatter_pdf <= 0)
+                return radiance;
+            // Power heuristic against sample_environment() picking the same direction
+            real light_pdf = environment->pdf(r.direction());
+            return radiance * (scatter_pdf * scatter_pdf / (scatter_pdf * scatter_pdf + light_pdf * light_pdf));
+        }
+
+        return sky_gradient(r.direction());
+    }
+
+    // One bit of 64 standing for material `m`, for tracking which materials paths touch; several
+    // materials may share a bit, which only ever costs re-shading a pixel needlessly
+    [[nodiscard]] static uint64_t material_bit(const material *m)
+    {
+        return uint64_t{1} << ((reinterpret_cast<uintptr_t>(m) * 0x9E3779B97F4A7C15ull) >> 58);
+    }
+
+    // Density with which a bounce at `rec` picks `direction`: the material's own, or its mix
+    // with the guide's when the bounce is guided from leaf *guide_cell
+    [[nodiscard]] real sampling_pdf(const hit_record &rec, const vec3 &direction, const uint32_t *guide_cell) const
+    {
+        real material_pdf = rec.mat->scattering_pdf(rec, direction);
+        if (!guide_cell)
+            return material_pdf;
+        return path_guide::bsdf_fraction * material_pdf +
+               (1 - path_guide::bsdf_fraction) * guide->pdf(*guide_cell, rec.normal, direction);
+    }
+
+    // Light sampling half of the environment estimator: one direction picked by luminance,
+    // MIS-weighted against the bounce's own sampling. Divided by the material's pdf, since the
+    // caller multiplies by the attenuation (which already carries the BSDF over its pdf).
+    [[nodiscard]] color sample_environment(const hit_record &rec, real time, const hittable &world,
+                                           const uint32_t *guide_cell = nullptr) const
+    {
+        vec3 direction;
+        real light_pdf;
+        real u1 = random_real(), u2 = random_real();
+        color radiance = environment->sample(u1, u2, direction, light_pdf);
+        if (light_pdf <= 0)
+            return {0, 0, 0};
+
+        real material_pdf = rec.mat->scattering_pdf(rec, direction);
+        if (material_pdf <= 0)
+            return {0, 0, 0};
+
+        hit_record blocker;
+        if (world.hit(rec.spawn_ray(direction, time), interval::positive, blocker))
+            return {0, 0, 0};
 
-        // Background gradient (sky)
-        vec3 unit_direction = unit_vector(r.direction());
-        auto a = 0.5f * (unit_direction.y + 1.0f);
-        return (1.0f - a) * color(1.0f, 1.0f, 1.0f) + a * color(0.5f, 0.7f, 1.0f);
+        real bounce_pdf = guide_cell ? sampling_pdf(rec, direction, guide_cell) : material_pdf;
+        real weight = light_pdf * light_pdf / (light_pdf * light_pdf + bounce_pdf * bounce_pdf);
+        return radiance * (weight * material_pdf / light_pdf);
     }
 };
\ No newline at end of file
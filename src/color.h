@@ -1,10 +1,12 @@
 #pragma once
 
+#include "cpu_dispatch.h"
 #include "interval.h"
+#include "precision.h"
 #include "vec3.h"
 #include <cstdint>
+#include <span>
 
-using real = float;
 using color = vec3;
 
 struct Pixel
@@ -34,4 +36,15 @@ struct Pixel
         .r = static_cast<std::uint8_t>(256.0f * intensity.clamp(linear_to_gamma(pixel_color.x))),
         .g = static_cast<std::uint8_t>(256.0f * intensity.clamp(linear_to_gamma(pixel_color.y))),
         .b = static_cast<std::uint8_t>(256.0f * intensity.clamp(linear_to_gamma(pixel_color.z)))};
-}
\ No newline at end of file
+}
+
+// to_pixel() over a span, compiled for each CPU level (cpu_dispatch.h) so its square roots
+// vectorize as wide as the CPU allows. The results are the same at every level.
+inline void to_pixels(std::span<const color> colors, std::span<Pixel> pixels)
+{
+    cpu_dispatch::run([&]
+                      {
+                          for (size_t k = 0; k < colors.size(); k++)
+                              pixels[k] = to_pixel(colors[k]);
+                      });
+}
@@ -1,12 +1,21 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <numbers>
 #include <random>
 
-using real = float;
+#include "precision.h"
+
+// Keeps a function out of line. Under -ffast-math, code inlined into different callers may be
+// rounded differently, so whatever has to give the same bits everywhere is kept out of line.
+#if defined(_MSC_VER)
+#define RT_NOINLINE __declspec(noinline)
+#else
+#define RT_NOINLINE __attribute__((noinline))
+#endif
 
 // Constants
 inline constexpr real infinity = std::numeric_limits<real>::infinity();
@@ -18,13 +27,65 @@ inline constexpr real pi = std::numbers::pi;
     return degrees * pi / 180.0f;
 }
 
+// PCG32 generator (O'Neill, pcg-random.org). Unlike std::mt19937 its state is 16 bytes,
+// so it is cheap enough to reseed for every pixel sample, which makes renders reproducible
+// regardless of how tiles are scheduled onto threads.
+class pcg32
+{
+public:
+    constexpr pcg32() = default;
+    constexpr pcg32(std::uint64_t seed, std::uint64_t stream = 0) { reseed(seed, stream); }
+
+    constexpr void reseed(std::uint64_t seed, std::uint64_t stream = 0) noexcept
+    {
+        state = 0;
+        inc = (stream << 1) | 1;
+        next();
+        state += seed;
+        next();
+    }
+
+    constexpr std::uint32_t next() noexcept
+    {
+        std::uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27);
+        auto rot = static_cast<std::uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+private:
+    std::uint64_t state = 0x853c49e6748fea9bULL;
+    std::uint64_t inc = 0xda3e39cb94b95bdbULL;
+};
+
+// Mixes several values into a well-distributed 64-bit seed (splitmix64 finalizer)
+[[nodiscard]] constexpr std::uint64_t hash_seed(std::uint64_t a, std::uint64_t b = 0) noexcept
+{
+    std::uint64_t z = a + 0x9e3779b97f4a7c15ULL * (b + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// thread_local ensures each thread has its own unique generator
+[[nodiscard]] inline pcg32 &thread_rng()
+{
+    static thread_local pcg32 generator{std::random_device{}(), std::random_device{}()};
+    return generator;
+}
+
+// Reseeds the calling thread's generator, e.g. before generating a scene
+inline void seed_random(std::uint64_t seed, std::uint64_t stream = 0)
+{
+    thread_rng().reseed(seed, stream);
+}
+
 // Returns a random real in [0,1)
 [[nodiscard]] inline real random_real()
 {
-    // thread_local ensures each thread has its own unique generator and distribution
-    static thread_local std::mt19937 generator{std::random_device{}()};
-    static thread_local std::uniform_real_distribution<real> distribution(0.0f, 1.0f);
-    return distribution(generator);
+    // Top 24 bits fill the float mantissa exactly, so the result never rounds up to 1
+    return static_cast<real>(thread_rng().next() >> 8) * 0x1p-24f;
 }
 
 // Overload for a specific range [min, max)
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <string>
+#include <string_view>
+
+// Runtime CPU dispatch. The hot kernels (BVH traversal with its box and sphere tests, camera
+// rays, shading and pixel conversion) are compiled for the build's own target and again for
+// each wider x86-64 level, and run as the widest level this CPU supports (by CPUID). A binary
+// built for a portable baseline, e.g. -march=x86-64-v2, thus runs AVX2 or AVX-512 code where
+// it can, and still starts on older machines.
+//
+// RT_ISA=sse4.2|avx2|avx512 forces a level for testing, as does select() from a tool's flag; a
+// level the CPU lacks falls back to the best it has. The level is fixed for the process, so
+// every render path runs the same code and their images stay bit-identical. Levels with FMA
+// round differently, so images of different levels may differ in the last bits.
+// RT_NO_CPU_DISPATCH builds only the baseline.
+#if !defined(RT_NO_CPU_DISPATCH) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define RT_CPU_DISPATCH 1
+// Compiles a kernel and everything it inlines for `features`
+#define RT_TARGET(features) __attribute__((target(features), flatten))
+#endif
+
+namespace cpu_dispatch
+{
+    enum class level : uint8_t
+    {
+        sse2,
+        sse42, // x86-64-v2
+        avx2,  // x86-64-v3: AVX2 and FMA
+        avx512 // x86-64-v4: AVX-512 F, VL, BW and DQ
+    };
+
+    // What the compiler was told to assume; kernels never run below it
+    inline constexpr level compiled =
+#if defined(__AVX512F__) && defined(__AVX512VL__) && defined(__AVX512BW__) && defined(__AVX512DQ__)
+        level::avx512;
+#elif defined(__AVX2__) && defined(__FMA__)
+        level::avx2;
+#elif defined(__SSE4_2__)
+        level::sse42;
+#else
+        level::sse2;
+#endif
+
+    [[nodiscard]] constexpr std::string_view name(level l) noexcept
+    {
+        constexpr std::string_view names[] = {"sse2", "sse4.2", "avx2", "avx512"};
+        return names[static_cast<int>(l)];
+    }
+
+    [[nodiscard]] inline bool supported(level l)
+    {
+#if RT_CPU_DISPATCH
+        // Also checks that the OS saves the AVX and AVX-512 registers
+        __builtin_cpu_init();
+        switch (l)
+        {
+        case level::sse2:
+            return true;
+        case level::sse42:
+            return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        case level::avx2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case level::avx512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                   __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+        }
+        return false;
+#else
+        return l <= compiled;
+#endif
+    }
+
+    // The widest level this CPU supports, at least the compiled one
+    [[nodiscard]] inline level best()
+    {
+        level l = compiled;
+        for (level next : {level::sse42, level::avx2, level::avx512})
+            if (next > l && supported(next))
+                l = next;
+        return l;
+    }
+
+    namespace detail
+    {
+        inline std::string &selection()
+        {
+            static std::string setting;
+            return setting;
+        }
+    }
+
+    // Overrides RT_ISA for this process with a level's name; only before the first kernel runs
+    inline void select(std::string setting) { detail::selection() = std::move(setting); }
+
+    // The level kernels run at: best(), unless select()ed or RT_ISA forces another. A forced
+    // level that is unknown, unsupported or below the compiled one is reported once.
+    [[nodiscard]] inline level active()
+    {
+        static const level chosen = []
+        {
+            std::string setting = detail::selection();
+            if (setting.empty())
+                if (const char *variable = std::getenv("RT_ISA"))
+                    setting = variable;
+            if (setting.empty())
+                return best();
+
+            for (level l : {level::sse2, level::sse42, level::avx2, level::avx512})
+            {
+                if (name(l) != setting)
+                    continue;
+                if (l < compiled)
+                {
+                    std::println(stderr, "ISA: built for {}; using it instead of {}", name(compiled), setting);
+                    return compiled;
+                }
+                if (!supported(l))
+                {
+                    std::println(stderr, "ISA: this CPU lacks {}; using {}", setting, name(best()));
+                    return best();
+                }
+                return l;
+            }
+            std::println(stderr, "ISA: unknown level {}; using {}", setting, name(best()));
+            return best();
+        }();
+        return chosen;
+    }
+
+    // E.g. "avx2 (CPU avx512, built for sse4.2)", for reports and logs
+    [[nodiscard]] inline std::string describe()
+    {
+        return std::format("{} (CPU {}, built for {})", name(active()), name(best()), name(compiled));
+    }
+
+    // Runs `kernel` compiled for the active level. Kernels are lambdas capturing their
+    // arguments; whatever they inline is compiled along, so calls through here should be
+    // few and large: a whole traversal or shading step, not a single vector operation.
+    template <class Kernel>
+    inline decltype(auto) run(Kernel &&kernel)
+    {
+#if RT_CPU_DISPATCH
+        switch (active())
+        {
+        case level::avx512:
+            if constexpr (compiled < level::avx512)
+                return [&]() RT_TARGET("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,sse4.2,popcnt") { return kernel(); }();
+            break;
+        case level::avx2:
+            if constexpr (compiled < level::avx2)
+                return [&]() RT_TARGET("avx2,fma,sse4.2,popcnt") { return kernel(); }();
+            break;
+        case level::sse42:
+            if constexpr (compiled < level::sse42)
+                return [&]() RT_TARGET("sse4.2,popcnt") { return kernel(); }();
+            break;
+        case level::sse2:
+            break;
+        }
+#endif
+        return kernel();
+    }
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Small deflate (RFC 1951) encoder for the PNG writer: greedy LZ77 with hash chains and the
+// fixed Huffman code, the same trade-off stb_image_write makes. Every piece is compressed
+// independently and ends byte-aligned on an empty stored block (a "sync flush"), so pieces
+// compressed in parallel can simply be concatenated into one stream, pigz style.
+
+namespace deflate
+{
+    class bit_writer
+    {
+    public:
+        explicit bit_writer(std::vector<uint8_t> &out) : out(out) {}
+
+        // Appends the low `count` bits of `value`, least significant first
+        void put(uint32_t value, int count)
+        {
+            bits |= static_cast<uint64_t>(value) << filled;
+            filled += count;
+            while (filled >= 8)
+            {
+                out.push_back(static_cast<uint8_t>(bits));
+                bits >>= 8;
+                filled -= 8;
+            }
+        }
+
+        // Pads with zero bits to the next byte boundary
+        void align()
+        {
+            if (filled > 0)
+                out.push_back(static_cast<uint8_t>(bits));
+            bits = 0;
+            filled = 0;
+        }
+
+    private:
+        std::vector<uint8_t> &out;
+        uint64_t bits = 0;
+        int filled = 0;
+    };
+
+    namespace detail
+    {
+        struct code
+        {
+            uint16_t bits;  // Already bit-reversed, ready for bit_writer::put
+            uint8_t length;
+        };
+
+        [[nodiscard]] constexpr uint16_t reverse(uint32_t value, int length)
+        {
+            uint32_t r = 0;
+            for (int i = 0; i < length; i++)
+                r |= ((value >> i) & 1u) << (length - 1 - i);
+            return static_cast<uint16_t>(r);
+        }
+
+        // Fixed literal/length code (RFC 1951, 3.2.6)
+        inline constexpr auto literal_codes = []
+        {
+            std::array<code, 288> table{};
+            for (uint32_t s = 0; s < 288; s++)
+            {
+                if (s < 144)
+                    table[s] = {reverse(0x30 + s, 8), 8};
+                else if (s < 256)
+                    table[s] = {reverse(0x190 + s - 144, 9), 9};
+                else if (s < 280)
+                    table[s] = {reverse(s - 256, 7), 7};
+                else
+                    table[s] = {reverse(0xc0 + s - 280, 8), 8};
+            }
+            return table;
+        }();
+
+        inline constexpr uint16_t length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        inline constexpr uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        inline constexpr uint16_t distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                                       8193, 12289, 16385, 24577};
+        inline constexpr uint8_t distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        inline constexpr int window = 32768;
+        inline constexpr int min_match = 3;
+        inline constexpr int max_match = 258;
+        inline constexpr int hash_bits = 15;
+
+        inline void put_match(bit_writer &bw, int length, int distance)
+        {
+            int l = static_cast<int>(std::upper_bound(std::begin(length_base), std::end(length_base), length) - std::begin(length_base)) - 1;
+            const auto &lc = literal_codes[257 + l];
+            bw.put(lc.bits, lc.length);
+            bw.put(length - length_base[l], length_extra[l]);
+
+            int d = static_cast<int>(std::upper_bound(std::begin(distance_base), std::end(distance_base), distance) - std::begin(distance_base)) - 1;
+            bw.put(reverse(d, 5), 5);
+            bw.put(distance - distance_base[d], distance_extra[d]);
+        }
+
+        [[nodiscard]] inline uint32_t hash3(const uint8_t *p)
+        {
+            uint32_t v = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+            return (v * 2654435761u) >> (32 - hash_bits);
+        }
+    }
+
+    // Appends `data` to `out` as non-final fixed-Huffman blocks followed by a sync flush.
+    // `max_chain` bounds the match search per position (speed vs. size).
+    inline void compress_piece(std::span<const uint8_t> data, std::vector<uint8_t> &out, int max_chain = 32)
+    {
+        using namespace detail;
+        bit_writer bw(out);
+        bw.put(0, 1); // BFINAL = 0
+        bw.put(1, 2); // BTYPE = fixed Huffman
+
+        const int n = static_cast<int>(data.size());
+        const uint8_t *p = data.data();
+        std::vector<int32_t> head(1 << hash_bits, -1);
+        std::vector<int32_t> prev(window, -1);
+
+        auto insert = [&](int i)
+        {
+            uint32_t h = hash3(p + i);
+            prev[i & (window - 1)] = head[h];
+            head[h] = i;
+        };
+
+        int i = 0;
+        while (i < n)
+        {
+            int best_length = 0, best_distance = 0;
+            if (i + min_match <= n)
+            {
+                int limit = std::min(max_match, n - i);
+                int candidate = head[hash3(p + i)];
+                for (int chain = max_chain; candidate >= 0 && i - candidate <= window && chain > 0; chain--)
+                {
+                    if (p[candidate + best_length] == p[i + best_length])
+                    {
+                        int length = 0;
+                        while (length < limit && p[candidate + length] == p[i + length])
+                            length++;
+                        if (length > best_length)
+                        {
+                            best_length = length;
+                            best_distance = i - candidate;
+                            if (length == limit)
+                                break;
+                        }
+                    }
+                    int next = prev[candidate & (window - 1)];
+                    if (next >= candidate) // Slot reused by a newer position: the chain ends here
+                        break;
+                    candidate = next;
+                }
+                insert(i);
+            }
+
+            if (best_length >= min_match)
+            {
+                put_match(bw, best_length, best_distance);
+                for (int k = 1; k < best_length; k++)
+                    if (i + k + min_match <= n)
+                        insert(i + k);
+                i += best_length;
+            }
+            else
+            {
+                const auto &lc = literal_codes[p[i]];
+                bw.put(lc.bits, lc.length);
+                i++;
+            }
+        }
+
+        const auto &end = literal_codes[256];
+        bw.put(end.bits, end.length);
+
+        // Empty stored block: byte-aligns the piece so the next one can follow directly
+        bw.put(0, 3);
+        bw.align();
+        out.insert(out.end(), {0x00, 0x00, 0xff, 0xff});
+    }
+
+    // Final empty fixed-Huffman block that terminates a stream of pieces
+    inline constexpr uint8_t final_block[2] = {0x03, 0x00};
+
+    [[nodiscard]] inline uint32_t adler32(std::span<const uint8_t> data, uint32_t adler = 1)
+    {
+        uint32_t a = adler & 0xffff, b = adler >> 16;
+        while (!data.empty())
+        {
+            // 5552 bytes is the most that can be summed before b can overflow 32 bits
+            auto chunk = data.first(std::min<size_t>(data.size(), 5552));
+            for (uint8_t byte : chunk)
+            {
+                a += byte;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data = data.subspan(chunk.size());
+        }
+        return (b << 16) | a;
+    }
+
+    // Adler-32 of A followed by B, from adler32(A), adler32(B) and B's length
+    [[nodiscard]] inline uint32_t adler32_combine(uint32_t first, uint32_t second, uint64_t second_length)
+    {
+        constexpr uint64_t mod = 65521;
+        uint64_t rem = second_length % mod;
+        uint64_t a1 = first & 0xffff, b1 = first >> 16;
+        uint64_t a2 = second & 0xffff, b2 = second >> 16;
+        uint64_t a = (a1 + a2 + mod - 1) % mod;
+        uint64_t b = (b1 + b2 + rem * a1 + mod - rem) % mod;
+        return static_cast<uint32_t>((b << 16) | a);
+    }
+
+    [[nodiscard]] inline uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0)
+    {
+        static constexpr auto table = []
+        {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (uint8_t byte : data)
+            crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+}
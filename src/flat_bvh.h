@@ -0,0 +1,471 @@
+#pragma once
+
+#include "common.h"
+#include "cpu_dispatch.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Sphere-only BVH stored as one contiguous, position-independent block: a header followed by
+// the node, sphere, sphere-material and material arrays, all referring to each other by index.
+// The block is exactly what gets written to disk, so a cached file is usable straight out of
+// mmap with no parsing or pointer fix-up, and render processes on one host share its pages.
+//
+//   auto bvh = flat_bvh::open("scene.bvh");        // zero-copy load of a saved BVH
+//   auto bvh = cached_bvh(world, "bvh_cache");     // reuse or build, keyed by content hash
+
+namespace flat_bvh_detail
+{
+    inline constexpr char magic[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+    inline constexpr uint32_t version = 1;         // Bump on any layout or build change
+    inline constexpr uint32_t byte_order = 0x01020304;
+    inline constexpr size_t alignment = 64;
+    inline constexpr int traverse_stack_size = 64; // Deepest tree traverse() can walk
+
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t content_hash; // Of the scene data the tree was built from
+        uint64_t file_size;
+        uint32_t node_count, sphere_count, material_count, reserved;
+        uint64_t nodes_offset, spheres_offset, sphere_materials_offset, materials_offset;
+    };
+
+    // Leaves hold `count` spheres starting at `offset`. Inner nodes have count 0; the left
+    // child is the next node and `offset` is the right child. `axis` is the split axis.
+    struct alignas(32) node
+    {
+        float lo[3];
+        uint32_t offset;
+        float hi[3];
+        uint16_t count, axis;
+    };
+
+    struct alignas(16) sphere_data
+    {
+        float center[3];
+        float radius;
+    };
+
+    struct material_data
+    {
+        uint32_t type;
+        float albedo[3];
+        float parameter;
+    };
+
+    static_assert(sizeof(node) == 32 && sizeof(sphere_data) == 16 && sizeof(material_data) == 20);
+
+    [[nodiscard]] inline bool box_hit(const node &n, const ray &r, const interval &ray_t)
+    {
+#if RT_SIMD_SSE
+        // lo and hi are 16-byte aligned; lane 3 holds the offset/count bits, so clear it
+        return simd_detail::slab_hit(simd_detail::clear_lane3(_mm_load_ps(n.lo)),
+                                     simd_detail::clear_lane3(_mm_load_ps(n.hi)), r, ray_t);
+#else
+        return aabb(point3(n.lo[0], n.lo[1], n.lo[2]), point3(n.hi[0], n.hi[1], n.hi[2])).hit(r, ray_t);
+#endif
+    }
+
+    // Index of the sphere `r` hits first within ray_t, whose max shrinks to that hit; UINT32_MAX
+    // if none. Nearest child first, so the far one is usually culled by the shrinking ray_t.max.
+    [[nodiscard]] inline uint32_t traverse(std::span<const node> nodes, std::span<const sphere_data> spheres,
+                                           const ray &r, interval &ray_t)
+    {
+        const bool dir_negative[3] = {r.direction().x < 0.0f, r.direction().y < 0.0f, r.direction().z < 0.0f};
+        uint32_t stack[traverse_stack_size];
+        int stack_size = 0;
+        uint32_t current = 0;
+        uint32_t closest = UINT32_MAX;
+
+        while (true)
+        {
+            const node &n = nodes[current];
+            if (box_hit(n, r, ray_t))
+            {
+                if (n.count > 0)
+                {
+                    for (uint32_t i = n.offset; i < n.offset + n.count; i++)
+                    {
+                        const auto &s = spheres[i];
+                        real root;
+                        if (sphere::intersect(point3(s.center[0], s.center[1], s.center[2]), s.radius, r, ray_t, root))
+                        {
+                            ray_t.max = root;
+                            closest = i;
+                        }
+                    }
+                }
+                else
+                {
+                    uint32_t near = current + 1, far = n.offset;
+                    if (dir_negative[n.axis])
+                        std::swap(near, far);
+                    stack[stack_size++] = far;
+                    current = near;
+                    continue;
+                }
+            }
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+        return closest;
+    }
+
+    // traverse() compiled for each CPU level (cpu_dispatch.h), the hot loop of every sphere scene
+    [[nodiscard]] inline uint32_t closest_sphere(std::span<const node> nodes, std::span<const sphere_data> spheres,
+                                                 const ray &r, interval &ray_t)
+    {
+        return cpu_dispatch::run([&]
+                                 { return traverse(nodes, spheres, r, ray_t); });
+    }
+
+    // Flattened scene: spheres in scene order, each pointing at a deduplicated material
+    struct scene_data
+    {
+        std::vector<sphere_data> spheres;
+        std::vector<uint32_t> sphere_materials;
+        std::vector<material_data> materials;
+    };
+
+    // Returns nothing if the world holds anything but spheres, or textured materials
+    [[nodiscard]] inline std::optional<scene_data> gather(const hittable_list &world)
+    {
+        scene_data data;
+        std::unordered_map<const material *, uint32_t> seen;
+        for (const auto &object : world.objects)
+        {
+            auto sph = dynamic_cast<const sphere *>(object.get());
+            if (!sph || sph->moving())
+                return std::nullopt; // Moving spheres are left to bvh_node
+
+            const material *mat = sph->material_ptr().get();
+            if (mat->texture())
+                return std::nullopt; // Textures are not part of the block
+            auto [it, inserted] = seen.try_emplace(mat, static_cast<uint32_t>(data.materials.size()));
+            if (inserted)
+            {
+                auto p = mat->params();
+                data.materials.push_back({static_cast<uint32_t>(p.type),
+                                          {float(p.albedo.x), float(p.albedo.y), float(p.albedo.z)}, float(p.parameter)});
+            }
+
+            const auto &c = sph->center();
+            data.spheres.push_back({{float(c.x), float(c.y), float(c.z)}, float(sph->radius())});
+            data.sphere_materials.push_back(it->second);
+        }
+        return data;
+    }
+
+    // FNV-1a over the raw bytes; enough to tell scenes apart, not meant to resist tampering
+    inline uint64_t fnv1a(std::span<const std::byte> bytes, uint64_t h = 0xcbf29ce484222325ULL) noexcept
+    {
+        for (auto b : bytes)
+            h = (h ^ static_cast<uint64_t>(b)) * 0x100000001b3ULL;
+        return h;
+    }
+
+    [[nodiscard]] inline uint64_t content_hash(const scene_data &data) noexcept
+    {
+        uint64_t h = fnv1a(std::as_bytes(std::span(&version, 1)));
+        h = fnv1a(std::as_bytes(std::span(data.spheres)), h);
+        h = fnv1a(std::as_bytes(std::span(data.sphere_materials)), h);
+        return fnv1a(std::as_bytes(std::span(data.materials)), h);
+    }
+
+    [[nodiscard]] constexpr uint64_t align_up(uint64_t n) noexcept
+    {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+class flat_bvh : public hittable
+{
+public:
+    // Builds the tree in memory. Returns nullptr if gather() cannot flatten the world.
+    [[nodiscard]] static std::shared_ptr<flat_bvh> build(const hittable_list &world)
+    {
+        auto data = flat_bvh_detail::gather(world);
+        return data ? build(*data) : nullptr;
+    }
+
+    // Maps a file written by save(). Throws std::runtime_error if it is missing, truncated or
+    // was written by a different version.
+    [[nodiscard]] static std::shared_ptr<flat_bvh> open(const std::filesystem::path &path)
+    {
+        auto bvh = std::shared_ptr<flat_bvh>(new flat_bvh());
+        bvh->file = mapped_file(path);
+        bvh->attach(bvh->file.bytes(), path.string());
+        return bvh;
+    }
+
+    // Writes the block to `path`. The file is written under a temporary name and renamed into
+    // place, so concurrent readers never see a partial file.
+    void save(const std::filesystem::path &path) const
+    {
+        auto temp = path;
+        temp += std::format(".{:08x}.tmp", std::random_device{}());
+        {
+            std::ofstream out(temp, std::ios::binary);
+            out.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size()));
+            if (!out)
+            {
+                std::error_code ignored;
+                std::filesystem::remove(temp, ignored);
+                throw std::runtime_error("cannot write " + temp.string());
+            }
+        }
+        std::filesystem::rename(temp, path);
+    }
+
+    [[nodiscard]] bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        if (spheres.empty())
+            return false;
+
+        uint32_t closest = flat_bvh_detail::closest_sphere(nodes, spheres, r, ray_t);
+        if (closest == UINT32_MAX)
+            return false;
+
+        const auto &s = spheres[closest];
+        point3 center(s.center[0], s.center[1], s.center[2]);
+        sphere::surface_hit(center, s.radius, r, ray_t.max, rec);
+        rec.mat = materials[sphere_materials[closest]];
+        return true;
+    }
+
+    [[nodiscard]] aabb bounding_box() const override
+    {
+        const auto &root = nodes[0];
+        return aabb(point3(root.lo[0], root.lo[1], root.lo[2]), point3(root.hi[0], root.hi[1], root.hi[2]));
+    }
+
+    [[nodiscard]] uint64_t content_hash() const noexcept { return info().content_hash; }
+    [[nodiscard]] size_t node_count() const noexcept { return nodes.size(); }
+    [[nodiscard]] size_t sphere_count() const noexcept { return spheres.size(); }
+    [[nodiscard]] size_t size_bytes() const noexcept { return image.size(); }
+
+    // Friend so the cache can build from data it has already gathered and hashed
+    friend std::shared_ptr<flat_bvh> cached_bvh(const hittable_list &world, const std::filesystem::path &cache_dir);
+
+private:
+    mapped_file file;                                    // Set when opened from disk
+    std::vector<flat_bvh_detail::node> storage;          // Backing block when built in memory
+    std::span<const std::byte> image;                    // The whole block, header included
+    std::span<const flat_bvh_detail::node> nodes;
+    std::span<const flat_bvh_detail::sphere_data> spheres;
+    std::span<const uint32_t> sphere_materials;
+    std::vector<std::shared_ptr<material>> materials;    // Rebuilt from the material table
+
+    flat_bvh() = default;
+
+    [[nodiscard]] const flat_bvh_detail::header &info() const noexcept
+    {
+        return *reinterpret_cast<const flat_bvh_detail::header *>(image.data());
+    }
+
+    // Validates the block and points the spans into it
+    void attach(std::span<const std::byte> bytes, const std::string &source)
+    {
+        using namespace flat_bvh_detail;
+        auto fail = [&](const char *what)
+        { throw std::runtime_error(source + ": " + what); };
+
+        if (bytes.size() < sizeof(header))
+            fail("not a BVH file");
+        const auto &h = *reinterpret_cast<const header *>(bytes.data());
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0)
+            fail("not a BVH file");
+        if (h.version != version)
+            fail("BVH file version mismatch");
+        if (h.byte_order != byte_order)
+            fail("BVH file written with a different byte order");
+        auto fits = [&](uint64_t offset, uint64_t count, uint64_t size)
+        { return offset <= h.file_size && count * size <= h.file_size - offset; };
+        if (h.file_size != bytes.size() || h.node_count == 0 ||
+            !fits(h.nodes_offset, h.node_count, sizeof(node)) ||
+            !fits(h.spheres_offset, h.sphere_count, sizeof(sphere_data)) ||
+            !fits(h.sphere_materials_offset, h.sphere_count, sizeof(uint32_t)) ||
+            !fits(h.materials_offset, h.material_count, sizeof(material_data)))
+            fail("BVH file truncated");
+        if ((h.nodes_offset | h.spheres_offset | h.sphere_materials_offset | h.materials_offset) % alignment != 0)
+            fail("BVH file has misaligned sections");
+
+        image = bytes;
+        nodes = {reinterpret_cast<const node *>(bytes.data() + h.nodes_offset), h.node_count};
+        spheres = {reinterpret_cast<const sphere_data *>(bytes.data() + h.spheres_offset), h.sphere_count};
+        sphere_materials = {reinterpret_cast<const uint32_t *>(bytes.data() + h.sphere_materials_offset), h.sphere_count};
+
+        // Traversal trusts the tree: children within it and after their parent (so it has no
+        // cycles), leaves within the spheres, and no deeper than its fixed stack
+        std::vector<uint8_t> depth(h.node_count, 0);
+        for (uint32_t i = 0; i < h.node_count; i++)
+        {
+            const auto &n = nodes[i];
+            if (n.count > 0)
+            {
+                if (uint64_t(n.offset) + n.count > h.sphere_count)
+                    fail("BVH file has a leaf outside the spheres");
+                continue;
+            }
+            if (n.axis > 2 || i + 1 >= h.node_count || n.offset <= i || n.offset >= h.node_count)
+                fail("BVH file has a bad inner node");
+            if (depth[i] >= traverse_stack_size)
+                fail("BVH file tree too deep");
+            for (uint32_t child : {i + 1, n.offset})
+                depth[child] = std::max<uint8_t>(depth[child], depth[i] + 1);
+        }
+
+        auto table = reinterpret_cast<const material_data *>(bytes.data() + h.materials_offset);
+        materials.clear();
+        for (uint32_t i = 0; i < h.material_count; i++)
+        {
+            const auto &m = table[i];
+            materials.push_back(make_material({static_cast<material_type>(m.type),
+                                               color(m.albedo[0], m.albedo[1], m.albedo[2]), m.parameter}));
+        }
+        for (auto index : sphere_materials)
+            if (index >= h.material_count)
+                fail("BVH file has a bad material index");
+    }
+
+    [[nodiscard]] static std::shared_ptr<flat_bvh> build(const flat_bvh_detail::scene_data &data)
+    {
+        using namespace flat_bvh_detail;
+
+        // Median split on the longest axis, sorted by box minimum, like bvh_node
+        const size_t count = data.spheres.size();
+        std::vector<uint32_t> order(count);
+        for (uint32_t i = 0; i < count; i++)
+            order[i] = i;
+
+        auto lower = [&](uint32_t i, int axis)
+        { return data.spheres[i].center[axis] - data.spheres[i].radius; };
+
+        std::vector<node> tree;
+        tree.reserve(count ? 2 * count : 1);
+        auto emit = [&](auto &self, size_t start, size_t end) -> void
+        {
+            constexpr float inf = std::numeric_limits<float>::infinity(); // Node bounds are float in every precision
+            node n{{inf, inf, inf}, 0, {-inf, -inf, -inf}, 0, 0};
+            for (size_t k = start; k < end; k++)
+            {
+                const auto &s = data.spheres[order[k]];
+                for (int a = 0; a < 3; a++)
+                {
+                    n.lo[a] = std::min(n.lo[a], s.center[a] - s.radius);
+                    n.hi[a] = std::max(n.hi[a], s.center[a] + s.radius);
+                }
+            }
+
+            size_t index = tree.size();
+            tree.push_back(n);
+            if (end - start <= 2)
+            {
+                tree[index].offset = static_cast<uint32_t>(start);
+                tree[index].count = static_cast<uint16_t>(end - start);
+                return;
+            }
+
+            float extent[3] = {n.hi[0] - n.lo[0], n.hi[1] - n.lo[1], n.hi[2] - n.lo[2]};
+            int axis = (extent[0] > extent[1]) ? (extent[0] > extent[2] ? 0 : 2)
+                                               : (extent[1] > extent[2] ? 1 : 2);
+            std::sort(order.begin() + start, order.begin() + end,
+                      [&](uint32_t a, uint32_t b)
+                      { return lower(a, axis) < lower(b, axis); });
+
+            size_t mid = start + (end - start) / 2;
+            self(self, start, mid);
+            tree[index].offset = static_cast<uint32_t>(tree.size());
+            tree[index].axis = static_cast<uint16_t>(axis);
+            self(self, mid, end);
+        };
+        emit(emit, 0, count);
+
+        // Lay out the block: header, nodes, spheres in leaf order, their materials, material table
+        header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order = byte_order;
+        h.content_hash = flat_bvh_detail::content_hash(data);
+        h.node_count = static_cast<uint32_t>(tree.size());
+        h.sphere_count = static_cast<uint32_t>(count);
+        h.material_count = static_cast<uint32_t>(data.materials.size());
+        h.nodes_offset = align_up(sizeof(header));
+        h.spheres_offset = align_up(h.nodes_offset + tree.size() * sizeof(node));
+        h.sphere_materials_offset = align_up(h.spheres_offset + count * sizeof(sphere_data));
+        h.materials_offset = align_up(h.sphere_materials_offset + count * sizeof(uint32_t));
+        h.file_size = h.materials_offset + data.materials.size() * sizeof(material_data);
+
+        auto bvh = std::shared_ptr<flat_bvh>(new flat_bvh());
+        bvh->storage.resize((h.file_size + sizeof(node) - 1) / sizeof(node));
+        auto *base = reinterpret_cast<std::byte *>(bvh->storage.data());
+        std::memcpy(base, &h, sizeof(h));
+        std::memcpy(base + h.nodes_offset, tree.data(), tree.size() * sizeof(node));
+        for (size_t k = 0; k < count; k++)
+        {
+            std::memcpy(base + h.spheres_offset + k * sizeof(sphere_data), &data.spheres[order[k]], sizeof(sphere_data));
+            std::memcpy(base + h.sphere_materials_offset + k * sizeof(uint32_t), &data.sphere_materials[order[k]], sizeof(uint32_t));
+        }
+        std::memcpy(base + h.materials_offset, data.materials.data(), data.materials.size() * sizeof(material_data));
+
+        bvh->attach({base, h.file_size}, "<memory>");
+        return bvh;
+    }
+};
+
+// Returns the flat BVH of `world`, mapped from `cache_dir`/<content hash>.bvh when an earlier
+// run already built it, otherwise built now and stored there for the next run (with a warning
+// on stderr if it cannot be). Returns nullptr if the world holds anything but spheres.
+[[nodiscard]] inline std::shared_ptr<flat_bvh> cached_bvh(const hittable_list &world, const std::filesystem::path &cache_dir)
+{
+    auto data = flat_bvh_detail::gather(world);
+    if (!data)
+        return nullptr;
+
+    auto hash = flat_bvh_detail::content_hash(*data);
+    auto path = cache_dir / std::format("{:016x}.bvh", hash);
+    if (std::filesystem::exists(path))
+    {
+        try
+        {
+            auto bvh = flat_bvh::open(path);
+            if (bvh->content_hash() == hash)
+                return bvh;
+        }
+        catch (const std::exception &)
+        {
+            // Stale or damaged entry: rebuild and overwrite it below
+        }
+    }
+
+    auto bvh = flat_bvh::build(*data);
+    try
+    {
+        std::filesystem::create_directories(cache_dir);
+        bvh->save(path);
+    }
+    catch (const std::exception &e)
+    {
+        // A read-only or full cache only costs the next run its build
+        std::println(stderr, "BVH cache: {}; rendering without caching", e.what());
+    }
+    return bvh;
+}
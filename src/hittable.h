@@ -2,12 +2,25 @@
 
 #include "ray.h"
 #include "aabb.h"
-
-using real = float;
+#include "precision.h"
 
 // Forward declare material
 class material;
 
+// Origin for a ray leaving point p of a sphere of `radius` in `direction`: p moved along the
+// unit `normal`, to the side `direction` is on, by more than p's rounding error. A point
+// computed as center + radius * normal is within gamma_bound(7) * (|center| + radius) of the
+// surface per component, and |center| is at most |p| + radius (Pharr et al., "Physically
+// Based Rendering", 4th ed., 6.8.6). Rays from here look for hits over interval::positive,
+// with no epsilon to tune per scene.
+[[nodiscard]] inline point3 spawn_origin(const point3 &p, const vec3 &normal, real radius, const vec3 &direction)
+{
+    const real margin = 2 * radius;
+    vec3 error = gamma_bound(7) * vec3(std::abs(p.x) + margin, std::abs(p.y) + margin, std::abs(p.z) + margin);
+    real offset = std::abs(normal.x) * error.x + std::abs(normal.y) * error.y + std::abs(normal.z) * error.z;
+    return p + (dot(direction, normal) > 0 ? offset : -offset) * normal;
+}
+
 struct hit_record
 {
     point3 p;
@@ -15,6 +28,8 @@ struct hit_record
     std::shared_ptr<material> mat;
     real t;
     bool front_face;
+    real radius = 1;    // Of the sphere hit; relates surface distances to texture coordinates and bounds p's error
+    real footprint = 0; // Width of the ray cone at p, for texture filtering (0 = sharpest)
 
     // Sets the hit record normal vector.
     // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -23,6 +38,12 @@ struct hit_record
         front_face = dot(r.direction(), outward_normal) < 0.0f;
         normal = front_face ? outward_normal : -outward_normal;
     }
+
+    // A ray leaving the surface at p, from spawn_origin()
+    [[nodiscard]] ray spawn_ray(const vec3 &direction, real time) const
+    {
+        return ray(spawn_origin(p, normal, radius, direction), direction, time);
+    }
 };
 
 class hittable
@@ -34,4 +55,10 @@ public:
         const ray &r, interval ray_t, hit_record &rec) const = 0;
 
     [[nodiscard]] virtual aabb bounding_box() const = 0;
+
+    // Objects that move over the shutter interval: bounding_box() covers the whole sweep, and
+    // bounding_box_at() the object at a time in [0, 1]. Objects move linearly, so a BVH can
+    // interpolate boxes at times 0 and 1 instead of bounding every sweep.
+    [[nodiscard]] virtual bool moving() const { return false; }
+    [[nodiscard]] virtual aabb bounding_box_at([[maybe_unused]] real time) const { return bounding_box(); }
 };
@@ -28,7 +28,7 @@ public:
     {
         // Update the bounding box to include the new object
         bbox = aabb(bbox, object->bounding_box());
-        objects.push_back(object);
+        objects.push_back(std::move(object));
     }
 
     [[nodiscard]] constexpr bool hit(
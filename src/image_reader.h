@@ -0,0 +1,208 @@
+#pragma once
+
+#include "color.h"
+#include "image_writer.h"
+#include "mapped_file.h"
+
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Readers for the float formats image_writer.h produces: Radiance .hdr (flat or run-length
+// encoded scanlines) and .pfm (RGB or grayscale). Files are memory-mapped, so only the decoded
+// texels take memory.
+
+struct float_image
+{
+    int width = 0, height = 0;
+    std::vector<color> texels; // Linear values, row-major, top row first
+};
+
+namespace image_reader_detail
+{
+    class cursor
+    {
+    public:
+        cursor(std::span<const std::byte> data, const std::filesystem::path &path)
+            : bytes(reinterpret_cast<const uint8_t *>(data.data()), data.size()), path(path) {}
+
+        [[noreturn]] void fail(const std::string &what) const
+        {
+            throw std::runtime_error(path.string() + ": " + what);
+        }
+
+        // Next '\n'-terminated line, without the terminator
+        std::string_view line()
+        {
+            auto rest = remaining();
+            auto end = rest.find('\n');
+            if (end == std::string_view::npos)
+                fail("truncated header");
+            position += end + 1;
+            return rest.substr(0, end);
+        }
+
+        std::span<const uint8_t> take(size_t n)
+        {
+            if (bytes.size() - position < n)
+                fail("truncated pixel data");
+            auto s = bytes.subspan(position, n);
+            position += n;
+            return s;
+        }
+
+        uint8_t next() { return take(1)[0]; }
+
+    private:
+        std::span<const uint8_t> bytes;
+        std::filesystem::path path;
+        size_t position = 0;
+
+        [[nodiscard]] std::string_view remaining() const
+        {
+            return {reinterpret_cast<const char *>(bytes.data()) + position, bytes.size() - position};
+        }
+    };
+
+    // Parses whitespace-separated numbers from `text` in order; false if any is missing
+    template <typename... T>
+    bool parse(std::string_view text, T &...values)
+    {
+        const char *p = text.data(), *end = text.data() + text.size();
+        auto one = [&](auto &value)
+        {
+            while (p < end && *p == ' ')
+                p++;
+            auto [next, error] = std::from_chars(p, end, value);
+            p = next;
+            return error == std::errc();
+        };
+        return (one(values) && ...);
+    }
+
+    [[nodiscard]] inline color from_rgbe(const uint8_t *rgbe)
+    {
+        if (rgbe[3] == 0)
+            return {0, 0, 0};
+        real scale = std::ldexp(1.0f, rgbe[3] - (128 + 8));
+        return {(rgbe[0] + 0.5f) * scale, (rgbe[1] + 0.5f) * scale, (rgbe[2] + 0.5f) * scale};
+    }
+
+    inline float_image read_hdr(cursor &in)
+    {
+        for (auto header = in.line(); !header.empty(); header = in.line())
+            if (header.starts_with("FORMAT=") && header != "FORMAT=32-bit_rle_rgbe")
+                in.fail("unsupported format " + std::string(header));
+
+        float_image image;
+        auto resolution = in.line();
+        if (!resolution.starts_with("-Y ") || !parse(resolution.substr(3), image.height) ||
+            resolution.find("+X ") == std::string_view::npos ||
+            !parse(resolution.substr(resolution.find("+X ") + 3), image.width) ||
+            image.width <= 0 || image.height <= 0)
+            in.fail("only top-down, left-to-right images are supported");
+
+        const int w = image.width;
+        image.texels.resize(static_cast<size_t>(w) * image.height);
+        std::vector<uint8_t> scanline(static_cast<size_t>(w) * 4);
+        for (int y = 0; y < image.height; y++)
+        {
+            auto start = in.take(4);
+            bool rle = w >= 8 && w <= 0x7fff && start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == w;
+            if (!rle)
+            {
+                if (start[0] == 1 && start[1] == 1 && start[2] == 1)
+                    in.fail("old-style run-length encoding is not supported");
+                std::memcpy(scanline.data(), start.data(), 4);
+                auto rest = in.take(static_cast<size_t>(w - 1) * 4);
+                std::memcpy(scanline.data() + 4, rest.data(), rest.size());
+            }
+            else
+            {
+                // Each channel is stored separately as runs and literal spans
+                for (int ch = 0; ch < 4; ch++)
+                {
+                    for (int x = 0; x < w;)
+                    {
+                        int count = in.next();
+                        bool run = count > 128;
+                        if (run)
+                            count -= 128;
+                        if (count == 0 || x + count > w)
+                            in.fail("corrupt scanline");
+                        if (run)
+                        {
+                            uint8_t value = in.next();
+                            for (int k = 0; k < count; k++)
+                                scanline[(x++) * 4 + ch] = value;
+                        }
+                        else
+                        {
+                            auto literal = in.take(count);
+                            for (uint8_t value : literal)
+                                scanline[(x++) * 4 + ch] = value;
+                        }
+                    }
+                }
+            }
+            for (int x = 0; x < w; x++)
+                image.texels[static_cast<size_t>(y) * w + x] = from_rgbe(&scanline[x * 4]);
+        }
+        return image;
+    }
+
+    inline float_image read_pfm(cursor &in)
+    {
+        auto magic = in.line();
+        if (magic != "PF" && magic != "Pf")
+            in.fail("not a PFM file");
+        const int channels = (magic == "PF") ? 3 : 1;
+
+        float_image image;
+        float scale = 0;
+        if (!parse(in.line(), image.width, image.height) || !parse(in.line(), scale) ||
+            image.width <= 0 || image.height <= 0)
+            in.fail("bad header");
+        bool swap = (scale < 0) != (std::endian::native == std::endian::little);
+
+        const int w = image.width;
+        image.texels.resize(static_cast<size_t>(w) * image.height);
+        for (int y = image.height - 1; y >= 0; y--) // Rows are stored bottom to top
+        {
+            auto row = in.take(static_cast<size_t>(w) * channels * sizeof(float));
+            for (int x = 0; x < w; x++)
+            {
+                float v[3];
+                for (int c = 0; c < channels; c++)
+                {
+                    uint32_t bits;
+                    std::memcpy(&bits, row.data() + (x * channels + c) * sizeof(float), sizeof(bits));
+                    if (swap)
+                        bits = std::byteswap(bits);
+                    v[c] = std::bit_cast<float>(bits);
+                }
+                image.texels[static_cast<size_t>(y) * w + x] = (channels == 3) ? color(v[0], v[1], v[2]) : color(v[0], v[0], v[0]);
+            }
+        }
+        return image;
+    }
+}
+
+// Loads a .hdr or .pfm file; throws std::runtime_error on unknown or malformed files
+[[nodiscard]] inline float_image read_float_image(const std::filesystem::path &path)
+{
+    mapped_file file(path);
+    image_reader_detail::cursor in(file.bytes(), path);
+    auto ext = image_extension(path);
+    if (ext == ".hdr")
+        return image_reader_detail::read_hdr(in);
+    if (ext == ".pfm")
+        return image_reader_detail::read_pfm(in);
+    throw std::runtime_error("unsupported float image format: " + path.string());
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "color.h"
+#include "deflate.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Streaming image writers. Rows are appended top to bottom as they are finished and go
+// straight to disk, so memory use does not depend on the image height, and each batch of rows
+// is encoded in parallel. Formats are chosen by extension:
+//
+//   .png   8-bit, row strips deflated independently in parallel
+//   .ppm   8-bit binary P6, uncompressed
+//   .pfm   32-bit float, linear
+//   .hdr   Radiance RGBE, linear, run-length encoded per scanline
+
+class image_writer
+{
+public:
+    image_writer(int width, int height) : width(width), height(height) {}
+    virtual ~image_writer() = default;
+
+    // Appends finished rows of linear colors (averaged samples, before gamma), top to bottom
+    virtual void write_rows(std::span<const color> rows) = 0;
+
+    // Completes the file; throws std::runtime_error if rows are missing or writing failed
+    virtual void finish() = 0;
+
+    const int width, height;
+
+protected:
+    int rows_written = 0;
+
+    void check_complete(const std::filesystem::path &path, const std::ofstream &out) const
+    {
+        if (rows_written != height)
+            throw std::runtime_error(std::format("{}: {} of {} rows written", path.string(), rows_written, height));
+        if (!out)
+            throw std::runtime_error("cannot write " + path.string());
+    }
+
+    int accept_rows(size_t values)
+    {
+        int count = static_cast<int>(values / width);
+        if (count * static_cast<size_t>(width) != values || rows_written + count > height)
+            throw std::logic_error("image_writer: rows do not fit the image");
+        rows_written += count;
+        return count;
+    }
+};
+
+// Writers that store 8-bit pixels; they also take already converted pixels directly
+class pixel_writer : public image_writer
+{
+public:
+    using image_writer::image_writer;
+
+    virtual void write_pixels(std::span<const Pixel> rows) = 0;
+
+    void write_rows(std::span<const color> rows) override
+    {
+        converted.resize(rows.size());
+        std::vector<int> row_indices(rows.size() / width);
+        std::iota(row_indices.begin(), row_indices.end(), 0);
+        std::for_each(std::execution::par, row_indices.begin(), row_indices.end(),
+                      [&](int r)
+                      {
+                          size_t first = static_cast<size_t>(r) * width;
+                          to_pixels(rows.subspan(first, width), std::span(converted).subspan(first, width));
+                      });
+        write_pixels(converted);
+    }
+
+private:
+    std::vector<Pixel> converted;
+};
+
+class png_writer : public pixel_writer
+{
+public:
+    png_writer(const std::filesystem::path &path, int width, int height)
+        : pixel_writer(width, height), path(path), out(path, std::ios::binary), previous(width * 3, 0)
+    {
+        static_assert(sizeof(Pixel) == 3);
+        static constexpr uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        out.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+
+        std::vector<uint8_t> ihdr;
+        put_be32(ihdr, width);
+        put_be32(ihdr, height);
+        ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, deflate, adaptive filters, no interlace
+        write_chunk("IHDR", ihdr);
+    }
+
+    void write_pixels(std::span<const Pixel> rows) override
+    {
+        const int count = accept_rows(rows.size());
+        const size_t stride = static_cast<size_t>(width) * 3;
+        const auto *raw = reinterpret_cast<const uint8_t *>(rows.data());
+
+        // Strips of roughly 256 KiB are enough to keep every core busy without hurting the ratio
+        const int strip_rows = std::max(1, static_cast<int>((256 * 1024) / (stride + 1)));
+        const int strip_count = (count + strip_rows - 1) / strip_rows;
+
+        struct strip
+        {
+            std::vector<uint8_t> compressed;
+            uint32_t adler;
+            size_t length;
+        };
+        std::vector<strip> strips(strip_count);
+        std::vector<int> indices(strip_count);
+        std::iota(indices.begin(), indices.end(), 0);
+
+        std::for_each(std::execution::par, indices.begin(), indices.end(),
+                      [&](int s)
+                      {
+                          int first = s * strip_rows;
+                          int last = std::min(count, first + strip_rows);
+                          std::vector<uint8_t> filtered;
+                          filtered.reserve((last - first) * (stride + 1));
+                          for (int r = first; r < last; r++)
+                          {
+                              // The row above the first one of the batch is the last one written before
+                              const uint8_t *above = (r == 0) ? previous.data() : raw + (r - 1) * stride;
+                              filter_row(raw + r * stride, above, stride, filtered);
+                          }
+                          strips[s].adler = deflate::adler32(filtered);
+                          strips[s].length = filtered.size();
+                          deflate::compress_piece(filtered, strips[s].compressed);
+                      });
+
+        std::vector<uint8_t> idat;
+        if (first_batch)
+        {
+            idat.insert(idat.end(), {0x78, 0x01}); // zlib header: deflate, 32K window, no dictionary
+            first_batch = false;
+        }
+        for (const auto &s : strips)
+        {
+            idat.insert(idat.end(), s.compressed.begin(), s.compressed.end());
+            adler = deflate::adler32_combine(adler, s.adler, s.length);
+        }
+        write_chunk("IDAT", idat);
+
+        if (count > 0)
+            std::memcpy(previous.data(), raw + (count - 1) * stride, stride);
+    }
+
+    void finish() override
+    {
+        std::vector<uint8_t> tail(std::begin(deflate::final_block), std::end(deflate::final_block));
+        if (first_batch)
+            tail.insert(tail.begin(), {0x78, 0x01});
+        put_be32(tail, adler);
+        write_chunk("IDAT", tail);
+        write_chunk("IEND", {});
+        out.flush();
+        check_complete(path, out);
+    }
+
+private:
+    std::filesystem::path path;
+    std::ofstream out;
+    std::vector<uint8_t> previous; // Last row written, unfiltered
+    uint32_t adler = 1;
+    bool first_batch = true;
+
+    static void put_be32(std::vector<uint8_t> &v, uint32_t x)
+    {
+        v.insert(v.end(), {uint8_t(x >> 24), uint8_t(x >> 16), uint8_t(x >> 8), uint8_t(x)});
+    }
+
+    void write_chunk(const char (&type)[5], const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> header;
+        put_be32(header, static_cast<uint32_t>(data.size()));
+        header.insert(header.end(), type, type + 4);
+        uint32_t crc = deflate::crc32(std::span(header).subspan(4));
+        crc = deflate::crc32(data, crc);
+
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+        out.write(reinterpret_cast<const char *>(data.data()), data.size());
+        std::vector<uint8_t> trailer;
+        put_be32(trailer, crc);
+        out.write(reinterpret_cast<const char *>(trailer.data()), trailer.size());
+    }
+
+    // Appends the filter byte and filtered row, picking the filter with the smallest sum of
+    // absolute residuals (the usual PNG heuristic)
+    static void filter_row(const uint8_t *row, const uint8_t *above, size_t stride, std::vector<uint8_t> &out)
+    {
+        auto paeth = [](int a, int b, int c)
+        {
+            int p = a + b - c;
+            int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b
+                                                           : c;
+        };
+        auto residual = [&](int filter, size_t i) -> uint8_t
+        {
+            int a = (i >= 3) ? row[i - 3] : 0;
+            int b = above[i];
+            int c = (i >= 3) ? above[i - 3] : 0;
+            switch (filter)
+            {
+            case 1:
+                return uint8_t(row[i] - a);
+            case 2:
+                return uint8_t(row[i] - b);
+            case 3:
+                return uint8_t(row[i] - ((a + b) >> 1));
+            case 4:
+                return uint8_t(row[i] - paeth(a, b, c));
+            default:
+                return row[i];
+            }
+        };
+
+        int best = 0;
+        long best_cost = -1;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            long cost = 0;
+            for (size_t i = 0; i < stride; i++)
+                cost += std::abs(static_cast<int8_t>(residual(filter, i)));
+            if (best_cost < 0 || cost < best_cost)
+            {
+                best = filter;
+                best_cost = cost;
+            }
+        }
+
+        out.push_back(static_cast<uint8_t>(best));
+        for (size_t i = 0; i < stride; i++)
+            out.push_back(residual(best, i));
+    }
+};
+
+class ppm_writer : public pixel_writer
+{
+public:
+    ppm_writer(const std::filesystem::path &path, int width, int height)
+        : pixel_writer(width, height), path(path), out(path, std::ios::binary)
+    {
+        out << "P6\n"
+            << width << " " << height << "\n255\n";
+    }
+
+    void write_pixels(std::span<const Pixel> rows) override
+    {
+        accept_rows(rows.size());
+        out.write(reinterpret_cast<const char *>(rows.data()), rows.size_bytes());
+    }
+
+    void finish() override
+    {
+        out.flush();
+        check_complete(path, out);
+    }
+
+private:
+    std::filesystem::path path;
+    std::ofstream out;
+};
+
+class pfm_writer : public image_writer
+{
+public:
+    pfm_writer(const std::filesystem::path &path, int width, int height)
+        : image_writer(width, height), path(path), out(path, std::ios::binary)
+    {
+        // A negative scale marks little-endian data
+        out << "PF\n"
+            << width << " " << height << "\n"
+            << (std::endian::native == std::endian::little ? "-1.0" : "1.0") << "\n";
+        data_offset = out.tellp();
+        out.flush();
+        // PFM stores rows bottom to top, so size the file up front and place rows by offset
+        std::filesystem::resize_file(path, static_cast<uintmax_t>(data_offset) + row_bytes() * height);
+    }
+
+    void write_rows(std::span<const color> rows) override
+    {
+        int first = rows_written;
+        int count = accept_rows(rows.size());
+        std::vector<float> row(width * 3);
+        for (int r = 0; r < count; r++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const auto &c = rows[r * width + x];
+                row[x * 3 + 0] = c.x;
+                row[x * 3 + 1] = c.y;
+                row[x * 3 + 2] = c.z;
+            }
+            out.seekp(data_offset + static_cast<std::streamoff>((height - 1 - (first + r)) * row_bytes()));
+            out.write(reinterpret_cast<const char *>(row.data()), row_bytes());
+        }
+    }
+
+    void finish() override
+    {
+        out.flush();
+        check_complete(path, out);
+    }
+
+private:
+    std::filesystem::path path;
+    std::ofstream out;
+    std::streamoff data_offset = 0;
+
+    [[nodiscard]] std::streamsize row_bytes() const { return static_cast<std::streamsize>(width) * 3 * sizeof(float); }
+};
+
+class hdr_writer : public image_writer
+{
+public:
+    hdr_writer(const std::filesystem::path &path, int width, int height)
+        : image_writer(width, height), path(path), out(path, std::ios::binary)
+    {
+        out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+    }
+
+    void write_rows(std::span<const color> rows) override
+    {
+        int count = accept_rows(rows.size());
+        std::vector<std::vector<uint8_t>> encoded(count);
+        std::vector<int> indices(count);
+        std::iota(indices.begin(), indices.end(), 0);
+        std::for_each(std::execution::par, indices.begin(), indices.end(),
+                      [&](int r)
+                      { encode_row(rows.subspan(static_cast<size_t>(r) * width, width), encoded[r]); });
+        for (const auto &e : encoded)
+            out.write(reinterpret_cast<const char *>(e.data()), e.size());
+    }
+
+    void finish() override
+    {
+        out.flush();
+        check_complete(path, out);
+    }
+
+    // Shared exponent encoding of one linear color
+    [[nodiscard]] static std::array<uint8_t, 4> to_rgbe(const color &c)
+    {
+        float v = std::max({c.x, c.y, c.z});
+        if (!(v > 1e-32f))
+            return {0, 0, 0, 0};
+        int exponent;
+        float scale = std::frexp(v, &exponent) * 256.0f / v;
+        auto channel = [scale](float x)
+        { return static_cast<uint8_t>(std::max(0.0f, x * scale)); };
+        return {channel(c.x), channel(c.y), channel(c.z), static_cast<uint8_t>(exponent + 128)};
+    }
+
+private:
+    std::filesystem::path path;
+    std::ofstream out;
+
+    void encode_row(std::span<const color> row, std::vector<uint8_t> &out) const
+    {
+        std::vector<std::array<uint8_t, 4>> rgbe(row.size());
+        std::transform(row.begin(), row.end(), rgbe.begin(), to_rgbe);
+
+        // The run-length scheme only exists for widths 8..32767; other rows are stored flat
+        if (width < 8 || width > 0x7fff)
+        {
+            for (const auto &p : rgbe)
+                out.insert(out.end(), p.begin(), p.end());
+            return;
+        }
+
+        out.insert(out.end(), {2, 2, uint8_t(width >> 8), uint8_t(width & 0xff)});
+        std::vector<uint8_t> channel(width);
+        for (int ch = 0; ch < 4; ch++)
+        {
+            for (int x = 0; x < width; x++)
+                channel[x] = rgbe[x][ch];
+
+            // Runs of 4+ equal bytes as (128 + length, value); everything else as literal spans
+            int x = 0;
+            while (x < width)
+            {
+                int run = 1;
+                while (x + run < width && run < 127 && channel[x + run] == channel[x])
+                    run++;
+                if (run >= 4)
+                {
+                    out.insert(out.end(), {uint8_t(128 + run), channel[x]});
+                    x += run;
+                    continue;
+                }
+
+                int start = x, length = 0;
+                while (x < width && length < 128)
+                {
+                    int ahead = 1;
+                    while (x + ahead < width && ahead < 4 && channel[x + ahead] == channel[x])
+                        ahead++;
+                    if (ahead >= 4)
+                        break;
+                    x++;
+                    length++;
+                }
+                out.push_back(static_cast<uint8_t>(length));
+                out.insert(out.end(), channel.begin() + start, channel.begin() + start + length);
+            }
+        }
+    }
+};
+
+// Lowercase extension of `path`, including the dot
+[[nodiscard]] inline std::string image_extension(const std::filesystem::path &path)
+{
+    auto ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+// True for formats that keep linear floating point values rather than 8-bit pixels
+[[nodiscard]] inline bool is_float_image(const std::filesystem::path &path)
+{
+    auto ext = image_extension(path);
+    return ext == ".pfm" || ext == ".hdr";
+}
+
+// Opens the writer for `path`'s extension; throws std::runtime_error for unknown extensions
+[[nodiscard]] inline std::unique_ptr<image_writer> open_image_writer(const std::filesystem::path &path, int width, int height)
+{
+    auto ext = image_extension(path);
+    if (ext == ".png")
+        return std::make_unique<png_writer>(path, width, height);
+    if (ext == ".ppm")
+        return std::make_unique<ppm_writer>(path, width, height);
+    if (ext == ".pfm")
+        return std::make_unique<pfm_writer>(path, width, height);
+    if (ext == ".hdr")
+        return std::make_unique<hdr_writer>(path, width, height);
+    throw std::runtime_error("unsupported image format: " + path.string());
+}
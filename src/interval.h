@@ -38,8 +38,9 @@ public:
         return x;
     }
 
-    static const interval empty, universe;
+    static const interval empty, universe, positive;
 };
 
 inline constexpr interval interval::empty = interval(+infinity, -infinity);
-inline constexpr interval interval::universe = interval(-infinity, +infinity);
\ No newline at end of file
+inline constexpr interval interval::universe = interval(-infinity, +infinity);
+inline constexpr interval interval::positive = interval(0, +infinity); // Every hit ahead of a ray's origin
\ No newline at end of file
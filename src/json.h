@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Minimal JSON reader/writer helpers for tool output (benchmark results, baselines).
+// Supports the full grammar except \u escapes beyond ASCII.
+
+struct json_value
+{
+    enum class kind
+    {
+        null,
+        boolean,
+        number,
+        string,
+        array,
+        object
+    };
+
+    kind type = kind::null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<json_value> array;
+    std::vector<std::pair<std::string, json_value>> object;
+
+    // Returns nullptr if this is not an object or the key is missing
+    [[nodiscard]] const json_value *find(std::string_view key) const
+    {
+        for (const auto &[k, v] : object)
+            if (k == key)
+                return &v;
+        return nullptr;
+    }
+};
+
+namespace json_detail
+{
+    class parser
+    {
+    public:
+        explicit parser(std::string_view text) : text(text) {}
+
+        json_value parse_document()
+        {
+            auto value = parse_value();
+            skip_whitespace();
+            if (pos != text.size())
+                fail("trailing characters");
+            return value;
+        }
+
+    private:
+        std::string_view text;
+        size_t pos = 0;
+
+        [[noreturn]] void fail(const char *what) const
+        {
+            throw std::runtime_error("JSON parse error at offset " + std::to_string(pos) + ": " + what);
+        }
+
+        void skip_whitespace()
+        {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+                pos++;
+        }
+
+        void expect(char c)
+        {
+            skip_whitespace();
+            if (pos >= text.size() || text[pos] != c)
+                fail("unexpected character");
+            pos++;
+        }
+
+        bool consume(std::string_view literal)
+        {
+            if (text.substr(pos, literal.size()) != literal)
+                return false;
+            pos += literal.size();
+            return true;
+        }
+
+        json_value parse_value()
+        {
+            skip_whitespace();
+            if (pos >= text.size())
+                fail("unexpected end of input");
+
+            json_value v;
+            char c = text[pos];
+            if (c == '{')
+            {
+                v.type = json_value::kind::object;
+                pos++;
+                skip_whitespace();
+                if (pos < text.size() && text[pos] == '}')
+                {
+                    pos++;
+                    return v;
+                }
+                do
+                {
+                    skip_whitespace();
+                    auto key = parse_string();
+                    expect(':');
+                    v.object.emplace_back(std::move(key), parse_value());
+                    skip_whitespace();
+                } while (pos < text.size() && text[pos] == ',' && ++pos);
+                expect('}');
+            }
+            else if (c == '[')
+            {
+                v.type = json_value::kind::array;
+                pos++;
+                skip_whitespace();
+                if (pos < text.size() && text[pos] == ']')
+                {
+                    pos++;
+                    return v;
+                }
+                do
+                {
+                    v.array.push_back(parse_value());
+                    skip_whitespace();
+                } while (pos < text.size() && text[pos] == ',' && ++pos);
+                expect(']');
+            }
+            else if (c == '"')
+            {
+                v.type = json_value::kind::string;
+                v.string = parse_string();
+            }
+            else if (consume("true") || consume("false"))
+            {
+                v.type = json_value::kind::boolean;
+                v.boolean = (c == 't');
+            }
+            else if (consume("null"))
+            {
+                v.type = json_value::kind::null;
+            }
+            else
+            {
+                v.type = json_value::kind::number;
+                auto [end, ec] = std::from_chars(text.data() + pos, text.data() + text.size(), v.number);
+                if (ec != std::errc())
+                    fail("invalid value");
+                pos = end - text.data();
+            }
+            return v;
+        }
+
+        std::string parse_string()
+        {
+            if (pos >= text.size() || text[pos] != '"')
+                fail("expected string");
+            pos++;
+
+            std::string out;
+            while (pos < text.size() && text[pos] != '"')
+            {
+                char c = text[pos++];
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+                if (pos >= text.size())
+                    fail("unterminated escape");
+                switch (char e = text[pos++])
+                {
+                case 'n':
+                    out += '\n';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 'u':
+                {
+                    unsigned code = 0;
+                    auto [end, ec] = std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16);
+                    if (ec != std::errc() || end != text.data() + pos + 4)
+                        fail("invalid \\u escape");
+                    out += code < 0x80 ? static_cast<char>(code) : '?';
+                    pos += 4;
+                    break;
+                }
+                default:
+                    out += e;
+                }
+            }
+            if (pos >= text.size())
+                fail("unterminated string");
+            pos++;
+            return out;
+        }
+    };
+}
+
+// Throws std::runtime_error on malformed input
+[[nodiscard]] inline json_value parse_json(std::string_view text)
+{
+    return json_detail::parser(text).parse_document();
+}
+
+// Quotes and escapes a string for embedding in JSON output
+[[nodiscard]] inline std::string json_quote(std::string_view s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                out += ' ';
+            else
+                out += c;
+        }
+    }
+    return out + "\"";
+}
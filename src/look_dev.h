@@ -0,0 +1,245 @@
+#pragma once
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <execution>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Look-dev sessions: re-render a scene after material or emitter edits without tracing all of
+// it again. The first render() traces the image as camera::render() does, and keeps the BVH,
+// every pixel's value, the primary hit of every sample (position, normal, material slot)
+// and which materials each pixel's paths touched. After set_material(), render() re-shades only
+// the pixels whose paths touched an edited material, starting from their cached primary hits;
+// the rest keep their values. Every sample replays its own random stream, so the image is
+// bit-identical to a full render of the edited scene.
+//
+//   look_dev_session session(world, cam);
+//   session.render();
+//   session.set_material(session.slot(red.get()), make_material({material_type::metal, color(0.8, 0.2, 0.2), 0.1}));
+//   session.render();
+//   session.save("lookdev.png");
+//
+// Edits replace the material on the scene's spheres in place, so the scene must outlive the
+// session and not be rendered elsewhere meanwhile. Geometry, camera and environment changes
+// need a new session. Settings that render in rounds (see camera::renders_in_rounds: time
+// budgets, caustic photons, path guiding, target errors) and memory budgets are not supported.
+
+class look_dev_session
+{
+public:
+    // Primary hits are cached for as many leading samples per pixel as fit in hit_cache_bytes;
+    // the remaining samples trace their camera rays again when re-shaded
+    look_dev_session(const hittable_list &world, camera settings, size_t hit_cache_bytes = 256u << 20)
+        : cam(std::move(settings))
+    {
+        if (cam.renders_in_rounds())
+            throw std::invalid_argument("look_dev_session: time budgets, caustic photons, path guiding and target errors are not supported");
+        if (cam.memory_budget > 0)
+            throw std::invalid_argument("look_dev_session: memory_budget is not supported");
+        cam.initialize();
+
+        for (const auto &object : world.objects)
+        {
+            auto sph = std::dynamic_pointer_cast<sphere>(object);
+            if (!sph)
+                continue;
+            auto [it, added] = slots.try_emplace(sph->material_ptr().get(), static_cast<uint32_t>(materials.size()));
+            if (added)
+            {
+                materials.push_back(sph->material_ptr());
+                users.emplace_back();
+            }
+            users[it->second].push_back(sph);
+        }
+
+        auto build_start = std::chrono::high_resolution_clock::now();
+        // Always a bvh_node: a flat BVH would hold copies of the materials
+        bvh = std::make_shared<bvh_node>(world, cam.leaf_objects());
+        build_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+        const size_t count = static_cast<size_t>(cam.image_width) * cam.image_height;
+        const size_t per_sample = std::max<size_t>(count * sizeof(primary_hit), 1);
+        cached_samples = cam.max_depth > 0 ? static_cast<int>(std::min<size_t>(cam.samples_per_pixel, hit_cache_bytes / per_sample)) : 0;
+        hits.resize(count * cached_samples);
+        touched.resize(count);
+        pixels.resize(count);
+    }
+
+    // Renders the whole image the first time, then the pixels the edits since affect
+    camera::render_stats render()
+    {
+        thread_limit limit(cam.worker_threads());
+        std::vector<int> rows(cam.image_height);
+        std::iota(rows.begin(), rows.end(), 0);
+        const bool first = !rendered;
+        std::atomic<size_t> shaded{0};
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        {
+            trace::scope phase(first ? "render" : "reshade");
+            std::for_each(std::execution::par, rows.begin(), rows.end(),
+                          [this, first, &shaded](int j)
+                          {
+                              size_t row_shaded = 0;
+                              for (int i = 0; i < cam.image_width; i++)
+                              {
+                                  const size_t index = static_cast<size_t>(j) * cam.image_width + i;
+                                  if (!first && !(touched[index] & edited))
+                                      continue;
+                                  shade_pixel(i, j, first);
+                                  row_shaded++;
+                              }
+                              shaded += row_shaded;
+                          });
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+
+        rendered = true;
+        edited = 0;
+        last_shaded = shaded.load();
+
+        camera::render_stats stats;
+        stats.render_seconds = std::chrono::duration<double>(end_time - start_time).count();
+        stats.build_seconds = first ? build_seconds : 0;
+        stats.rays = static_cast<uint64_t>(last_shaded) * cam.samples_per_pixel;
+        last_stats = stats;
+        return stats;
+    }
+
+    // Gives material slot `slot` a new material: every sphere using it switches over, and the
+    // next render() re-shades the pixels whose paths touched it
+    void set_material(size_t slot, std::shared_ptr<material> replacement)
+    {
+        auto &current = materials.at(slot);
+        edited |= camera::material_bit(current.get());
+        for (const auto &sph : users[slot])
+            sph->set_material(replacement);
+        slots.erase(current.get());
+        slots[replacement.get()] = static_cast<uint32_t>(slot);
+        current = std::move(replacement);
+    }
+
+    // Slot of material `m` as found on the scene's spheres
+    [[nodiscard]] size_t slot(const material *m) const
+    {
+        auto it = slots.find(m);
+        if (it == slots.end())
+            throw std::out_of_range("look_dev_session: the material is not on any sphere of the scene");
+        return it->second;
+    }
+
+    // Re-shades every pixel on the next render(), e.g. after editing a material object in place
+    void invalidate() { edited = ~uint64_t{0}; }
+
+    // Saves the current image under images/, reported and logged like camera::render()
+    std::filesystem::path save(std::string_view filename) const
+    {
+        auto path = cam.save(pixels, filename, last_stats);
+        std::println(stderr, "  Look-dev: shaded {} of {} pixels | {} materials | hits cached for {} of {} samples ({})",
+                     last_shaded, pixels.size(), materials.size(), cached_samples, cam.samples_per_pixel,
+                     memory_detail::format_bytes(hit_cache_bytes()));
+        return path;
+    }
+
+    [[nodiscard]] const std::vector<Pixel> &image() const { return pixels; }
+    [[nodiscard]] const std::vector<std::shared_ptr<material>> &scene_materials() const { return materials; }
+    [[nodiscard]] size_t shaded_pixels() const { return last_shaded; } // By the last render()
+    [[nodiscard]] size_t hit_cache_bytes() const { return hits.capacity() * sizeof(primary_hit); }
+
+private:
+    // A camera ray's first hit, enough to rebuild its hit_record
+    struct primary_hit
+    {
+        point3 p;
+        vec3 normal;
+        real t;
+        real radius;
+        uint32_t slot; // Into `materials`, or missed / untracked
+        bool front_face;
+    };
+    static constexpr uint32_t missed = ~uint32_t{0};
+    static constexpr uint32_t untracked = missed - 1; // Material not on a sphere of the scene: traced again
+
+    camera cam;
+    std::shared_ptr<hittable> bvh;
+    double build_seconds = 0;
+
+    std::vector<std::shared_ptr<material>> materials;          // By slot
+    std::vector<std::vector<std::shared_ptr<sphere>>> users;   // Spheres using each slot
+    std::unordered_map<const material *, uint32_t> slots;
+
+    int cached_samples = 0;
+    std::vector<primary_hit> hits; // cached_samples per pixel, row-major
+    std::vector<uint64_t> touched; // material_bit()s of every material the pixel's paths hit
+    std::vector<Pixel> pixels;
+
+    bool rendered = false;
+    uint64_t edited = 0; // material_bit()s of the materials edited since the last render()
+    size_t last_shaded = 0;
+    camera::render_stats last_stats;
+
+    // Traces all samples of pixel (i, j) as camera::sample_pixel() does, from the cached
+    // primary hits unless `capture`, in which case they are found and cached
+    void shade_pixel(int i, int j, bool capture)
+    {
+        const size_t index = static_cast<size_t>(j) * cam.image_width + i;
+        const camera::ray_cone cone{0, cam.pixel_spread};
+        auto pixel_seed = hash_seed(cam.seed, index);
+        color sum(0, 0, 0);
+        uint64_t mask = 0;
+
+        for (int s = 0; s < cam.samples_per_pixel; ++s)
+        {
+            seed_random(pixel_seed, s);
+            ray r = cam.get_ray(i, j);
+            if (s >= cached_samples)
+            {
+                sum += cam.ray_color(r, cam.max_depth, *bvh, 0, camera::path_kind::camera, cone, &mask);
+                continue;
+            }
+
+            auto &cached = hits[index * cached_samples + s];
+            hit_record rec;
+            if (capture)
+            {
+                if (!bvh->hit(r, interval::positive, rec))
+                    cached.slot = missed;
+                else
+                {
+                    auto it = slots.find(rec.mat.get());
+                    cached = {rec.p, rec.normal, rec.t, rec.radius, it != slots.end() ? it->second : untracked, rec.front_face};
+                }
+            }
+            else if (cached.slot == untracked)
+            {
+                sum += cam.ray_color(r, cam.max_depth, *bvh, 0, camera::path_kind::camera, cone, &mask);
+                continue;
+            }
+            else if (cached.slot != missed)
+            {
+                rec.p = cached.p;
+                rec.normal = cached.normal;
+                rec.mat = materials[cached.slot];
+                rec.t = cached.t;
+                rec.front_face = cached.front_face;
+                rec.radius = cached.radius;
+            }
+
+            if (cached.slot == missed)
+                sum += cam.background(r, 0, camera::path_kind::camera);
+            else
+                sum += cam.shade(r, rec, cam.max_depth, *bvh, camera::path_kind::camera, cone, &mask);
+        }
+
+        touched[index] = mask;
+        pixels[index] = cam.resolve(sum);
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif __has_include(<sys/mman.h>)
+#define RT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Where the OS supports it the file is memory-mapped, so
+// opening costs nothing up front, pages are faulted in on first touch and processes that map
+// the same file share one copy in the page cache. Elsewhere the file is read into memory.
+// The data is at least 64-byte aligned either way.
+class mapped_file
+{
+public:
+    mapped_file() = default;
+
+    // Throws std::runtime_error if the file cannot be opened
+    explicit mapped_file(const std::filesystem::path &path)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("cannot open " + path.string());
+        LARGE_INTEGER size{};
+        GetFileSizeEx(file, &size);
+        length = static_cast<size_t>(size.QuadPart);
+        HANDLE mapping = length ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+        if (length && !mapping)
+            throw std::runtime_error("cannot map " + path.string());
+        if (mapping)
+        {
+            base = static_cast<const std::byte *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+            if (!base)
+                throw std::runtime_error("cannot map " + path.string());
+            mapped = true;
+        }
+#elif RT_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + path.string());
+        struct stat st{};
+        fstat(fd, &st);
+        length = static_cast<size_t>(st.st_size);
+        void *p = length ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+        ::close(fd); // The mapping keeps its own reference to the file
+        if (p == MAP_FAILED)
+            throw std::runtime_error("cannot map " + path.string());
+        base = static_cast<const std::byte *>(p);
+        mapped = length != 0;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("cannot open " + path.string());
+        length = static_cast<size_t>(std::filesystem::file_size(path));
+        copy = std::make_unique<block[]>((length + sizeof(block) - 1) / sizeof(block));
+        in.read(reinterpret_cast<char *>(copy.get()), static_cast<std::streamsize>(length));
+        base = reinterpret_cast<const std::byte *>(copy.get());
+#endif
+    }
+
+    mapped_file(mapped_file &&other) noexcept { swap(other); }
+    mapped_file &operator=(mapped_file other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+        if (!mapped)
+            return;
+#if defined(_WIN32)
+        UnmapViewOfFile(base);
+#elif RT_HAVE_MMAP
+        munmap(const_cast<std::byte *>(base), length);
+#endif
+    }
+
+    [[nodiscard]] std::span<const std::byte> bytes() const noexcept { return {base, length}; }
+    [[nodiscard]] const std::byte *data() const noexcept { return base; }
+    [[nodiscard]] size_t size() const noexcept { return length; }
+
+private:
+    struct alignas(64) block
+    {
+        std::byte b[64];
+    };
+
+    const std::byte *base = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    std::unique_ptr<block[]> copy; // Only used without mmap
+
+    void swap(mapped_file &other) noexcept
+    {
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        std::swap(mapped, other.mapped);
+        std::swap(copy, other.copy);
+    }
+};
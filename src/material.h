@@ -1,14 +1,40 @@
 #pragma once
 
+#include "common.h"
+#include "cpu_dispatch.h"
 #include "hittable.h"
 
+enum class material_type
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light
+};
+
+class image_texture;
+
+// Type and parameters of a material, e.g. for saving a scene to a file
+struct material_params
+{
+    material_type type = material_type::lambertian;
+    color albedo;       // Albedo (lambertian, metal) or emitted color (diffuse_light)
+    real parameter = 0; // Fuzz (metal) or refraction index (dielectric)
+};
+
 class material
 {
 public:
     virtual ~material() = default;
 
+    [[nodiscard]] virtual material_params params() const = 0;
+
+    // Texture modulating the material, if any (see texture.h); params() then holds its average
+    [[nodiscard]] virtual const image_texture *texture() const { return nullptr; }
+
     // Returns true if the ray was scattered, and provides the
     // resulting attenuation (color) and the new scattered ray.
+    // The built-in materials scatter through cpu_dispatch::run().
     [[nodiscard]] virtual bool scatter(
         const ray &r_in,
         const hit_record &rec,
@@ -19,6 +45,18 @@ public:
     {
         return color(0, 0, 0);
     }
+
+    // Density (per solid angle) with which scatter() picks `direction` at `rec`. Materials that
+    // scatter into a single direction return 0; the renderer only samples lights for the others.
+    [[nodiscard]] virtual real scattering_pdf([[maybe_unused]] const hit_record &rec,
+                                              [[maybe_unused]] const vec3 &direction) const
+    {
+        return 0;
+    }
+
+    // Whether scatter() spreads light over directions rather than into a single one (mirror,
+    // glass). Caustic photons are stored on, and gathered at, diffuse surfaces.
+    [[nodiscard]] bool diffuse(const hit_record &rec) const { return scattering_pdf(rec, rec.normal) > 0; }
 };
 
 class lambertian : public material
@@ -26,8 +64,16 @@ class lambertian : public material
 public:
     lambertian(const color &albedo) : albedo(albedo) {}
 
-    bool scatter([[maybe_unused]] const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
         const override
+    {
+        return cpu_dispatch::run([&]
+                                 { return scatter(albedo, r_in, rec, attenuation, scattered); });
+    }
+
+    // The scattering itself, shared with static dispatch (see scatter(const material_params &, ...))
+    static bool scatter(const color &albedo, const ray &r_in, const hit_record &rec,
+                        color &attenuation, ray &scattered)
     {
         auto scatter_direction = rec.normal + random_unit_vector();
 
@@ -35,11 +81,20 @@ public:
         if (scatter_direction.near_zero())
             scatter_direction = rec.normal;
 
-        scattered = ray(rec.p, scatter_direction);
+        scattered = rec.spawn_ray(scatter_direction, r_in.time());
         attenuation = albedo;
         return true;
     }
 
+    // normal + random unit vector is cosine distributed about the normal
+    real scattering_pdf(const hit_record &rec, const vec3 &direction) const override
+    {
+        real cosine = dot(rec.normal, unit_vector(direction));
+        return cosine > 0 ? cosine / pi : 0;
+    }
+
+    material_params params() const override { return {material_type::lambertian, albedo, 0}; }
+
 private:
     color albedo;
 };
@@ -51,14 +106,23 @@ public:
 
     bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
         const override
+    {
+        return cpu_dispatch::run([&]
+                                 { return scatter(albedo, fuzz, r_in, rec, attenuation, scattered); });
+    }
+
+    static bool scatter(const color &albedo, real fuzz, const ray &r_in, const hit_record &rec,
+                        color &attenuation, ray &scattered)
     {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
-        scattered = ray(rec.p, reflected);
+        scattered = rec.spawn_ray(reflected, r_in.time());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0.0f);
     }
 
+    material_params params() const override { return {material_type::metal, albedo, fuzz}; }
+
 private:
     color albedo;
     real fuzz; // Fuzziness factor (0 = perfect mirror, 1 = very fuzzy)
@@ -71,6 +135,13 @@ public:
 
     bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
         const override
+    {
+        return cpu_dispatch::run([&]
+                                 { return scatter(refraction_index, r_in, rec, attenuation, scattered); });
+    }
+
+    static bool scatter(real refraction_index, const ray &r_in, const hit_record &rec,
+                        color &attenuation, ray &scattered)
     {
         attenuation = color(1.0f, 1.0f, 1.0f); // Glass doesn't absorb light
         real refraction_ratio = rec.front_face ? (1.0f / refraction_index) : refraction_index;
@@ -86,10 +157,12 @@ public:
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-        scattered = ray(rec.p, direction);
+        scattered = rec.spawn_ray(direction, r_in.time());
         return true;
     }
 
+    material_params params() const override { return {material_type::dielectric, color(), refraction_index}; }
+
 private:
     // Refraction index of the material or ratio of the material's
     // refraction index over surrounding refraction index
@@ -126,6 +199,48 @@ public:
         return emit;
     }
 
+    material_params params() const override { return {material_type::diffuse_light, emit, 0}; }
+
 private:
     color emit;
-};
\ No newline at end of file
+};
+
+// Scatters like the material described by `p` would, without a material object or virtual
+// call; for scenes whose materials are known at compile time (static_scene.h)
+[[nodiscard]] inline bool scatter(const material_params &p, const ray &r_in, const hit_record &rec,
+                                  color &attenuation, ray &scattered)
+{
+    switch (p.type)
+    {
+    case material_type::lambertian:
+        return lambertian::scatter(p.albedo, r_in, rec, attenuation, scattered);
+    case material_type::metal:
+        return metal::scatter(p.albedo, p.parameter, r_in, rec, attenuation, scattered);
+    case material_type::dielectric:
+        return dielectric::scatter(p.parameter, r_in, rec, attenuation, scattered);
+    default:
+        return false;
+    }
+}
+
+// Light emitted by the material described by `p`
+[[nodiscard]] constexpr color emitted(const material_params &p)
+{
+    return p.type == material_type::diffuse_light ? p.albedo : color(0, 0, 0);
+}
+
+// Creates the material described by `p`
+[[nodiscard]] inline std::shared_ptr<material> make_material(const material_params &p)
+{
+    switch (p.type)
+    {
+    case material_type::metal:
+        return std::make_shared<metal>(p.albedo, p.parameter);
+    case material_type::dielectric:
+        return std::make_shared<dielectric>(p.parameter);
+    case material_type::diffuse_light:
+        return std::make_shared<diffuse_light>(p.albedo);
+    default:
+        return std::make_shared<lambertian>(p.albedo);
+    }
+}
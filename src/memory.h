@@ -0,0 +1,179 @@
+#pragma once
+
+#include "bvh_node.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <atomic>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#endif
+
+// Memory accounting for renders: bytes per subsystem (scene, BVH, framebuffers, photon map,
+// ...), computed from the sizes of the data structures, next to the process's peak resident
+// set and its heap allocation count. The counts come from the replacement operator new in
+// memory_counters.cpp and read as zero when that file is not linked in.
+
+namespace memory_detail
+{
+    inline std::atomic<uint64_t> allocation_count{0};
+    inline std::atomic<uint64_t> allocated_bytes{0};
+
+    // What a shared_ptr object made by make_shared or scene_arena carries besides the object:
+    // the control block's vtable pointer and two counts, plus padding
+    inline constexpr size_t shared_overhead = 16;
+
+    // "12.3 MiB", or KiB below a mebibyte
+    [[nodiscard]] inline std::string format_bytes(size_t bytes)
+    {
+        if (bytes < (1u << 20))
+            return std::format("{:.1f} KiB", bytes / 1024.0);
+        return std::format("{:.1f} MiB", bytes / 1048576.0);
+    }
+}
+
+// Peak resident set size of the process in bytes, 0 where the OS does not say
+[[nodiscard]] inline size_t peak_rss_bytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#elif __has_include(<sys/resource.h>)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss); // Bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // Kilobytes elsewhere
+#endif
+#else
+    return 0;
+#endif
+}
+
+struct memory_report
+{
+    struct entry
+    {
+        std::string name;
+        size_t bytes;
+    };
+
+    std::vector<entry> entries; // Per subsystem
+    size_t primitives = 0;
+    size_t peak_rss = 0;          // Of the whole process, when known
+    uint64_t allocations = 0;     // Heap allocations during the render, when counted
+    uint64_t allocated_bytes = 0; // And the bytes they asked for
+
+    void add(std::string name, size_t bytes)
+    {
+        if (bytes > 0)
+            entries.push_back({std::move(name), bytes});
+    }
+
+    [[nodiscard]] size_t total() const
+    {
+        size_t sum = 0;
+        for (const auto &e : entries)
+            sum += e.bytes;
+        return sum;
+    }
+
+    [[nodiscard]] const entry *find(std::string_view name) const
+    {
+        for (const auto &e : entries)
+            if (e.name == name)
+                return &e;
+        return nullptr;
+    }
+
+    [[nodiscard]] size_t bytes_per_primitive() const { return primitives ? total() / primitives : 0; }
+
+    // "scene 1.2 MiB, bvh 0.8 MiB, ..."
+    [[nodiscard]] std::string breakdown() const
+    {
+        std::string text;
+        for (const auto &e : entries)
+            text += std::format("{}{} {}", text.empty() ? "" : ", ", e.name, memory_detail::format_bytes(e.bytes));
+        return text;
+    }
+};
+
+// Thrown before rendering when no choice of representations fits camera::memory_budget
+class memory_budget_error : public std::runtime_error
+{
+public:
+    memory_budget_error(const memory_report &report, size_t budget)
+        : std::runtime_error(std::format("memory budget of {} exceeded: needs {} ({})", memory_detail::format_bytes(budget),
+                                         memory_detail::format_bytes(report.total()), report.breakdown())),
+          report(report) {}
+
+    memory_report report; // The cheapest plan that was tried
+};
+
+// Heap allocations so far: {count, bytes}
+[[nodiscard]] inline std::pair<uint64_t, uint64_t> allocation_totals()
+{
+    return {memory_detail::allocation_count.load(std::memory_order_relaxed),
+            memory_detail::allocated_bytes.load(std::memory_order_relaxed)};
+}
+
+// Adds the scene's objects, materials and textures to `report`, and counts its primitives
+inline void account_scene(const hittable_list &world, memory_report &report)
+{
+    using memory_detail::shared_overhead;
+    size_t objects = world.objects.capacity() * sizeof(std::shared_ptr<hittable>);
+    size_t materials = 0, textures = 0;
+    std::unordered_set<const material *> seen_materials;
+    std::unordered_set<const image_texture *> seen_textures;
+    for (const auto &object : world.objects)
+    {
+        auto sph = dynamic_cast<const sphere *>(object.get());
+        objects += (sph ? sizeof(sphere) : sizeof(hittable_list)) + shared_overhead;
+        if (!sph || !seen_materials.insert(sph->material_ptr().get()).second)
+            continue;
+        materials += sizeof(metal) + shared_overhead; // The largest of the plain materials
+        if (auto tex = sph->material_ptr()->texture(); tex && seen_textures.insert(tex).second)
+            textures += tex->size_bytes();
+    }
+    report.primitives += world.objects.size();
+    report.add("scene", objects);
+    report.add("materials", materials);
+    report.add("textures", textures);
+}
+
+// Bytes held by an acceleration structure built by camera::build_acceleration()
+[[nodiscard]] inline size_t acceleration_bytes(const hittable &bvh)
+{
+    if (auto flat = dynamic_cast<const flat_bvh *>(&bvh))
+        return flat->size_bytes();
+    if (auto node = dynamic_cast<const bvh_node *>(&bvh))
+        return node->node_count() * (sizeof(bvh_node) + memory_detail::shared_overhead + sizeof(void *));
+    return 0;
+}
+
+// Bytes a BVH over `spheres` spheres will take: as bvh_node, or `compact` as a flat_bvh
+[[nodiscard]] inline size_t acceleration_bytes(size_t spheres, bool compact)
+{
+    if (compact)
+        return sizeof(flat_bvh_detail::header) + 2 * spheres * sizeof(flat_bvh_detail::node) +
+               spheres * (sizeof(flat_bvh_detail::sphere_data) + sizeof(uint32_t) + sizeof(flat_bvh_detail::material_data));
+    return spheres * (sizeof(bvh_node) + memory_detail::shared_overhead + sizeof(void *));
+}
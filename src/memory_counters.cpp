@@ -0,0 +1,80 @@
+// Replacement global operator new/delete that count heap allocations for memory reports
+// (see memory.h). The counters are relaxed atomics; rendering itself hardly allocates.
+
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+static void *counted_allocate(std::size_t size)
+{
+    memory_detail::allocation_count.fetch_add(1, std::memory_order_relaxed);
+    memory_detail::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+static void *counted_allocate(std::size_t size, std::align_val_t alignment)
+{
+    memory_detail::allocation_count.fetch_add(1, std::memory_order_relaxed);
+    memory_detail::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    auto align = static_cast<std::size_t>(alignment);
+    auto bytes = std::max<std::size_t>(size, 1); // Rounded up from 0, aligned_alloc may return nullptr
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, align);
+#else
+    return std::aligned_alloc(align, (bytes + align - 1) / align * align);
+#endif
+}
+
+static void counted_free(void *p, std::align_val_t)
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *operator new(std::size_t size)
+{
+    if (void *p = counted_allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (void *p = counted_allocate(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t alignment) noexcept { counted_free(p, alignment); }
+void operator delete[](void *p, std::align_val_t alignment) noexcept { counted_free(p, alignment); }
+void operator delete(void *p, std::size_t, std::align_val_t alignment) noexcept { counted_free(p, alignment); }
+void operator delete[](void *p, std::size_t, std::align_val_t alignment) noexcept { counted_free(p, alignment); }
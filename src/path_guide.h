@@ -0,0 +1,305 @@
+#pragma once
+
+#include "common.h"
+#include "aabb.h"
+#include "environment.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <execution>
+#include <vector>
+
+// Online path guiding, after Müller et al., "Practical Path Guiding for Efficient Light-Transport
+// Simulation" (2017). A kd-tree over the scene holds a directional histogram per leaf of where
+// light arrived from in earlier passes; diffuse bounces then sample a mix of that histogram and
+// the BSDF, so paths head for small lights instead of finding them by chance.
+//
+// Directions are binned on an equal-area cylindrical map (cos theta against phi), so every bin
+// covers the same solid angle. Training happens while rendering: every diffuse bounce records
+// the light its ray brought back, and where it happened in a per-axis histogram of the leaf.
+// Records are added with integer atomics (energy in fixed point), which keeps training lock-free
+// and makes the sums, and so the image, independent of thread order. Between passes update()
+// turns the sums into sampling distributions and splits busy leaves at the median of their
+// records, on the axis where they spread most, as often as their record count warrants.
+
+class path_guide
+{
+public:
+    static constexpr int resolution = 16; // Bins per side of the direction map
+    static constexpr int bins = resolution * resolution;
+    static constexpr real bsdf_fraction = 0.5f; // Share of bounces sampled from the BSDF
+
+    explicit path_guide(const aabb &bounds)
+    {
+        nodes.push_back({0, 0, 0.0f});
+        cells.emplace_back();
+        cells[0].lo = {bounds.x.min, bounds.y.min, bounds.z.min};
+        cells[0].hi = {bounds.x.max, bounds.y.max, bounds.z.max};
+    }
+
+    // Index of the leaf containing `p`
+    [[nodiscard]] uint32_t find(const point3 &p) const
+    {
+        uint32_t n = 0;
+        while (!nodes[n].is_leaf())
+        {
+            const auto &node = nodes[n];
+            n = node.index + (p[node.axis - 1] >= node.split ? 1 : 0);
+        }
+        return nodes[n].index;
+    }
+
+    // Whether leaf `cell` has a distribution to sample yet
+    [[nodiscard]] bool trained(uint32_t cell) const { return cells[cell].trained; }
+
+    // Direction drawn from leaf `cell`'s distribution, from two uniform numbers, on the side
+    // of the surface `normal` points to. A leaf can hold surfaces facing many ways, so
+    // directions below the surface are mirrored above it rather than wasted.
+    [[nodiscard]] vec3 sample(uint32_t cell, const vec3 &normal, real u1, real u2) const
+    {
+        const auto &c = cells[cell];
+        int b = environment_detail::find_interval(c.cdf.data(), bins, u1);
+        real du = (u1 - c.cdf[b]) / std::max(c.cdf[b + 1] - c.cdf[b], 1e-20f);
+        real x = (b % resolution + std::clamp<real>(du, 0, 1)) / resolution;
+        real y = (b / resolution + u2) / resolution;
+        vec3 d = from_square(x, y);
+        return dot(d, normal) < 0 ? reflect(d, normal) : d;
+    }
+
+    // Solid-angle density of sample() for `direction` (need not be normalized) above the
+    // surface with unit `normal`: the direction's own density plus its mirror image's
+    [[nodiscard]] real pdf(uint32_t cell, const vec3 &normal, const vec3 &direction) const
+    {
+        if (dot(direction, normal) < 0)
+            return 0;
+        const auto &c = cells[cell];
+        int b = bin(direction), mirrored = bin(reflect(direction, normal));
+        return (c.cdf[b + 1] - c.cdf[b] + c.cdf[mirrored + 1] - c.cdf[mirrored]) * (bins / (4 * pi));
+    }
+
+    // Adds light arriving at `p` in leaf `cell` from `direction`: `value` is its luminance over
+    // the density the direction was sampled with. Safe to call from any number of threads.
+    void record(uint32_t cell, const point3 &p, const vec3 &direction, real value)
+    {
+        if (!(value > 0))
+            return;
+        auto &c = cells[cell];
+        std::atomic_ref<uint64_t>(c.energy[bin(direction)])
+            .fetch_add(static_cast<uint64_t>(std::min(value, max_value) * energy_scale), std::memory_order_relaxed);
+        for (int a = 0; a < 3; a++)
+        {
+            real extent = c.hi[a] - c.lo[a];
+            int b = extent > 0 ? static_cast<int>((p[a] - c.lo[a]) / extent * position_bins) : 0;
+            std::atomic_ref<uint32_t>(c.occupancy[a][std::clamp(b, 0, position_bins - 1)]).fetch_add(1, std::memory_order_relaxed);
+        }
+        std::atomic_ref<uint64_t>(c.records).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Turns what was recorded since the last update into sampling distributions and splits
+    // leaves with more than `split_records` records. Not thread-safe; call between passes.
+    void update(uint64_t split_records = 2048)
+    {
+        std::for_each(std::execution::par, cells.begin(), cells.end(),
+                      [](cell_data &c)
+                      {
+                          if (c.records < min_records)
+                              return; // Too little data: keep the previous distribution
+                          double total = 0;
+                          for (auto e : c.energy)
+                              total += static_cast<double>(e);
+                          if (total <= 0)
+                              return;
+                          // A little uniform density keeps every direction reachable
+                          double floor = 0.01 * total / bins, sum = 0;
+                          c.cdf[0] = 0;
+                          for (int b = 0; b < bins; b++)
+                          {
+                              sum += static_cast<double>(c.energy[b]) + floor;
+                              c.cdf[b + 1] = static_cast<float>(sum);
+                          }
+                          double concentration = 0;
+                          for (int b = 1; b <= bins; b++)
+                          {
+                              c.cdf[b] = static_cast<float>(c.cdf[b] / sum);
+                              double p = c.cdf[b] - c.cdf[b - 1];
+                              concentration += p * p * bins;
+                          }
+                          c.cdf[bins] = 1;
+                          // Light about as spread out as a cosine lobe (8/3 here) is sampled as
+                          // well by the BSDF; mixing in the guide would only add noise
+                          c.trained = concentration > min_concentration;
+                      });
+
+        const size_t count = nodes.size();
+        for (size_t n = 0; n < count; n++)
+        {
+            if (!nodes[n].is_leaf() || cells[nodes[n].index].records <= split_records)
+                continue;
+            const auto &c = cells[nodes[n].index];
+            records_layout layout{c.lo, c.hi, c.occupancy};
+            split(static_cast<uint32_t>(n), layout, c.lo, c.hi, split_records);
+        }
+
+        std::for_each(std::execution::par, cells.begin(), cells.end(),
+                      [](cell_data &c)
+                      {
+                          c.energy.fill(0);
+                          for (auto &axis : c.occupancy)
+                              axis.fill(0);
+                          c.records = 0;
+                      });
+    }
+
+    [[nodiscard]] size_t leaf_count() const { return cells.size(); }
+    [[nodiscard]] size_t size_bytes() const
+    {
+        return nodes.capacity() * sizeof(node) + cells.capacity() * sizeof(cell_data);
+    }
+
+    // What a fully split guide takes
+    [[nodiscard]] static constexpr size_t max_size_bytes() { return 2 * max_cells * (sizeof(node) + sizeof(cell_data)); }
+
+private:
+    static constexpr uint64_t min_records = 1024;
+    static constexpr double min_concentration = 4; // Bins times the sum of squared bin probabilities
+    static constexpr size_t max_cells = 4096;
+    static constexpr int max_depth = 64;
+    static constexpr int position_bins = 32;      // Per axis, over the leaf's bounds
+    static constexpr real max_value = 1e6f;       // Clamps fireflies out of the fixed-point sums
+    static constexpr real energy_scale = 0x1p24f; // Fixed-point steps per unit of recorded value
+
+    using occupancy_histogram = std::array<std::array<uint32_t, position_bins>, 3>;
+
+    struct node
+    {
+        uint32_t axis;  // 0 for a leaf, else 1 + the split axis
+        uint32_t index; // Leaf: the cell; inner node: the first of two consecutive children
+        float split;
+
+        [[nodiscard]] bool is_leaf() const { return axis == 0; }
+    };
+
+    struct cell_data
+    {
+        point3 lo, hi;
+        std::array<float, bins + 1> cdf{}; // Sampling distribution over bins
+        bool trained = false;
+
+        // Training sums
+        std::array<uint64_t, bins> energy{}; // Fixed point
+        occupancy_histogram occupancy{};     // Where the records were, per axis
+        uint64_t records = 0;
+    };
+
+    std::vector<node> nodes;
+    std::vector<cell_data> cells;
+
+    // Where a leaf's records were, as recorded: per-axis histograms over its bounds. Sub-boxes
+    // are assumed to hold the product of the axes' shares (the axes are taken as independent).
+    struct records_layout
+    {
+        point3 lo, hi;
+        occupancy_histogram occupancy;
+
+        // Share of the records along `axis` below coordinate x, interpolated within bins
+        [[nodiscard]] double below(int axis, real x) const
+        {
+            real extent = hi[axis] - lo[axis];
+            if (extent <= 0)
+                return x >= lo[axis] ? 1 : 0;
+            double t = std::clamp<real>((x - lo[axis]) / extent, 0, 1) * position_bins;
+            int b = std::min(static_cast<int>(t), position_bins - 1);
+            double total = 0, under = 0;
+            for (int k = 0; k < position_bins; k++)
+            {
+                total += occupancy[axis][k];
+                if (k < b)
+                    under += occupancy[axis][k];
+            }
+            under += occupancy[axis][b] * (t - b);
+            return total > 0 ? under / total : 0;
+        }
+
+        // Coordinate along `axis` below which a share `q` of the records lies
+        [[nodiscard]] real quantile(int axis, double q) const
+        {
+            double total = 0;
+            for (auto n : occupancy[axis])
+                total += n;
+            double target = q * total, sum = 0;
+            real bin_width = (hi[axis] - lo[axis]) / position_bins;
+            for (int k = 0; k < position_bins; k++)
+            {
+                if (occupancy[axis][k] > 0 && sum + occupancy[axis][k] >= target)
+                    return lo[axis] + (k + static_cast<real>((target - sum) / occupancy[axis][k])) * bin_width;
+                sum += occupancy[axis][k];
+            }
+            return hi[axis];
+        }
+    };
+
+    // Splits leaf node `n`, covering the box [lo, hi], at the median of its records on the axis
+    // where the middle 80% of them spread widest, and recurses while a half is expected to hold
+    // more than `split_records`. Both halves start from the parent's distribution.
+    void split(uint32_t n, const records_layout &layout, point3 lo, point3 hi, uint64_t split_records, int depth = 0)
+    {
+        double share = 1;
+        int axis = -1;
+        real width = 0, at = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            double from = layout.below(a, lo[a]), to = layout.below(a, hi[a]);
+            share *= to - from;
+            real spread = layout.quantile(a, from + 0.9 * (to - from)) - layout.quantile(a, from + 0.1 * (to - from));
+            if (spread > width)
+            {
+                width = spread;
+                axis = a;
+                at = layout.quantile(a, (from + to) / 2);
+            }
+        }
+        const uint64_t records = cells[nodes[n].index].records;
+        if (axis < 0 || depth >= max_depth || cells.size() >= max_cells || records * share <= split_records ||
+            !(at > lo[axis] && at < hi[axis]))
+            return;
+
+        float split_at = static_cast<float>(at);
+        uint32_t left_cell = nodes[n].index, right_cell = static_cast<uint32_t>(cells.size());
+        cells.push_back(cells[left_cell]);
+        cells[left_cell].hi[axis] = split_at;
+        cells[right_cell].lo[axis] = split_at;
+
+        uint32_t children = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({0, left_cell, 0.0f});
+        nodes.push_back({0, right_cell, 0.0f});
+        nodes[n] = {static_cast<uint32_t>(axis + 1), children, split_at};
+
+        point3 left_hi = hi, right_lo = lo;
+        left_hi[axis] = split_at;
+        right_lo[axis] = split_at;
+        split(children, layout, lo, left_hi, split_records, depth + 1);
+        split(children + 1, layout, right_lo, hi, split_records, depth + 1);
+    }
+
+    // Equal-area map between the unit square and the sphere: y = (cos theta + 1) / 2
+    [[nodiscard]] static vec3 from_square(real x, real y)
+    {
+        real cos_theta = 2 * y - 1;
+        real sin_theta = std::sqrt(std::max<real>(0, 1 - cos_theta * cos_theta));
+        real phi = 2 * pi * x;
+        return {sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi)};
+    }
+
+    [[nodiscard]] static int bin(const vec3 &direction)
+    {
+        vec3 d = unit_vector(direction);
+        real x = std::atan2(d.z, d.x) / (2 * pi);
+        x -= std::floor(x);
+        real y = (std::clamp<real>(d.y, -1, 1) + 1) / 2;
+        int bx = std::min(static_cast<int>(x * resolution), resolution - 1);
+        int by = std::min(static_cast<int>(y * resolution), resolution - 1);
+        return by * resolution + bx;
+    }
+};
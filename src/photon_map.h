@@ -0,0 +1,412 @@
+#pragma once
+
+#include "common.h"
+#include "environment.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <execution>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+// Caustic photon map. Caustics (light focused by glass or mirrors onto a diffuse surface) are
+// the paths a path tracer finds worst: a diffuse bounce has to reach the light through the
+// glass by chance. Photon mapping traces them from the light side instead (Jensen, "Realistic
+// Image Synthesis Using Photon Mapping", 2001): photons leave the lights, follow specular
+// bounces and are stored where they land on a diffuse surface. The camera adds the photons
+// around each diffuse hit and drops the same light paths from its own estimate.
+//
+// Light comes from diffuse_light spheres and from the background (sky gradient or environment
+// map). Background photons are aimed at the disks the specular spheres show to their direction,
+// since only photons that hit glass or a mirror can become caustics. Photons are stored in a
+// hashed grid whose cells are twice the gather radius, so a lookup visits 8 cells; the grid is
+// built by sorting photons by cell in parallel.
+
+// Where photons come from and where they are aimed, gathered once per scene
+struct photon_sources
+{
+    struct sphere_light
+    {
+        point3 center;
+        real radius;
+        color radiance;
+    };
+    struct target
+    {
+        point3 center;
+        real radius;
+    };
+
+    std::vector<sphere_light> lights; // diffuse_light spheres
+    std::vector<target> specular;     // metal and dielectric spheres
+    bool gathered = false;            // Made by gather(), rather than knowing no scene at all
+
+    // Spheres of `world` by material; other objects still block and reflect photons
+    [[nodiscard]] static photon_sources gather(const hittable_list &world)
+    {
+        photon_sources sources;
+        sources.gathered = true;
+        for (const auto &object : world.objects)
+        {
+            auto s = std::dynamic_pointer_cast<sphere>(object);
+            if (!s || !s->material_ptr())
+                continue;
+            auto params = s->material_ptr()->params();
+            if (params.type == material_type::diffuse_light)
+                sources.lights.push_back({s->center(), s->radius(), params.albedo});
+            else if (params.type == material_type::metal || params.type == material_type::dielectric)
+                sources.specular.push_back({s->center(), s->radius()});
+        }
+        return sources;
+    }
+
+    // Without glass or mirrors there are no caustics
+    [[nodiscard]] bool empty() const { return specular.empty(); }
+};
+
+// Sky gradient used when no environment map is set
+[[nodiscard]] inline color sky_gradient(const vec3 &direction)
+{
+    vec3 unit_direction = unit_vector(direction);
+    auto a = 0.5f * (unit_direction.y + 1.0f);
+    return (1.0f - a) * color(1.0f, 1.0f, 1.0f) + a * color(0.5f, 0.7f, 1.0f);
+}
+
+class photon_map
+{
+public:
+    struct photon
+    {
+        float position[3];
+        uint32_t power;     // rgb9e5 (see environment.h), before dividing by the photon count
+        float direction[3]; // Direction of travel
+        uint32_t bucket;    // Grid bucket, the sort key
+    };
+
+    // Traces `count` photons from the lights of `sources` through `world` and stores those that
+    // reach a diffuse surface through at least one specular bounce. `environment` replaces the
+    // sky gradient when set. The same seed gives the same map on any number of threads.
+    [[nodiscard]] static std::shared_ptr<photon_map> trace(const hittable &world, const photon_sources &sources,
+                                                           const environment_map *environment, int count,
+                                                           real radius, int max_depth, uint64_t seed)
+    {
+        auto map = std::make_shared<photon_map>(radius);
+        emitter lights(sources, environment);
+        if (count <= 0 || sources.empty() || lights.total <= 0)
+            return map;
+
+        // Emit in fixed chunks so the photon order does not depend on scheduling
+        const int chunk_size = 4096;
+        const int chunks = (count + chunk_size - 1) / chunk_size;
+        std::vector<std::vector<photon>> stored(chunks);
+        std::vector<int> chunk_index(chunks);
+        std::iota(chunk_index.begin(), chunk_index.end(), 0);
+        std::for_each(std::execution::par, chunk_index.begin(), chunk_index.end(),
+                      [&](int c)
+                      {
+                          int end = std::min(count, (c + 1) * chunk_size);
+                          for (int k = c * chunk_size; k < end; k++)
+                          {
+                              seed_random(seed, static_cast<uint64_t>(k));
+                              ray r;
+                              color power;
+                              if (!lights.emit(world, sources, r, power))
+                                  continue;
+                              photon p;
+                              if (trace_photon(world, r, power, max_depth, p))
+                                  stored[c].push_back(p);
+                          }
+                      });
+
+        size_t total = 0;
+        for (const auto &chunk : stored)
+            total += chunk.size();
+        map->power_scale = 1.0f / count;
+        map->photons.reserve(total);
+        for (const auto &chunk : stored)
+            map->photons.insert(map->photons.end(), chunk.begin(), chunk.end());
+        stored = {}; // build() sorts into a copy
+        map->build();
+        return map;
+    }
+
+    explicit photon_map(real radius) : gather_radius(radius), cell_size(2 * radius) {}
+
+    // Caustic radiance leaving a lambertian surface at `rec`, per unit albedo: the irradiance of
+    // the photons within the gather radius (Epanechnikov kernel) divided by pi
+    [[nodiscard]] color radiance(const hit_record &rec) const
+    {
+        if (photons.empty())
+            return {0, 0, 0};
+
+        const real r2 = gather_radius * gather_radius;
+        int lo[3], hi[3];
+        const real p[3] = {rec.p.x, rec.p.y, rec.p.z};
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = cell(p[a] - gather_radius);
+            hi[a] = std::min(cell(p[a] + gather_radius), lo[a] + 1); // Rounding could give a third cell
+        }
+
+        // At most 8 cells; cells sharing a bucket are visited once
+        std::array<uint32_t, 8> visited;
+        int visited_count = 0;
+        color sum(0, 0, 0);
+        for (int x = lo[0]; x <= hi[0]; x++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int z = lo[2]; z <= hi[2]; z++)
+                {
+                    uint32_t b = bucket(x, y, z);
+                    if (std::find(visited.begin(), visited.begin() + visited_count, b) != visited.begin() + visited_count)
+                        continue;
+                    visited[visited_count++] = b;
+                    for (uint32_t i = bucket_start[b]; i < bucket_start[b + 1]; i++)
+                    {
+                        const auto &ph = photons[i];
+                        vec3 d(ph.position[0] - p[0], ph.position[1] - p[1], ph.position[2] - p[2]);
+                        real d2 = d.length_squared();
+                        // Only photons arriving on the side the ray sees
+                        if (d2 >= r2 || dot(vec3(ph.direction[0], ph.direction[1], ph.direction[2]), rec.normal) >= 0)
+                            continue;
+                        sum += environment_detail::from_rgb9e5(ph.power) * (1.0f - d2 / r2);
+                    }
+                }
+        return sum * (power_scale * 2.0f / (pi * r2 * pi));
+    }
+
+    [[nodiscard]] size_t size() const { return photons.size(); }
+    [[nodiscard]] size_t size_bytes() const
+    {
+        return photons.capacity() * sizeof(photon) + bucket_start.capacity() * sizeof(uint32_t);
+    }
+
+    // Most memory trace() can take for `count` photons: the map and its sorted copy with the
+    // sort keys, or the per-chunk lists and the map
+    [[nodiscard]] static size_t peak_bytes(int count)
+    {
+        return static_cast<size_t>(std::max(count, 0)) * (2 * sizeof(photon) + sizeof(uint64_t));
+    }
+
+    [[nodiscard]] real radius() const { return gather_radius; }
+
+    // Gather radius of pass `pass` of progressive photon mapping, starting from `initial`: the
+    // squared radius shrinks by (i + alpha) / (i + 1) after pass i, so the bias vanishes while
+    // every pass still finds enough photons (Knaus and Zwicker, "Progressive Photon Mapping: A
+    // Probabilistic Approach", 2011)
+    [[nodiscard]] static real progressive_radius(real initial, int pass, real alpha = 2.0f / 3.0f)
+    {
+        real r2 = initial * initial;
+        for (int i = 0; i < pass; i++)
+            r2 *= (i + alpha) / (i + 1);
+        return std::sqrt(r2);
+    }
+
+private:
+    real gather_radius, cell_size;
+    real power_scale = 0;               // One over the number of photons emitted
+    std::vector<photon> photons;        // Sorted by bucket
+    std::vector<uint32_t> bucket_start; // First photon of each bucket, plus the end
+    uint32_t bucket_mask = 0;
+
+    // Picks a light in proportion to its estimated power and starts a photon from it
+    struct emitter
+    {
+        const environment_map *environment;
+        std::vector<real> cdf; // Background first, then each sphere light
+        real total = 0;
+        real target_area = 0; // Summed disk areas of the specular spheres
+
+        emitter(const photon_sources &sources, const environment_map *environment) : environment(environment)
+        {
+            for (const auto &t : sources.specular)
+                target_area += pi * t.radius * t.radius;
+
+            // Mean background luminance over a Fibonacci sphere of directions
+            const int n = 256;
+            real mean = 0;
+            for (int k = 0; k < n; k++)
+            {
+                real y = 1 - 2 * (k + 0.5f) / n;
+                real s = std::sqrt(std::max<real>(0, 1 - y * y));
+                real phi = k * 2.39996323f;
+                mean += environment_detail::luminance(background(vec3(s * std::cos(phi), y, s * std::sin(phi)))) / n;
+            }
+            total += 4 * pi * mean * target_area;
+            cdf.push_back(total);
+            for (const auto &l : sources.lights)
+            {
+                total += pi * 4 * pi * l.radius * l.radius * environment_detail::luminance(l.radiance);
+                cdf.push_back(total);
+            }
+        }
+
+        [[nodiscard]] color background(const vec3 &d) const
+        {
+            return environment ? environment->radiance(d) : sky_gradient(d);
+        }
+
+        // Sets the photon's ray and power (as if it were the only photon).
+        // False for samples that carry no light.
+        bool emit(const hittable &world, const photon_sources &sources, ray &r, color &power) const
+        {
+            real u = random_real() * total;
+            size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            if (k >= cdf.size())
+                k = cdf.size() - 1;
+            real probability = (cdf[k] - (k ? cdf[k - 1] : 0)) / total;
+            if (probability <= 0)
+                return false;
+            if (k == 0)
+                return emit_background(world, sources, probability, r, power);
+
+            // Uniform point on the light, cosine-weighted direction: the light's power is
+            // pi * area * radiance
+            const auto &l = sources.lights[k - 1];
+            vec3 n = random_unit_vector();
+            vec3 direction = n + random_unit_vector();
+            if (direction.near_zero())
+                direction = n;
+            point3 p = l.center + l.radius * n;
+            r = ray(spawn_origin(p, n, l.radius, direction), direction);
+            power = l.radiance * (pi * 4 * pi * l.radius * l.radius / probability);
+            return true;
+        }
+
+        // A direction from the background, then a point on the disk one specular sphere shows
+        // to that direction. Disks that overlap share the photons passing through them.
+        bool emit_background(const hittable &world, const photon_sources &sources, real probability,
+                             ray &r, color &power) const
+        {
+            vec3 d;
+            real pdf;
+            color radiance;
+            if (environment)
+                radiance = environment->sample(random_real(), random_real(), d, pdf);
+            else
+            {
+                d = random_unit_vector();
+                pdf = 1 / (4 * pi);
+                radiance = sky_gradient(d);
+            }
+            if (pdf <= 0)
+                return false;
+
+            real pick = random_real() * target_area;
+            size_t s = 0;
+            for (; s + 1 < sources.specular.size(); s++)
+            {
+                real area = pi * sources.specular[s].radius * sources.specular[s].radius;
+                if (pick < area)
+                    break;
+                pick -= area;
+            }
+            const auto &target = sources.specular[s];
+
+            vec3 a = unit_vector(cross(std::fabs(d.x) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0), d));
+            vec3 b = cross(d, a);
+            vec3 disk = random_in_unit_disk();
+            point3 p = target.center + target.radius * (disk.x * a + disk.y * b);
+
+            // Count the disks on this line, and start beyond all of them
+            int covering = 0;
+            real beyond = 0;
+            for (const auto &t : sources.specular)
+            {
+                vec3 to_center = t.center - p;
+                real along = dot(to_center, d);
+                if ((to_center - along * d).length_squared() < t.radius * t.radius)
+                    covering++;
+                beyond = std::max(beyond, along + t.radius);
+            }
+            if (covering == 0)
+                return false;
+
+            // The photon only exists if nothing hides the background from its start
+            point3 origin = p + (beyond + 0.01f) * d;
+            hit_record blocker;
+            if (world.hit(ray(origin, d), interval::positive, blocker))
+                return false;
+
+            r = ray(origin, -d);
+            power = radiance * (target_area / (pdf * covering * probability));
+            return true;
+        }
+    };
+
+    // Follows a photon through specular bounces; true if it was stored on a diffuse surface
+    static bool trace_photon(const hittable &world, ray r, color power, int max_depth, photon &out)
+    {
+        bool specular = false;
+        for (int depth = 0; depth < max_depth; depth++)
+        {
+            hit_record rec;
+            if (!world.hit(r, interval::positive, rec))
+                return false;
+            if (rec.mat->diffuse(rec))
+            {
+                if (!specular)
+                    return false; // Direct light, which path tracing handles well
+                vec3 d = unit_vector(r.direction());
+                out = {{float(rec.p.x), float(rec.p.y), float(rec.p.z)}, environment_detail::to_rgb9e5(power), {float(d.x), float(d.y), float(d.z)}, 0};
+                return true;
+            }
+
+            ray scattered;
+            color attenuation;
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+                return false; // Absorbed, e.g. by a light
+            power = power * attenuation;
+            r = scattered;
+            specular = true;
+        }
+        return false;
+    }
+
+    [[nodiscard]] int cell(real x) const { return static_cast<int>(std::floor(x / cell_size)); }
+
+    [[nodiscard]] uint32_t bucket(int x, int y, int z) const
+    {
+        auto h = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^ static_cast<uint32_t>(z) * 83492791u;
+        return h & bucket_mask;
+    }
+
+    void build()
+    {
+        uint32_t buckets = std::bit_ceil(static_cast<uint32_t>(std::max<size_t>(photons.size(), 1)));
+        bucket_mask = buckets - 1;
+        std::for_each(std::execution::par_unseq, photons.begin(), photons.end(),
+                      [this](photon &p)
+                      { p.bucket = bucket(cell(p.position[0]), cell(p.position[1]), cell(p.position[2])); });
+        // Sorts by bucket, then by emission order: the keys are unique, so the order does not
+        // depend on how the parallel sort splits the work
+        std::vector<uint64_t> keys(photons.size());
+        for (size_t i = 0; i < photons.size(); i++)
+            keys[i] = static_cast<uint64_t>(photons[i].bucket) << 32 | i;
+        std::sort(std::execution::par_unseq, keys.begin(), keys.end());
+        std::vector<photon> sorted(photons.size());
+        std::transform(std::execution::par_unseq, keys.begin(), keys.end(), sorted.begin(),
+                       [this](uint64_t key)
+                       { return photons[static_cast<uint32_t>(key)]; });
+        photons = std::move(sorted);
+        keys = {};
+
+        bucket_start.resize(buckets + 1);
+        std::vector<uint32_t> ids(buckets + 1);
+        std::iota(ids.begin(), ids.end(), 0u);
+        std::for_each(std::execution::par_unseq, ids.begin(), ids.end(),
+                      [this](uint32_t b)
+                      {
+                          auto it = std::lower_bound(photons.begin(), photons.end(), b,
+                                                     [](const photon &p, uint32_t key)
+                                                     { return p.bucket < key; });
+                          bucket_start[b] = static_cast<uint32_t>(it - photons.begin());
+                      });
+    }
+};
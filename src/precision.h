@@ -0,0 +1,30 @@
+#pragma once
+
+#include <limits>
+
+// Numeric precision of the renderer, picked at compile time:
+//
+//   (default)               float everywhere, with the SSE math of vec3.h and aabb.h
+//   -DRT_PRECISION_DOUBLE   double everywhere; the SIMD paths are float-only, so math is scalar
+//   -DRT_PRECISION_MIXED    float storage and math, but ray-sphere intersection in double for
+//                           spheres of at least large_sphere_radius (ground spheres and the like)
+//
+// Texture, environment and photon storage stays float in every mode.
+#if defined(RT_PRECISION_DOUBLE)
+using real = double;
+#else
+using real = float;
+#endif
+
+// Radius from which RT_PRECISION_MIXED intersects spheres in double
+#if defined(RT_PRECISION_MIXED)
+inline constexpr real large_sphere_radius = 64;
+#endif
+
+// Bound on the relative error of n chained roundings, n * u / (1 - n * u) with u the unit
+// roundoff (Higham; Pharr et al., "Physically Based Rendering", 4th ed., 6.8)
+[[nodiscard]] constexpr real gamma_bound(int n) noexcept
+{
+    constexpr real u = std::numeric_limits<real>::epsilon() / 2;
+    return (n * u) / (1 - n * u);
+}
@@ -1,19 +1,22 @@
 #pragma once
 
+#include "precision.h"
 #include "vec3.h"
 
-using real = float;
-
 class ray
 {
 public:
     constexpr ray() = default;
-    constexpr ray(const point3 &origin, const vec3 &direction)
-        : orig{origin}, dir{direction} {}
+    constexpr ray(const point3 &origin, const vec3 &direction, real time = 0)
+        : orig{origin}, dir{direction}, inv_dir{reciprocal(direction)}, tm{time} {}
 
     // Accessors
     [[nodiscard]] constexpr point3 origin() const { return orig; }
     [[nodiscard]] constexpr vec3 direction() const { return dir; }
+    [[nodiscard]] constexpr real time() const { return tm; } // Within the camera's shutter interval
+
+    // Component-wise 1/direction, computed once per ray for the slab tests
+    [[nodiscard]] constexpr const vec3 &inverse_direction() const { return inv_dir; }
 
     // Compute point along ray at parameter t
     [[nodiscard]] constexpr point3 at(real t) const { return orig + t * dir; }
@@ -21,4 +24,6 @@ public:
 private:
     point3 orig;
     vec3 dir;
-};
\ No newline at end of file
+    vec3 inv_dir;
+    real tm = 0;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "camera.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <execution>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Render sessions: many views of one scene, e.g. a turntable of product shots or a stereo
+// pair. The BVH is built once when the session is made. render() then runs the tiles of every
+// added camera through one parallel loop, interleaved view by view, so no core idles at the
+// end of one view while another still has tiles left. Each view's image is exactly what its
+// camera's render() produces.
+//
+//   render_session session(world);
+//   for (int k = 0; k < 12; k++)
+//   {
+//       cam.lookfrom = point3(13 * std::cos(k * pi / 6), 2, 13 * std::sin(k * pi / 6));
+//       session.add_view(cam, std::format("shot_{:02}.png", k));
+//   }
+//   session.render();
+//
+// Views are whole frames in 8-bit formats; band_rows is not applied to them, and a memory_budget
+// throws std::invalid_argument, as the shared BVH is built before any view is known.
+// Views rendering in rounds (time budgets, caustic photons, path guiding, target errors) are
+// rendered after the others, one at a time. The scene must outlive the session.
+
+class render_session
+{
+public:
+    // The BVH is built with `settings`'s build_acceleration(), so its bvh_cache_dir and
+    // bvh_leaf_size apply, and its threads cap the workers of render()
+    explicit render_session(const hittable_list &world, const camera &settings = camera())
+        : threads(settings.worker_threads())
+    {
+        if (settings.memory_budget > 0)
+            throw std::invalid_argument("render_session: memory_budget needs camera::render()");
+        auto build_start = std::chrono::high_resolution_clock::now();
+        {
+            trace::scope phase("build_bvh");
+            bvh = settings.build_acceleration(world);
+        }
+        build_seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+        sources = photon_sources::gather(world);
+        account_scene(world, scene_memory);
+        scene_memory.add(dynamic_cast<const flat_bvh *>(bvh.get()) ? "bvh (compact)" : "bvh", acceleration_bytes(*bvh));
+    }
+
+    // Adds a view rendered by the next render(), saved to images/<filename> unless empty.
+    // Returns its index.
+    size_t add_view(camera cam, std::string filename = "")
+    {
+        if (!filename.empty() && is_float_image(filename))
+            throw std::invalid_argument("render_session: " + filename + ": float formats need camera::render()");
+        if (cam.memory_budget > 0)
+            throw std::invalid_argument("render_session: memory_budget needs camera::render()");
+        views.push_back({std::move(cam), std::move(filename), {}, {}, {}});
+        return views.size() - 1;
+    }
+
+    // Renders every view and saves those with a filename. Returns the totals over all views;
+    // view_stats() has each one's, timed from the start until its last tile was done.
+    camera::render_stats render()
+    {
+        thread_limit limit(threads);
+        std::vector<work> tiles;
+        std::vector<view_progress> progress(views.size());
+        std::vector<size_t> in_rounds;
+        size_t longest = 0;
+        for (size_t v = 0; v < views.size(); v++)
+        {
+            auto &view = views[v];
+            view.cam.initialize();
+            view.pixels.resize(static_cast<size_t>(view.cam.image_width) * view.cam.image_height);
+            if (view.cam.renders_in_rounds())
+            {
+                in_rounds.push_back(v);
+                continue;
+            }
+            view.tiles = view.cam.generate_tiles(view.cam.tile_pixels());
+            longest = std::max(longest, view.tiles.size());
+        }
+
+        // Round robin over the views, so all of them progress together
+        for (size_t t = 0; t < longest; t++)
+            for (size_t v = 0; v < views.size(); v++)
+                if (t < views[v].tiles.size())
+                    tiles.push_back({static_cast<uint32_t>(v), static_cast<uint32_t>(t)});
+
+        auto textures_before = tile_cache::shared().stats();
+        auto start_time = std::chrono::high_resolution_clock::now();
+        {
+            trace::scope phase("render_views", static_cast<int>(views.size()));
+            std::for_each(std::execution::par, tiles.begin(), tiles.end(),
+                          [this, &progress, start_time](const work &item)
+                          {
+                              auto &view = views[item.view];
+                              const auto &cam = view.cam;
+                              if (cam.cancel && cam.cancel->load(std::memory_order_relaxed))
+                                  return;
+                              const auto &tile = view.tiles[item.tile];
+                              trace::scope tile_span("tile", static_cast<int>(item.tile));
+                              auto &p = progress[item.view];
+                              p.rays += cam.render_tile(tile, *bvh, view.pixels);
+                              int done = ++p.tiles_done;
+                              if (done == static_cast<int>(view.tiles.size()))
+                                  p.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+                              if (cam.on_tile)
+                                  cam.on_tile({tile.x_start, tile.y_start, tile.width, tile.height,
+                                               done, static_cast<int>(view.tiles.size())});
+                          });
+        }
+
+        for (size_t v = 0; v < views.size(); v++)
+        {
+            auto &view = views[v];
+            if (view.tiles.empty())
+                continue;
+            view.stats = {};
+            view.stats.rays = progress[v].rays.load();
+            view.stats.cancelled = progress[v].tiles_done.load() < static_cast<int>(view.tiles.size());
+            view.stats.render_seconds = view.stats.cancelled ? std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count()
+                                                             : progress[v].seconds;
+            view.tiles.clear();
+        }
+        for (size_t v : in_rounds)
+        {
+            auto &view = views[v];
+            view.cam.caustic_sources = sources;
+            view.stats = view.cam.render_prebuilt(*bvh, view.pixels);
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+
+        camera::render_stats totals;
+        totals.render_seconds = std::chrono::duration<double>(end_time - start_time).count();
+        totals.build_seconds = rendered ? 0 : build_seconds;
+        totals.textures = camera::texture_use_since(textures_before);
+        totals.memory = scene_memory;
+        size_t framebuffers = 0;
+        for (const auto &view : views)
+        {
+            totals.rays += view.stats.rays;
+            totals.cancelled |= view.stats.cancelled;
+            framebuffers += view.pixels.capacity() * sizeof(Pixel);
+        }
+        totals.memory.add("framebuffers", framebuffers);
+        totals.memory.peak_rss = peak_rss_bytes();
+        rendered = true;
+
+        for (const auto &view : views)
+            if (!view.filename.empty())
+            {
+                if (view.stats.cancelled)
+                    std::println(stderr, "Cancelled: {} not saved", view.filename);
+                else
+                    view.cam.save(view.pixels, view.filename, view.stats);
+            }
+        std::println(stderr, "Session: {} views | {:.2f}s | {:.2f} MRays/s | BVH built once in {:.3f}s | {}",
+                     views.size(), totals.render_seconds, totals.mrays_s(), build_seconds,
+                     memory_detail::format_bytes(totals.memory.total()));
+        return totals;
+    }
+
+    // Drops all views (and their images); the BVH stays for the next ones
+    void clear_views() { views.clear(); }
+
+    [[nodiscard]] size_t view_count() const { return views.size(); }
+    [[nodiscard]] const std::vector<Pixel> &image(size_t view) const { return views.at(view).pixels; }
+    [[nodiscard]] const camera::render_stats &view_stats(size_t view) const { return views.at(view).stats; } // Of the last render()
+    [[nodiscard]] const hittable &acceleration() const { return *bvh; }
+
+private:
+    struct view
+    {
+        camera cam;
+        std::string filename;
+        std::vector<Pixel> pixels;
+        camera::render_stats stats;
+        std::vector<camera::Tile> tiles; // During render()
+    };
+
+    // One tile of one view, as scheduled
+    struct work
+    {
+        uint32_t view, tile;
+    };
+
+    struct view_progress
+    {
+        std::atomic<uint64_t> rays{0};
+        std::atomic<int> tiles_done{0};
+        double seconds = 0; // Written by whichever thread finishes the last tile
+    };
+
+    int threads;
+    std::shared_ptr<hittable> bvh;
+    double build_seconds = 0;
+    photon_sources sources;
+    memory_report scene_memory; // Scene and BVH; framebuffers are added per render()
+    std::vector<view> views;
+    bool rendered = false;
+};
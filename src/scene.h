@@ -5,6 +5,7 @@
 
 #include "material.h"
 #include "sphere.h"
+#include "static_scene.h"
 
 struct scene
 {
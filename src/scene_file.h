@@ -0,0 +1,378 @@
+#pragma once
+
+#include "scene.h"
+#include "texture.h"
+
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+// Plain-text scene description, so scenes can be loaded at runtime instead of compiled in.
+// One directive per line, '#' starts a comment:
+//
+//   camera <field> <value...>          any public camera setting, e.g. "camera lookfrom 13 2 3"
+//   material <name> lambertian <r g b>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <refraction_index>
+//   material <name> diffuse_light <r g b>
+//   material <name> textured <path>   lambertian with albedo from a .hdr/.pfm/.rttex texture (texture.h)
+//   sphere <x y z> <radius> <material name> [to <x y z>]
+//                                      "to" moves the sphere there by time 1 (camera shutter_open/_close)
+//   environment <path> [intensity] [rotation]
+//                                      .hdr/.pfm lat-long map lighting the scene (rotation in degrees)
+//   output <filename>                  image written by batch renders (default: <file stem>.png)
+
+struct scene_description
+{
+    scene value;
+    std::string output;
+};
+
+namespace scene_file_detail
+{
+    [[noreturn]] inline void fail(std::string_view source, int line, const std::string &what)
+    {
+        throw std::runtime_error(std::string(source) + ":" + std::to_string(line) + ": " + what);
+    }
+
+    inline std::string_view type_name(material_type type)
+    {
+        switch (type)
+        {
+        case material_type::metal:
+            return "metal";
+        case material_type::dielectric:
+            return "dielectric";
+        case material_type::diffuse_light:
+            return "diffuse_light";
+        default:
+            return "lambertian";
+        }
+    }
+
+    // Reads a camera field; returns false for unknown names
+    inline bool read_camera_field(camera &cam, const std::string &field, std::istream &in)
+    {
+        auto read_vec = [&in](vec3 &v)
+        { in >> v.x >> v.y >> v.z; };
+
+        if (field == "aspect_ratio")
+            in >> cam.aspect_ratio;
+        else if (field == "image_width")
+            in >> cam.image_width;
+        else if (field == "samples_per_pixel")
+            in >> cam.samples_per_pixel;
+        else if (field == "max_depth")
+            in >> cam.max_depth;
+        else if (field == "vfov")
+            in >> cam.vfov;
+        else if (field == "lookfrom")
+            read_vec(cam.lookfrom);
+        else if (field == "lookat")
+            read_vec(cam.lookat);
+        else if (field == "vup")
+            read_vec(cam.vup);
+        else if (field == "defocus_angle")
+            in >> cam.defocus_angle;
+        else if (field == "focus_dist")
+            in >> cam.focus_dist;
+        else if (field == "shutter_open")
+            in >> cam.shutter_open;
+        else if (field == "shutter_close")
+            in >> cam.shutter_close;
+        else if (field == "seed")
+            in >> cam.seed;
+        else if (field == "time_budget")
+            in >> cam.time_budget;
+        else if (field == "caustic_photons")
+            in >> cam.caustic_photons;
+        else if (field == "caustic_radius")
+            in >> cam.caustic_radius;
+        else if (field == "caustic_passes")
+            in >> cam.caustic_passes;
+        else if (field == "path_guiding")
+            in >> cam.path_guiding;
+        else if (field == "target_error")
+            in >> cam.target_error;
+        else if (field == "memory_budget")
+            in >> cam.memory_budget;
+        else if (field == "band_rows")
+            in >> cam.band_rows;
+        else
+            return false;
+        return true;
+    }
+}
+
+// Throws std::runtime_error (with the offending line) on malformed input
+[[nodiscard]] inline scene_description parse_scene(std::istream &in, std::string_view source = "<scene>")
+{
+    using namespace scene_file_detail;
+
+    hittable_list world;
+    scene_arena arena; // Spheres and materials (see arena.h)
+    camera cam;
+    std::string output;
+    std::unordered_map<std::string, std::shared_ptr<material>> materials;
+    std::unordered_map<std::string, std::shared_ptr<const image_texture>> textures; // By path, loaded once
+
+    int line_number = 0;
+    int shutter_line = 0; // The last shutter_open or shutter_close, to report an inverted interval
+    for (std::string line; std::getline(in, line);)
+    {
+        line_number++;
+        if (auto comment = line.find('#'); comment != std::string::npos)
+            line.erase(comment);
+
+        std::istringstream fields(line);
+        std::string directive;
+        if (!(fields >> directive))
+            continue;
+
+        if (directive == "camera")
+        {
+            std::string field;
+            fields >> field;
+            if (!read_camera_field(cam, field, fields))
+                fail(source, line_number, "unknown camera field '" + field + "'");
+            if (field == "shutter_open" || field == "shutter_close")
+            {
+                real time = field == "shutter_open" ? cam.shutter_open : cam.shutter_close;
+                if (!fields.fail() && !(time >= 0 && time <= 1))
+                    fail(source, line_number, field + " must be within [0, 1]");
+                shutter_line = line_number;
+            }
+        }
+        else if (directive == "material")
+        {
+            std::string name, type;
+            material_params p;
+            fields >> name >> type;
+            if (type == "lambertian" || type == "metal" || type == "diffuse_light")
+            {
+                fields >> p.albedo.x >> p.albedo.y >> p.albedo.z;
+                p.type = (type == "metal")           ? material_type::metal
+                         : (type == "diffuse_light") ? material_type::diffuse_light
+                                                     : material_type::lambertian;
+                if (p.type == material_type::metal)
+                    fields >> p.parameter;
+            }
+            else if (type == "dielectric")
+            {
+                p.type = material_type::dielectric;
+                fields >> p.parameter;
+            }
+            else if (type == "textured")
+            {
+                std::string path;
+                if (!(fields >> path))
+                    fail(source, line_number, "malformed material");
+                try
+                {
+                    auto tex = textures.find(path);
+                    if (tex == textures.end())
+                        tex = textures.emplace(path, image_texture::load(path)).first;
+                    materials[name] = arena.make<textured_lambertian>(tex->second);
+                }
+                catch (const std::exception &e)
+                {
+                    fail(source, line_number, e.what());
+                }
+                continue;
+            }
+            else
+                fail(source, line_number, "unknown material type '" + type + "'");
+
+            if (fields.fail())
+                fail(source, line_number, "malformed material");
+            materials[name] = make_material(p);
+        }
+        else if (directive == "sphere")
+        {
+            point3 center, destination;
+            real radius;
+            std::string name;
+            fields >> center.x >> center.y >> center.z >> radius >> name;
+            if (fields.fail())
+                fail(source, line_number, "malformed sphere");
+            bool moving = false;
+            if (std::string to; fields >> to)
+            {
+                fields >> destination.x >> destination.y >> destination.z;
+                if (to != "to" || fields.fail())
+                    fail(source, line_number, "malformed sphere");
+                moving = true;
+            }
+            else
+                fields.clear(); // No destination: the failed read must not fail the line
+
+            auto mat = materials.find(name);
+            if (mat == materials.end())
+                fail(source, line_number, "undefined material '" + name + "'");
+            if (moving)
+                world.add(arena.make<sphere>(center, destination, radius, mat->second));
+            else
+                world.add(arena.make<sphere>(center, radius, mat->second));
+        }
+        else if (directive == "environment")
+        {
+            std::string path;
+            real values[2] = {1, 0}; // Intensity, rotation
+            fields >> path;
+            for (auto &value : values)
+            {
+                if (fields.fail() || fields >> value)
+                    continue;
+                if (!fields.eof())
+                    fail(source, line_number, "malformed environment");
+                fields.clear(); // Optional values left out
+                break;
+            }
+            if (fields.fail())
+                fail(source, line_number, "malformed environment");
+
+            try
+            {
+                auto map = environment_map::load(path);
+                map->intensity = values[0];
+                map->rotation = values[1];
+                cam.environment = map;
+            }
+            catch (const std::exception &e)
+            {
+                fail(source, line_number, e.what());
+            }
+        }
+        else if (directive == "output")
+            fields >> output;
+        else
+            fail(source, line_number, "unknown directive '" + directive + "'");
+
+        if (fields.fail())
+            fail(source, line_number, "malformed " + directive);
+    }
+    if (cam.shutter_open > cam.shutter_close)
+        fail(source, shutter_line, "shutter_open is after shutter_close");
+
+    return {scene(std::move(world), cam), output};
+}
+
+[[nodiscard]] inline scene_description load_scene(const std::filesystem::path &path)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open scene file " + path.string());
+
+    auto description = parse_scene(in, path.string());
+    if (description.output.empty())
+        description.output = path.stem().string() + ".png";
+    return description;
+}
+
+// Writes `s` in the scene file format. Only spheres can be represented; other objects
+// are skipped and counted in the return value.
+inline int write_scene(std::ostream &out, const scene &s, std::string_view output = "")
+{
+    using namespace scene_file_detail;
+
+    // Enough digits that every float reads back to exactly the same value
+    out.precision(std::numeric_limits<real>::max_digits10);
+
+    const camera &cam = s.cam;
+    out << "camera aspect_ratio " << cam.aspect_ratio << "\n"
+        << "camera image_width " << cam.image_width << "\n"
+        << "camera samples_per_pixel " << cam.samples_per_pixel << "\n"
+        << "camera max_depth " << cam.max_depth << "\n"
+        << "camera vfov " << cam.vfov << "\n"
+        << "camera lookfrom " << cam.lookfrom.x << " " << cam.lookfrom.y << " " << cam.lookfrom.z << "\n"
+        << "camera lookat " << cam.lookat.x << " " << cam.lookat.y << " " << cam.lookat.z << "\n"
+        << "camera vup " << cam.vup.x << " " << cam.vup.y << " " << cam.vup.z << "\n"
+        << "camera defocus_angle " << cam.defocus_angle << "\n"
+        << "camera focus_dist " << cam.focus_dist << "\n"
+        << "camera seed " << cam.seed << "\n";
+    if (cam.shutter_close > cam.shutter_open)
+        out << "camera shutter_open " << cam.shutter_open << "\n"
+            << "camera shutter_close " << cam.shutter_close << "\n";
+    if (cam.time_budget > 0)
+        out << "camera time_budget " << cam.time_budget << "\n";
+    if (cam.caustic_photons > 0)
+        out << "camera caustic_photons " << cam.caustic_photons << "\n"
+            << "camera caustic_radius " << cam.caustic_radius << "\n"
+            << "camera caustic_passes " << cam.caustic_passes << "\n";
+    if (cam.path_guiding)
+        out << "camera path_guiding 1\n";
+    if (cam.target_error > 0)
+        out << "camera target_error " << cam.target_error << "\n";
+    if (cam.memory_budget > 0)
+        out << "camera memory_budget " << cam.memory_budget << "\n";
+    if (cam.band_rows > 0)
+        out << "camera band_rows " << cam.band_rows << "\n";
+    if (cam.environment && !cam.environment->source.empty())
+        out << "environment " << cam.environment->source << " " << cam.environment->intensity
+            << " " << cam.environment->rotation << "\n";
+    if (!output.empty())
+        out << "output " << output << "\n";
+    out << "\n";
+
+    // Materials are shared between spheres, so name each distinct one once
+    std::map<const material *, std::string> names;
+    int skipped = 0;
+    std::ostringstream spheres;
+    spheres.precision(out.precision());
+
+    for (const auto &object : s.world.objects)
+    {
+        auto sph = std::dynamic_pointer_cast<sphere>(object);
+        if (!sph)
+        {
+            skipped++;
+            continue;
+        }
+
+        const material *mat = sph->material_ptr().get();
+        auto [it, inserted] = names.try_emplace(mat, "m" + std::to_string(names.size()));
+        if (inserted)
+        {
+            auto p = mat->params();
+            out << "material " << it->second << " ";
+            // Textures built in memory have no file to name; they are written as their average
+            if (auto tex = mat->texture(); tex && !tex->source.empty())
+                out << "textured " << tex->source;
+            else
+            {
+                out << type_name(p.type);
+                if (p.type != material_type::dielectric)
+                    out << " " << p.albedo.x << " " << p.albedo.y << " " << p.albedo.z;
+                if (p.type == material_type::metal || p.type == material_type::dielectric)
+                    out << " " << p.parameter;
+            }
+            out << "\n";
+        }
+
+        const auto &c = sph->center();
+        spheres << "sphere " << c.x << " " << c.y << " " << c.z << " " << sph->radius() << " " << it->second;
+        if (sph->moving())
+        {
+            auto d = sph->center(1);
+            spheres << " to " << d.x << " " << d.y << " " << d.z;
+        }
+        spheres << "\n";
+    }
+
+    out << "\n"
+        << spheres.str();
+    return skipped;
+}
+
+inline int save_scene(const scene &s, const std::filesystem::path &path, std::string_view output = "")
+{
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("cannot write scene file " + path.string());
+    return write_scene(out, s, output);
+}
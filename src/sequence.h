@@ -0,0 +1,247 @@
+#pragma once
+
+#include "camera.h"
+#include "hittable_list.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Keyframed camera animation. The BVH is built once for the whole sequence, and frames are
+// handed to a separate I/O thread for PNG encoding, so writing frame N overlaps with
+// rendering frame N+1.
+
+struct camera_keyframe
+{
+    real frame = 0; // Position in the sequence, in frames
+    point3 lookfrom;
+    point3 lookat;
+    real vfov = 90;
+    real focus_dist = 10;
+
+    // The animated parameters of `cam`, keyed at `frame`
+    [[nodiscard]] static camera_keyframe from(const camera &cam, real frame = 0)
+    {
+        return {frame, cam.lookfrom, cam.lookat, cam.vfov, cam.focus_dist};
+    }
+
+    void apply(camera &cam) const
+    {
+        cam.lookfrom = lookfrom;
+        cam.lookat = lookat;
+        cam.vfov = vfov;
+        cam.focus_dist = focus_dist;
+    }
+};
+
+// Catmull-Rom spline through the keys (sorted by frame), so motion has no kinks at keyframes.
+// Frames before the first or after the last key hold that key.
+[[nodiscard]] inline camera_keyframe interpolate(const std::vector<camera_keyframe> &keys, real frame)
+{
+    if (keys.size() == 1 || frame <= keys.front().frame)
+        return keys.front();
+    if (frame >= keys.back().frame)
+        return keys.back();
+
+    size_t i = 1;
+    while (keys[i].frame < frame)
+        i++;
+    const auto &k1 = keys[i - 1];
+    const auto &k2 = keys[i];
+    const auto &k0 = (i >= 2) ? keys[i - 2] : k1;
+    const auto &k3 = (i + 1 < keys.size()) ? keys[i + 1] : k2;
+
+    real t = (frame - k1.frame) / (k2.frame - k1.frame);
+    real t2 = t * t, t3 = t2 * t;
+    real w0 = 0.5f * (-t3 + 2 * t2 - t);
+    real w1 = 0.5f * (3 * t3 - 5 * t2 + 2);
+    real w2 = 0.5f * (-3 * t3 + 4 * t2 + t);
+    real w3 = 0.5f * (t3 - t2);
+    auto blend = [&](auto member)
+    { return w0 * k0.*member + w1 * k1.*member + w2 * k2.*member + w3 * k3.*member; };
+
+    return {frame, blend(&camera_keyframe::lookfrom), blend(&camera_keyframe::lookat),
+            blend(&camera_keyframe::vfov), blend(&camera_keyframe::focus_dist)};
+}
+
+// Keys for `turns` full circles of lookfrom around lookat (about the vertical axis) over
+// `frames` frames, starting from `start`; the last frame stops one step short of the start, so
+// the sequence loops seamlessly. Eight keys per turn keep the spline on the circle.
+[[nodiscard]] inline std::vector<camera_keyframe> orbit_keys(const camera_keyframe &start, real turns, int frames)
+{
+    vec3 offset = start.lookfrom - start.lookat;
+    real radius = std::sqrt(offset.x * offset.x + offset.z * offset.z);
+    real angle0 = std::atan2(offset.z, offset.x);
+
+    int steps = std::max(2, static_cast<int>(std::ceil(8 * std::abs(turns))));
+    std::vector<camera_keyframe> keys;
+    for (int k = -1; k <= steps + 1; k++) // One extra key at each end fixes the end tangents
+    {
+        real f = static_cast<real>(k) / steps;
+        real angle = angle0 + 2 * pi * turns * f;
+        auto key = start;
+        key.frame = f * frames;
+        key.lookfrom = start.lookat + vec3(radius * std::cos(angle), offset.y, radius * std::sin(angle));
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+class sequence_renderer
+{
+public:
+    std::string name_pattern = "frame_{:04}.png"; // std::format pattern for the frame number
+    int queue_depth = 2;                          // Finished frames that may wait for the I/O thread
+
+    struct frame_stats
+    {
+        int frame = 0;
+        double render_seconds = 0;
+        double encode_seconds = 0;
+        uint64_t rays = 0;
+    };
+
+    // Renders `frames` frames of `cam` moving along `keys`; returns the per-frame statistics.
+    // The BVH is built once for every frame, so a memory_budget throws std::invalid_argument,
+    // as does a float name_pattern (frames are 8-bit). An exception from rendering or saving
+    // a frame stops the sequence and is rethrown here once the I/O thread has finished.
+    std::vector<frame_stats> render(const hittable_list &world, camera cam,
+                                    const std::vector<camera_keyframe> &keys, int frames)
+    {
+        if (cam.memory_budget > 0)
+            throw std::invalid_argument("sequence_renderer: memory_budget needs camera::render()");
+        int first = 0;
+        if (is_float_image(std::vformat(name_pattern, std::make_format_args(first))))
+            throw std::invalid_argument("sequence_renderer: " + name_pattern + ": float formats need camera::render()");
+        auto sequence_start = std::chrono::steady_clock::now();
+        std::shared_ptr<hittable> world_bvh;
+        {
+            trace::scope phase("build_bvh");
+            world_bvh = cam.build_acceleration(world);
+        }
+        if (cam.caustic_photons > 0)
+            cam.set_caustic_sources(photon_sources::gather(world));
+        std::chrono::duration<double> build = std::chrono::steady_clock::now() - sequence_start;
+
+        std::vector<frame_stats> stats(frames);
+        // One buffer being rendered, the rest queued or being encoded
+        spare.clear();
+        finished.clear();
+        write_error = nullptr;
+        for (int i = 0; i <= queue_depth; i++)
+            spare.emplace_back();
+
+        // Joined on every path: if a render throws, leaving this scope asks the writer to stop
+        // once the frames already queued are saved
+        std::jthread writer([this, &stats, frames](std::stop_token stop)
+                            { write_frames(stop, stats, frames); });
+
+        for (int f = 0; f < frames; f++)
+        {
+            std::vector<Pixel> pixels;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [this]
+                             { return !spare.empty() || write_error; });
+                if (write_error)
+                    break;
+                pixels = std::move(spare.back());
+                spare.pop_back();
+            }
+
+            interpolate(keys, static_cast<real>(f)).apply(cam);
+            auto result = cam.render_prebuilt(*world_bvh, pixels);
+            stats[f] = {f, result.render_seconds, 0, result.rays};
+
+            {
+                std::lock_guard lock(mutex);
+                finished.push_back({f, cam, std::move(pixels)});
+            }
+            changed.notify_all();
+        }
+        writer.join();
+        if (write_error)
+            std::rethrow_exception(write_error);
+
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - sequence_start;
+        report(stats, build.count(), wall.count());
+        return stats;
+    }
+
+private:
+    struct finished_frame
+    {
+        int frame;
+        camera cam; // Copy of the camera as rendered, for the image size
+        std::vector<Pixel> pixels;
+    };
+
+    std::mutex mutex;
+    std::condition_variable_any changed;
+    std::deque<finished_frame> finished;
+    std::vector<std::vector<Pixel>> spare;
+    std::exception_ptr write_error; // Why the writer gave up, handed back to render()
+
+    void write_frames(std::stop_token stop, std::vector<frame_stats> &stats, int frames)
+    {
+        for (int written = 0; written < frames; written++)
+        {
+            finished_frame job;
+            {
+                std::unique_lock lock(mutex);
+                if (!changed.wait(lock, stop, [this]
+                                  { return !finished.empty(); }))
+                    return; // Stopped, with nothing left to save
+                job = std::move(finished.front());
+                finished.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            std::filesystem::path path;
+            try
+            {
+                path = job.cam.save_image(job.pixels, std::vformat(name_pattern, std::make_format_args(job.frame)));
+            }
+            catch (...)
+            {
+                std::lock_guard lock(mutex);
+                write_error = std::current_exception();
+                changed.notify_all();
+                return;
+            }
+            std::chrono::duration<double> encode = std::chrono::steady_clock::now() - start;
+
+            std::lock_guard lock(mutex);
+            auto &s = stats[job.frame];
+            s.encode_seconds = encode.count();
+            std::println(stderr, "Frame {}/{}: {} | render {:.2f}s ({:.2f} MRays/s) | encode {:.3f}s",
+                         job.frame + 1, frames, path.string(), s.render_seconds,
+                         s.rays / s.render_seconds / 1e6, s.encode_seconds);
+            spare.push_back(std::move(job.pixels));
+            changed.notify_all();
+        }
+    }
+
+    static void report(const std::vector<frame_stats> &stats, double build_seconds, double wall_seconds)
+    {
+        double render = 0, encode = 0;
+        uint64_t rays = 0;
+        for (const auto &s : stats)
+        {
+            render += s.render_seconds;
+            encode += s.encode_seconds;
+            rays += s.rays;
+        }
+        std::println(stderr, "Sequence: {} frames | {:.2f}s wall | {:.2f} frames/s | {:.2f} MRays/s",
+                     stats.size(), wall_seconds, stats.size() / wall_seconds, rays / render / 1e6);
+        std::println(stderr, "  build {:.3f}s once | render {:.2f}s | encode {:.2f}s, {:.0f}% overlapped with rendering",
+                     build_seconds, render, encode,
+                     encode > 0 ? 100.0 * std::clamp((build_seconds + render + encode - wall_seconds) / encode, 0.0, 1.0) : 0.0);
+    }
+};
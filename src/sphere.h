@@ -8,15 +8,54 @@ class sphere : public hittable
 {
 public:
     constexpr sphere(const point3 &center, real radius, std::shared_ptr<material> mat)
-        : center(center), radius(std::max(0.0f, radius)), mat(mat)
+        : sphere_center(center), sphere_radius(std::max<real>(0, radius)), mat(mat)
     {
         // The bounding box goes from (center - radius) to (center + radius)
         auto r_vec = vec3(radius, radius, radius);
         bbox = aabb(center - r_vec, center + r_vec);
     }
 
+    // Moving sphere: at `center1` at time 0 and `center2` at time 1, in a straight line
+    constexpr sphere(const point3 &center1, const point3 &center2, real radius, std::shared_ptr<material> mat)
+        : sphere(center1, radius, std::move(mat))
+    {
+        sphere_motion = center2 - center1;
+        in_motion = !sphere_motion.near_zero();
+        bbox = aabb(bbox, bounding_box_at(1));
+    }
+
     [[nodiscard]] bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
+        const point3 current = in_motion ? center(r.time()) : sphere_center;
+        real root;
+        if (!intersect(current, sphere_radius, r, ray_t, root))
+            return false;
+
+        surface_hit(current, sphere_radius, r, root, rec);
+        rec.mat = mat;
+        return true;
+    }
+
+    // Fills in `rec` for the hit of `r` at `root`, shared with the flat BVH and static scenes.
+    // The point is projected back onto the surface: r.at(root) carries the error of the root,
+    // which grows with the sphere, while the projection stays within a few roundings of it
+    // (what spawn_origin() in hittable.h allows for).
+    static void surface_hit(const point3 &center, real radius, const ray &r, real root, hit_record &rec)
+    {
+        vec3 outward_normal = unit_vector(r.at(root) - center);
+        rec.t = root;
+        rec.p = center + radius * outward_normal;
+        rec.set_face_normal(r, outward_normal);
+        rec.radius = radius;
+    }
+
+    // Nearest root of the ray-sphere quadratic inside `ray_t`, shared with the flat BVH
+    [[nodiscard]] static bool intersect(const point3 &center, real radius, const ray &r, interval ray_t, real &root)
+    {
+#if defined(RT_PRECISION_MIXED)
+        if (radius >= large_sphere_radius)
+            return intersect_double(center, radius, r, ray_t, root);
+#endif
         vec3 oc = center - r.origin();
         // Simplified quadratic: a*t^2 + 2ht + c = 0
         auto a = r.direction().length_squared();
@@ -30,28 +69,79 @@ public:
         auto sqrtd = std::sqrt(discriminant);
 
         // Find the nearest root that lies in the acceptable range (tmin, tmax)
-        auto root = (h - sqrtd) / a;
+        root = (h - sqrtd) / a;
         if (!ray_t.surrounds(root))
         {
             root = (h + sqrtd) / a;
             if (!ray_t.surrounds(root))
                 return false;
         }
+        return true;
+    }
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
+#if defined(RT_PRECISION_MIXED)
+    // intersect() in double: on large spheres c = |oc|^2 - radius^2 cancels most of a float's bits
+    [[nodiscard]] static bool intersect_double(const point3 &center, real radius, const ray &r, interval ray_t, real &root)
+    {
+        const double ox = double(center.x) - r.origin().x, oy = double(center.y) - r.origin().y, oz = double(center.z) - r.origin().z;
+        const double dx = r.direction().x, dy = r.direction().y, dz = r.direction().z;
+        const double a = dx * dx + dy * dy + dz * dz;
+        const double h = dx * ox + dy * oy + dz * oz;
+        const double c = ox * ox + oy * oy + oz * oz - double(radius) * radius;
 
+        const double discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        const double sqrtd = std::sqrt(discriminant);
+        double t = (h - sqrtd) / a;
+        if (!ray_t.surrounds(static_cast<real>(t)))
+        {
+            t = (h + sqrtd) / a;
+            if (!ray_t.surrounds(static_cast<real>(t)))
+                return false;
+        }
+        root = static_cast<real>(t);
         return true;
     }
+#endif
+
+    // Texture coordinates of the point with unit `outward_normal`: u in [0, 1] around the Y axis
+    // from X = -1, v in [0, 1] from the top (Y = 1) down
+    static void surface_uv(const vec3 &outward_normal, real &u, real &v)
+    {
+        real theta = std::acos(std::clamp<real>(outward_normal.y, -1, 1));
+        real phi = std::atan2(-outward_normal.z, outward_normal.x) + pi;
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
 
     [[nodiscard]] aabb bounding_box() const override { return bbox; }
 
+    [[nodiscard]] bool moving() const override { return in_motion; }
+    [[nodiscard]] aabb bounding_box_at(real time) const override
+    {
+        if (!in_motion)
+            return bbox;
+        auto r_vec = vec3(sphere_radius, sphere_radius, sphere_radius);
+        return aabb(center(time) - r_vec, center(time) + r_vec);
+    }
+
+    // Accessors
+    [[nodiscard]] constexpr const point3 &center() const { return sphere_center; } // At time 0
+    [[nodiscard]] constexpr point3 center(real time) const { return sphere_center + time * sphere_motion; }
+    [[nodiscard]] constexpr const vec3 &motion() const { return sphere_motion; } // From time 0 to 1
+    [[nodiscard]] constexpr real radius() const { return sphere_radius; }
+    [[nodiscard]] const std::shared_ptr<material> &material_ptr() const { return mat; }
+
+    // Swaps the material, e.g. for look-dev edits (look_dev.h); never while rendering
+    void set_material(std::shared_ptr<material> m) { mat = std::move(m); }
+
 private:
-    point3 center;
-    real radius;
+    point3 sphere_center;
+    vec3 sphere_motion;
+    real sphere_radius;
+    bool in_motion = false;
     std::shared_ptr<material> mat;
     aabb bbox;
 };
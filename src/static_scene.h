@@ -0,0 +1,186 @@
+#pragma once
+
+#include "common.h"
+#include "cpu_dispatch.h"
+#include "flat_bvh.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Scenes whose spheres and materials are fixed at compile time. Declared as a constexpr
+// variable, the BVH is built by the compiler and lands in read-only data, and rendering goes
+// through camera::render_static(): materials are dispatched by a switch on their type and
+// primitives are always spheres, so there are no virtual calls, no shared_ptr copies and no
+// heap allocation per ray. The image is the same as rendering world() the usual way: bit for
+// bit in strict floating point, statistically with -ffast-math, which may fuse the inlined
+// arithmetic differently.
+//
+//   inline constexpr static_scene box{
+//       std::array{static_sphere{point3(0, -1000, 0), 1000, 0}, ...},
+//       std::array{material_params{material_type::lambertian, color(0.5, 0.5, 0.5)}, ...}};
+//   cam.render_static(box, "box.png");
+
+struct static_sphere
+{
+    point3 center;
+    real radius;
+    uint32_t material; // Index into the scene's materials
+};
+
+template <size_t Spheres, size_t Materials>
+class static_scene
+{
+    static_assert(Spheres > 0 && Materials > 0, "a static scene needs spheres and materials");
+
+public:
+    // Throws (a compile error in constant evaluation) if a sphere names a missing material
+    constexpr static_scene(const std::array<static_sphere, Spheres> &list,
+                           const std::array<material_params, Materials> &material_list)
+        : materials(material_list)
+    {
+        for (auto &m : materials)
+            if (m.type == material_type::metal)
+                m.parameter = std::min<real>(m.parameter, 1); // Fuzz is clamped like metal's constructor does
+
+        std::array<uint32_t, Spheres> order{};
+        for (uint32_t i = 0; i < Spheres; i++)
+        {
+            if (list[i].material >= Materials)
+                throw std::out_of_range("static_scene: sphere material index out of range");
+            order[i] = i;
+        }
+        build(list, order, 0, Spheres);
+
+        for (size_t k = 0; k < Spheres; k++)
+        {
+            const auto &s = list[order[k]];
+            spheres[k] = {{float(s.center.x), float(s.center.y), float(s.center.z)}, float(std::max<real>(0, s.radius))};
+            sphere_materials[k] = s.material;
+        }
+    }
+
+    // Nearest hit, like flat_bvh::hit(); `material` receives the material index
+    [[nodiscard]] RT_NOINLINE bool hit(const ray &r, interval ray_t, hit_record &rec, uint32_t &material) const
+    {
+        uint32_t closest = flat_bvh_detail::closest_sphere(std::span(nodes).first(used_nodes), spheres, r, ray_t);
+        if (closest == UINT32_MAX)
+            return false;
+
+        const auto &s = spheres[closest];
+        point3 center(s.center[0], s.center[1], s.center[2]);
+        sphere::surface_hit(center, s.radius, r, ray_t.max, rec);
+        material = sphere_materials[closest];
+        return true;
+    }
+
+    // camera::ray_color() for this scene, with the same arithmetic and random number use.
+    // The background is the sky gradient.
+    [[nodiscard]] color ray_color(const ray &r, int depth) const
+    {
+        if (depth <= 0)
+            return color(0.0f, 0.0f, 0.0f);
+
+        hit_record rec;
+        uint32_t material;
+        if (hit(r, interval::positive, rec, material))
+            return shade(r, rec, materials[material], depth);
+        return background(r);
+    }
+
+    // hit(), shade() and background() are out of line like their counterparts in the camera,
+    // and shade() is compiled for each CPU level like camera::shade(), so both round alike
+    [[nodiscard]] RT_NOINLINE color shade(const ray &r, const hit_record &rec, const material_params &params, int depth) const
+    {
+        return cpu_dispatch::run([&]
+                                 {
+                                     ray scattered;
+                                     color attenuation;
+                                     color color_from_emission = emitted(params);
+
+                                     if (scatter(params, r, rec, attenuation, scattered))
+                                         return color_from_emission + (attenuation * ray_color(scattered, depth - 1));
+                                     else
+                                         return color_from_emission;
+                                 });
+    }
+
+    [[nodiscard]] RT_NOINLINE color background(const ray &r) const
+    {
+        vec3 unit_direction = unit_vector(r.direction());
+        auto a = 0.5f * (unit_direction.y + 1.0f);
+        return (1.0f - a) * color(1.0f, 1.0f, 1.0f) + a * color(0.5f, 0.7f, 1.0f);
+    }
+
+    // The same scene as ordinary objects, e.g. for camera::render() or scene files
+    [[nodiscard]] hittable_list world() const
+    {
+        std::vector<std::shared_ptr<material>> shared;
+        for (const auto &m : materials)
+            shared.push_back(make_material(m));
+
+        hittable_list list;
+        for (size_t k = 0; k < Spheres; k++)
+        {
+            const auto &s = spheres[k];
+            list.add(std::make_shared<sphere>(point3(s.center[0], s.center[1], s.center[2]), s.radius,
+                                              shared[sphere_materials[k]]));
+        }
+        return list;
+    }
+
+    [[nodiscard]] constexpr size_t node_count() const { return used_nodes; }
+
+private:
+    std::array<flat_bvh_detail::node, 2 * Spheres - 1> nodes{};
+    std::array<flat_bvh_detail::sphere_data, Spheres> spheres{}; // In leaf order
+    std::array<uint32_t, Spheres> sphere_materials{};
+    std::array<material_params, Materials> materials{};
+    size_t used_nodes = 0;
+
+    // Same tree as flat_bvh::build(): median split on the longest axis, sorted by box
+    // minimum, at most two spheres per leaf. Returns the index of the subtree's root.
+    constexpr size_t build(const std::array<static_sphere, Spheres> &list, std::array<uint32_t, Spheres> &order,
+                           size_t start, size_t end)
+    {
+        constexpr float inf = std::numeric_limits<float>::infinity();
+        flat_bvh_detail::node n{{inf, inf, inf}, 0, {-inf, -inf, -inf}, 0, 0};
+        for (size_t k = start; k < end; k++)
+        {
+            const auto &s = list[order[k]];
+            for (int a = 0; a < 3; a++)
+            {
+                n.lo[a] = std::min(n.lo[a], float(s.center[a] - s.radius));
+                n.hi[a] = std::max(n.hi[a], float(s.center[a] + s.radius));
+            }
+        }
+
+        size_t index = used_nodes++;
+        nodes[index] = n;
+        if (end - start <= 2)
+        {
+            nodes[index].offset = static_cast<uint32_t>(start);
+            nodes[index].count = static_cast<uint16_t>(end - start);
+            return index;
+        }
+
+        float extent[3] = {n.hi[0] - n.lo[0], n.hi[1] - n.lo[1], n.hi[2] - n.lo[2]};
+        int axis = (extent[0] > extent[1]) ? (extent[0] > extent[2] ? 0 : 2)
+                                           : (extent[1] > extent[2] ? 1 : 2);
+        std::sort(order.begin() + start, order.begin() + end,
+                  [&](uint32_t a, uint32_t b)
+                  { return list[a].center[axis] - list[a].radius < list[b].center[axis] - list[b].radius; });
+
+        size_t mid = start + (end - start) / 2;
+        build(list, order, start, mid);
+        nodes[index].offset = static_cast<uint32_t>(build(list, order, mid, end));
+        nodes[index].axis = static_cast<uint16_t>(axis);
+        return index;
+    }
+};
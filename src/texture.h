@@ -0,0 +1,478 @@
+#pragma once
+
+#include "common.h"
+#include "environment.h"
+#include "image_reader.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Image textures read through a bounded tile cache, in the spirit of OpenImageIO's ImageCache.
+//
+// A texture is a mip pyramid (each level half the size of the previous, down to 1x1) cut into
+// 32x32 tiles of rgb9e5 texels (see environment.h), stored as one position-independent block
+// like flat_bvh.h: save() writes it to a .rttex file and open() maps that file, so a texture
+// costs no memory until its tiles are touched. Lookups decode tiles into a process-wide LRU
+// cache of bounded size, split into shards with a lock each so threads rarely contend; only
+// the tiles (and mip levels) a render actually sees are ever decoded.
+//
+//   auto tex = image_texture::load("wood.hdr");      // .hdr/.pfm are tiled in memory
+//   auto tex = image_texture::load("wood.rttex");    // pre-tiled, zero-copy
+//   world.add(make_shared<sphere>(center, 1, make_shared<textured_lambertian>(tex)));
+//
+// The mip level comes from the width of the ray's footprint on the surface (hit_record::
+// footprint, a ray cone traced by the camera), blending the two nearest levels.
+
+namespace texture_detail
+{
+    inline constexpr char magic[8] = {'R', 'T', 'T', 'E', 'X', '\0', '\0', '\0'};
+    inline constexpr uint32_t version = 1;
+    inline constexpr uint32_t byte_order = 0x01020304;
+    inline constexpr int tile_size = 32; // Texels per tile side
+    inline constexpr int tile_texels = tile_size * tile_size;
+    inline constexpr int max_levels = 32;
+
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t width, height;
+        uint32_t level_count, reserved;
+        uint64_t file_size;
+    };
+
+    // Tiles of a level are row-major, each tile_texels texels row-major, edge tiles padded
+    struct level
+    {
+        uint32_t width, height;
+        uint32_t tiles_x, tiles_y;
+        uint64_t offset; // Of the first tile, from the start of the block
+    };
+
+    static_assert(sizeof(header) == 40 && sizeof(level) == 24);
+}
+
+// Decoded tiles shared by all textures, least recently used first out once `capacity` bytes
+// are held (split evenly over the shards, each of which keeps at least one tile). Safe to use
+// from any number of threads.
+class tile_cache
+{
+public:
+    using tile = std::array<color, texture_detail::tile_texels>;
+
+    struct statistics
+    {
+        uint64_t hits = 0, misses = 0;
+        size_t bytes = 0, capacity = 0;
+
+        [[nodiscard]] double hit_rate() const
+        {
+            return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0;
+        }
+    };
+
+    explicit tile_cache(size_t capacity = 64u << 20) : capacity(capacity) {}
+
+    // The cache textures use unless given another one
+    [[nodiscard]] static tile_cache &shared()
+    {
+        static tile_cache cache;
+        return cache;
+    }
+
+    // Tile `key`, decoded by `decode(tile &)` on a miss. The tile stays valid while the returned
+    // pointer is held, even if it is evicted meanwhile.
+    template <typename Decode>
+    [[nodiscard]] std::shared_ptr<const tile> get(uint64_t key, Decode &&decode)
+    {
+        auto &s = shards[shard_of(key)];
+        {
+            std::lock_guard lock(s.mutex);
+            if (auto it = s.index.find(key); it != s.index.end())
+            {
+                s.lru.splice(s.lru.begin(), s.lru, it->second); // Most recently used first
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second->second;
+            }
+        }
+
+        // Decode outside the lock; two threads missing the same tile both decode it, and the
+        // second one finds and returns the first one's copy
+        auto decoded = std::make_shared<tile>();
+        decode(*decoded);
+        misses.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard lock(s.mutex);
+        if (auto it = s.index.find(key); it != s.index.end())
+            return it->second->second;
+        s.lru.emplace_front(key, decoded);
+        s.index.emplace(key, s.lru.begin());
+        s.bytes += sizeof(tile);
+        const size_t limit = capacity.load(std::memory_order_relaxed) / shard_count;
+        while (s.bytes > limit && s.lru.size() > 1)
+        {
+            s.index.erase(s.lru.back().first);
+            s.lru.pop_back();
+            s.bytes -= sizeof(tile);
+        }
+        return decoded;
+    }
+
+    // Changes the size limit; shrinking takes effect as tiles are added
+    void set_capacity(size_t bytes) { capacity.store(bytes, std::memory_order_relaxed); }
+
+    // Puts the size limit back as it was when constructed, on leaving its scope; lets a render
+    // shrink the cache for its own memory budget without shrinking it for the ones after
+    class capacity_scope
+    {
+    public:
+        explicit capacity_scope(tile_cache &cache) : cache(cache), saved(cache.capacity.load()) {}
+        ~capacity_scope() { cache.set_capacity(saved); }
+        capacity_scope(const capacity_scope &) = delete;
+        capacity_scope &operator=(const capacity_scope &) = delete;
+
+    private:
+        tile_cache &cache;
+        size_t saved;
+    };
+
+    // Drops every tile, e.g. between unrelated renders
+    void clear()
+    {
+        for (auto &s : shards)
+        {
+            std::lock_guard lock(s.mutex);
+            s.index.clear();
+            s.lru.clear();
+            s.bytes = 0;
+        }
+    }
+
+    [[nodiscard]] statistics stats()
+    {
+        statistics st{hits.load(), misses.load(), 0, capacity.load()};
+        for (auto &s : shards)
+        {
+            std::lock_guard lock(s.mutex);
+            st.bytes += s.bytes;
+        }
+        return st;
+    }
+
+    // Keys of distinct textures never collide: the top 24 bits number the texture
+    [[nodiscard]] static uint64_t new_texture_id()
+    {
+        static std::atomic<uint64_t> next{0};
+        return next.fetch_add(1, std::memory_order_relaxed) << 40;
+    }
+
+private:
+    static constexpr size_t shard_count = 64;
+
+    struct shard
+    {
+        std::mutex mutex;
+        std::list<std::pair<uint64_t, std::shared_ptr<const tile>>> lru;
+        std::unordered_map<uint64_t, decltype(lru)::iterator> index;
+        size_t bytes = 0;
+    };
+
+    std::array<shard, shard_count> shards;
+    std::atomic<size_t> capacity;
+    std::atomic<uint64_t> hits{0}, misses{0};
+
+    [[nodiscard]] static size_t shard_of(uint64_t key)
+    {
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15ULL) >> 58);
+    }
+};
+
+class image_texture
+{
+public:
+    std::string source; // Path the texture was loaded from, if any (for writing scene files)
+
+    // Tiles and mip-maps `width` x `height` linear texels (row-major, top row first). Throws
+    // std::invalid_argument if the count does not match the size.
+    [[nodiscard]] static std::shared_ptr<image_texture> build(int width, int height, const std::vector<color> &texels,
+                                                              tile_cache &cache = tile_cache::shared())
+    {
+        if (width <= 0 || height <= 0 || texels.size() != static_cast<size_t>(width) * height)
+            throw std::invalid_argument("image_texture: texel count does not match the size");
+        auto tex = std::shared_ptr<image_texture>(new image_texture(cache));
+        tex->storage = encode(width, height, texels);
+        tex->attach(std::as_bytes(std::span(tex->storage)), "image_texture");
+        return tex;
+    }
+
+    // Maps a file written by save(). Throws std::runtime_error if it is missing, truncated,
+    // inconsistent or was written by a different version.
+    [[nodiscard]] static std::shared_ptr<image_texture> open(const std::filesystem::path &path,
+                                                             tile_cache &cache = tile_cache::shared())
+    {
+        auto tex = std::shared_ptr<image_texture>(new image_texture(cache));
+        tex->file = mapped_file(path);
+        tex->attach(tex->file.bytes(), path.string());
+        tex->source = path.string();
+        return tex;
+    }
+
+    // open() for .rttex files, build() from read_float_image() for .hdr and .pfm
+    [[nodiscard]] static std::shared_ptr<image_texture> load(const std::filesystem::path &path,
+                                                             tile_cache &cache = tile_cache::shared())
+    {
+        if (path.extension() == ".rttex")
+            return open(path, cache);
+        auto image = read_float_image(path);
+        auto tex = build(image.width, image.height, image.texels, cache);
+        tex->source = path.string();
+        return tex;
+    }
+
+    // Writes the tiled block to `path` (written aside and renamed into place, like flat_bvh)
+    void save(const std::filesystem::path &path) const
+    {
+        auto temp = path;
+        temp += std::format(".{:08x}.tmp", std::random_device{}());
+        {
+            std::ofstream out(temp, std::ios::binary);
+            out.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size()));
+            if (!out)
+                throw std::runtime_error("cannot write " + temp.string());
+        }
+        std::filesystem::rename(temp, path);
+    }
+
+    // Trilinearly filtered color at (u, v) for a footprint `width` texture-space units wide.
+    // u wraps around; v is clamped to [0, 1], 0 being the top row.
+    [[nodiscard]] color value(real u, real v, real width) const
+    {
+        real lod = std::log2(std::max(width * static_cast<real>(std::max(levels[0].width, levels[0].height)), real(1)));
+        lod = std::min(lod, static_cast<real>(levels.size() - 1));
+        int fine = static_cast<int>(lod);
+        real blend = lod - fine;
+        color c = bilinear(fine, u, v);
+        if (blend > 0 && fine + 1 < static_cast<int>(levels.size()))
+            c = (1 - blend) * c + blend * bilinear(fine + 1, u, v);
+        return c;
+    }
+
+    // Mean color of the whole texture (its 1x1 level)
+    [[nodiscard]] color average() const { return texel(static_cast<int>(levels.size()) - 1, 0, 0); }
+
+    [[nodiscard]] int width() const { return static_cast<int>(levels[0].width); }
+    [[nodiscard]] int height() const { return static_cast<int>(levels[0].height); }
+    [[nodiscard]] int level_count() const { return static_cast<int>(levels.size()); }
+    [[nodiscard]] size_t size_bytes() const noexcept { return image.size(); }
+
+private:
+    tile_cache &cache;
+    uint64_t id;
+    mapped_file file;                           // Set when opened from disk
+    std::vector<uint32_t> storage;              // Backing block when built in memory
+    std::span<const std::byte> image;           // The whole block, header included
+    std::vector<texture_detail::level> levels;  // Copied out of the block
+
+    explicit image_texture(tile_cache &cache) : cache(cache), id(tile_cache::new_texture_id()) {}
+
+    void attach(std::span<const std::byte> bytes, const std::string &what)
+    {
+        using namespace texture_detail;
+        auto fail = [&](const char *reason)
+        { throw std::runtime_error(what + ": " + reason); };
+
+        if (bytes.size() < sizeof(header))
+            fail("not a texture file");
+        const auto &h = *reinterpret_cast<const header *>(bytes.data());
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0)
+            fail("not a texture file");
+        if (h.version != version)
+            fail("texture file version mismatch");
+        if (h.byte_order != byte_order)
+            fail("texture file written with a different byte order");
+        if (h.file_size != bytes.size() || h.level_count == 0 || h.level_count > max_levels ||
+            sizeof(header) + h.level_count * sizeof(level) > h.file_size)
+            fail("texture file truncated");
+
+        auto table = reinterpret_cast<const level *>(bytes.data() + sizeof(header));
+        levels.assign(table, table + h.level_count);
+        constexpr uint64_t tile_bytes = tile_texels * sizeof(uint32_t);
+        auto tiles = [](uint32_t texels) { return (uint64_t(texels) + tile_size - 1) / tile_size; };
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            const auto &l = levels[i];
+            if (l.width == 0 || l.height == 0 || l.tiles_x != tiles(l.width) || l.tiles_y != tiles(l.height))
+                fail("texture file has a bad level size");
+            // Each level halves the one before, as encode() builds them
+            if (i > 0 && (l.width != std::max(1u, levels[i - 1].width / 2) ||
+                          l.height != std::max(1u, levels[i - 1].height / 2)))
+                fail("texture file has a bad level size");
+            if (l.offset % alignof(uint32_t) != 0)
+                fail("texture file has a misaligned level");
+            if (l.offset > h.file_size || uint64_t(l.tiles_x) * l.tiles_y > (h.file_size - l.offset) / tile_bytes)
+                fail("texture file truncated");
+        }
+        image = bytes;
+    }
+
+    // The block: header, level table, then every level's tiles
+    [[nodiscard]] static std::vector<uint32_t> encode(int width, int height, const std::vector<color> &texels)
+    {
+        using namespace texture_detail;
+
+        // Box-filtered pyramid; odd sizes fold their last row or column into the one before
+        std::vector<std::vector<color>> pyramid{texels};
+        std::vector<std::array<int, 2>> sizes{{width, height}};
+        while (sizes.back()[0] > 1 || sizes.back()[1] > 1)
+        {
+            auto [w, h] = sizes.back();
+            int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+            const auto &src = pyramid.back();
+            std::vector<color> dst(static_cast<size_t>(nw) * nh, color(0, 0, 0));
+            std::vector<int> counts(dst.size(), 0);
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                {
+                    size_t d = static_cast<size_t>(std::min(y / 2, nh - 1)) * nw + std::min(x / 2, nw - 1);
+                    dst[d] += src[static_cast<size_t>(y) * w + x];
+                    counts[d]++;
+                }
+            for (size_t i = 0; i < dst.size(); i++)
+                dst[i] /= static_cast<real>(counts[i]);
+            pyramid.push_back(std::move(dst));
+            sizes.push_back({nw, nh});
+        }
+
+        std::vector<level> table;
+        uint64_t offset = sizeof(header) + pyramid.size() * sizeof(level);
+        for (auto [w, h] : sizes)
+        {
+            level l{static_cast<uint32_t>(w), static_cast<uint32_t>(h),
+                    static_cast<uint32_t>((w + tile_size - 1) / tile_size),
+                    static_cast<uint32_t>((h + tile_size - 1) / tile_size), offset};
+            offset += uint64_t(l.tiles_x) * l.tiles_y * tile_texels * sizeof(uint32_t);
+            table.push_back(l);
+        }
+
+        std::vector<uint32_t> block(offset / sizeof(uint32_t));
+        header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order = byte_order;
+        h.width = static_cast<uint32_t>(width);
+        h.height = static_cast<uint32_t>(height);
+        h.level_count = static_cast<uint32_t>(table.size());
+        h.file_size = offset;
+        std::memcpy(block.data(), &h, sizeof(h));
+        std::memcpy(reinterpret_cast<std::byte *>(block.data()) + sizeof(h), table.data(), table.size() * sizeof(level));
+
+        for (size_t n = 0; n < table.size(); n++)
+        {
+            const auto &l = table[n];
+            uint32_t *out = block.data() + l.offset / sizeof(uint32_t);
+            for (uint32_t ty = 0; ty < l.tiles_y; ty++)
+                for (uint32_t tx = 0; tx < l.tiles_x; tx++)
+                    for (int y = 0; y < tile_size; y++)
+                        for (int x = 0; x < tile_size; x++)
+                        {
+                            // Padding repeats the edge texels
+                            uint32_t sx = std::min<uint32_t>(tx * tile_size + x, l.width - 1);
+                            uint32_t sy = std::min<uint32_t>(ty * tile_size + y, l.height - 1);
+                            *out++ = environment_detail::to_rgb9e5(pyramid[n][static_cast<size_t>(sy) * l.width + sx]);
+                        }
+        }
+        return block;
+    }
+
+    // The tile last fetched by a lookup, so neighbouring texels skip the cache
+    struct tile_ref
+    {
+        uint64_t key = UINT64_MAX;
+        std::shared_ptr<const tile_cache::tile> tile;
+    };
+
+    [[nodiscard]] color texel(int n, int x, int y, tile_ref &ref) const
+    {
+        using namespace texture_detail;
+        const auto &l = levels[n];
+        uint32_t tile_index = (y / tile_size) * l.tiles_x + x / tile_size;
+        uint64_t key = id | (static_cast<uint64_t>(n) << 32) | tile_index;
+        if (key != ref.key)
+        {
+            ref.tile = cache.get(key, [&](tile_cache::tile &decoded)
+                                 {
+                                     auto packed = reinterpret_cast<const uint32_t *>(image.data() + l.offset) +
+                                                   static_cast<size_t>(tile_index) * tile_texels;
+                                     for (int i = 0; i < tile_texels; i++)
+                                         decoded[i] = environment_detail::from_rgb9e5(packed[i]); });
+            ref.key = key;
+        }
+        return (*ref.tile)[(y % tile_size) * tile_size + x % tile_size];
+    }
+
+    [[nodiscard]] color texel(int n, int x, int y) const
+    {
+        tile_ref ref;
+        return texel(n, x, y, ref);
+    }
+
+    [[nodiscard]] color bilinear(int n, real u, real v) const
+    {
+        const auto &l = levels[n];
+        const int w = static_cast<int>(l.width), h = static_cast<int>(l.height);
+        real x = (u - std::floor(u)) * w - 0.5f;
+        real y = std::clamp<real>(v, 0, 1) * h - 0.5f;
+        int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        real fx = x - x0, fy = y - y0;
+        auto wrap = [w](int i)
+        { return (i % w + w) % w; };
+        int xa = wrap(x0), xb = wrap(x0 + 1);
+        int ya = std::clamp(y0, 0, h - 1), yb = std::clamp(y0 + 1, 0, h - 1);
+        tile_ref ref; // The four texels usually share a tile
+        return (1 - fy) * ((1 - fx) * texel(n, xa, ya, ref) + fx * texel(n, xb, ya, ref)) +
+               fy * ((1 - fx) * texel(n, xa, yb, ref) + fx * texel(n, xb, yb, ref));
+    }
+};
+
+// Lambertian surface whose albedo comes from a texture, mapped onto spheres by latitude and
+// longitude (sphere::surface_uv())
+class textured_lambertian : public lambertian
+{
+public:
+    explicit textured_lambertian(std::shared_ptr<const image_texture> tex)
+        : lambertian(tex->average()), tex(std::move(tex)) {}
+
+    bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered)
+        const override
+    {
+        real u, v;
+        sphere::surface_uv(rec.front_face ? rec.normal : -rec.normal, u, v);
+        // v covers half a circle of the sphere: pi radii of surface
+        real width = rec.footprint / (pi * rec.radius);
+        return lambertian::scatter(tex->value(u, v, width), r_in, rec, attenuation, scattered);
+    }
+
+    const image_texture *texture() const override { return tex.get(); }
+
+private:
+    std::shared_ptr<const image_texture> tex;
+};
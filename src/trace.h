@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracer that exports Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+//
+// Each thread records into its own buffer, so recording never takes a lock; the
+// registry mutex is only touched once per thread (on its first event) and when dumping.
+// Buffers must only be dumped while no render is in flight.
+namespace trace
+{
+    struct event
+    {
+        const char *name; // Must point to a string literal (never copied)
+        std::int64_t begin_ns;
+        std::int64_t end_ns;
+        int tile; // Tile index, or -1 for phase events
+    };
+
+    struct thread_buffer
+    {
+        int id;
+        std::vector<event> events;
+    };
+
+    namespace detail
+    {
+        inline std::atomic<bool> enabled{false};
+        inline std::chrono::steady_clock::time_point epoch;
+        inline std::mutex registry_mutex;
+        inline std::vector<std::unique_ptr<thread_buffer>> registry;
+
+        [[nodiscard]] inline thread_buffer &local_buffer()
+        {
+            // Buffers are owned by the registry so they outlive worker threads
+            static thread_local thread_buffer *buffer = nullptr;
+            if (!buffer)
+            {
+                std::lock_guard lock(registry_mutex);
+                auto &slot = registry.emplace_back(std::make_unique<thread_buffer>());
+                slot->id = static_cast<int>(registry.size()) - 1;
+                slot->events.reserve(4096);
+                buffer = slot.get();
+            }
+            return *buffer;
+        }
+
+        [[nodiscard]] inline std::int64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - epoch)
+                .count();
+        }
+    }
+
+    [[nodiscard]] inline bool enabled() noexcept
+    {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    // Discards previously recorded events and starts recording
+    inline void start()
+    {
+        std::lock_guard lock(detail::registry_mutex);
+        for (auto &buffer : detail::registry)
+            buffer->events.clear();
+        detail::epoch = std::chrono::steady_clock::now();
+        detail::enabled.store(true, std::memory_order_relaxed);
+    }
+
+    inline void stop()
+    {
+        detail::enabled.store(false, std::memory_order_relaxed);
+    }
+
+    // Records a complete event spanning the lifetime of the scope
+    class scope
+    {
+    public:
+        explicit scope(const char *name, int tile = -1)
+            : name(name), tile(tile), begin_ns(enabled() ? detail::now_ns() : -1) {}
+
+        ~scope()
+        {
+            if (begin_ns >= 0 && enabled())
+                detail::local_buffer().events.push_back({name, begin_ns, detail::now_ns(), tile});
+        }
+
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+
+    private:
+        const char *name;
+        int tile;
+        std::int64_t begin_ns;
+    };
+
+    // Writes all recorded events as a Chrome trace JSON file
+    inline void write(const std::filesystem::path &path)
+    {
+        std::lock_guard lock(detail::registry_mutex);
+        std::ofstream out(path);
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        bool first = true;
+        auto separator = [&]() -> std::ofstream &
+        {
+            if (!first)
+                out << ",\n";
+            first = false;
+            return out;
+        };
+
+        for (const auto &buffer : detail::registry)
+        {
+            if (buffer->events.empty())
+                continue;
+
+            separator() << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                        << ",\"name\":\"thread_name\",\"args\":{\"name\":\"thread " << buffer->id << "\"}}";
+
+            for (const auto &e : buffer->events)
+            {
+                // Chrome expects microseconds
+                separator() << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                            << ",\"name\":\"" << e.name << "\""
+                            << ",\"ts\":" << e.begin_ns / 1000.0
+                            << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0;
+                if (e.tile >= 0)
+                    out << ",\"args\":{\"tile\":" << e.tile << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+}
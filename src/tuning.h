@@ -0,0 +1,195 @@
+#pragma once
+
+#include "build_info.h"
+#include "cpu_dispatch.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#if __has_include(<tbb/global_control.h>)
+#include <tbb/global_control.h>
+#define RT_HAS_TBB_CONTROL 1
+#endif
+
+// Machine profiles: the render parameters whose best values depend on the machine, measured by
+// tools/autotune.cpp and saved per host as <host>.profile in the user's config directory
+// ($XDG_CONFIG_HOME/raytracer, else ~/.config/raytracer), wherever a tool runs from. Renders
+// read this host's profile the first time they need it and take from it every one of these
+// parameters the camera leaves at 0. A profile measured with other build flags or another
+// kernel level is reported and skipped. Setting RT_TUNING to a path reads that profile
+// instead, and RT_TUNING=off reads none; machine_profile::select() does the same from a
+// tool's flag.
+//
+//   # tile_size threads bvh_leaf_size: 32 0 4 at 41.7 MRays/s
+//   host render-07
+//   build -O -ffast-math sse4.2 kernels avx2
+//   tile_size 32
+//   threads 0
+//   bvh_leaf_size 4
+//   mrays_s 41.7
+
+struct machine_profile
+{
+    int tile_size = 16;    // Pixels per side of a render tile
+    int threads = 0;       // Worker threads (0 = every hardware thread)
+    int bvh_leaf_size = 2; // Most objects per BVH leaf
+    double mrays_s = 0;    // Calibration throughput with these settings
+    std::string host;      // Where they were measured
+    std::string build;     // With which build_flags() and kernel level (cpu_dispatch.h)
+
+    [[nodiscard]] static std::filesystem::path default_path()
+    {
+        return config_dir() / (host_name() + ".profile");
+    }
+
+    // The `build` a profile measured by this process would record
+    [[nodiscard]] static std::string current_build()
+    {
+        return std::format("{} kernels {}", build_flags(), cpu_dispatch::name(cpu_dispatch::active()));
+    }
+
+    // Throws std::runtime_error if the file cannot be read or is malformed
+    [[nodiscard]] static machine_profile load(const std::filesystem::path &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+            throw std::runtime_error("cannot open tuning profile " + path.string());
+
+        machine_profile profile;
+        int line_number = 0;
+        for (std::string line; std::getline(in, line);)
+        {
+            line_number++;
+            line.erase(std::min(line.find('#'), line.size()));
+            std::istringstream fields(line);
+            std::string key;
+            if (!(fields >> key))
+                continue;
+            if (key == "tile_size")
+                fields >> profile.tile_size;
+            else if (key == "threads")
+                fields >> profile.threads;
+            else if (key == "bvh_leaf_size")
+                fields >> profile.bvh_leaf_size;
+            else if (key == "mrays_s")
+                fields >> profile.mrays_s;
+            else if (key == "host")
+                fields >> profile.host;
+            else if (key == "build")
+                std::getline(fields >> std::ws, profile.build);
+            // Unknown keys are skipped, so older builds read newer profiles
+
+            if (fields.fail() || profile.tile_size < 1 || profile.threads < 0 || profile.bvh_leaf_size < 2)
+                throw std::runtime_error(std::format("{}:{}: malformed {}", path.string(), line_number, key));
+        }
+        return profile;
+    }
+
+    void save(const std::filesystem::path &path) const
+    {
+        if (path.has_parent_path())
+            std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path);
+        if (!out)
+            throw std::runtime_error("cannot write tuning profile " + path.string());
+        out << std::format("# tile_size threads bvh_leaf_size: {} {} {} at {:.2f} MRays/s\n", tile_size, threads, bvh_leaf_size, mrays_s)
+            << "host " << host << "\n"
+            << "build " << build << "\n"
+            << "tile_size " << tile_size << "\n"
+            << "threads " << threads << "\n"
+            << "bvh_leaf_size " << bvh_leaf_size << "\n"
+            << std::format("mrays_s {:.2f}\n", mrays_s);
+        if (!out)
+            throw std::runtime_error("cannot write tuning profile " + path.string());
+    }
+
+    // Overrides RT_TUNING for this process with a profile path or "off"; only before the
+    // first render, which reads the profile once for good
+    static void select(std::string setting) { selection() = std::move(setting); }
+
+    // This process's profile, read on first use as select()ed, else from RT_TUNING, else from
+    // default_path(); nullptr when there is none. A profile that fails to load is reported
+    // once and ignored.
+    [[nodiscard]] static const machine_profile *current()
+    {
+        static const std::optional<machine_profile> profile = []() -> std::optional<machine_profile>
+        {
+            std::string setting = selection();
+            if (setting.empty())
+                if (const char *variable = std::getenv("RT_TUNING"))
+                    setting = variable;
+            if (setting == "off")
+                return std::nullopt;
+            const bool named = !setting.empty();
+            std::filesystem::path path = named ? std::filesystem::path(setting) : default_path();
+            if (!named && !std::filesystem::exists(path))
+                return std::nullopt;
+            try
+            {
+                auto loaded = load(path);
+                if (!loaded.build.empty() && loaded.build != current_build())
+                {
+                    std::println(stderr, "Tuning: {} was measured with {}, not {}; using defaults", path.string(),
+                                 loaded.build, current_build());
+                    return std::nullopt;
+                }
+                std::println(stderr, "Tuning: {} (tile {}, {} threads, leaf {})", path.string(), loaded.tile_size,
+                             loaded.threads ? std::to_string(loaded.threads) : "all", loaded.bvh_leaf_size);
+                return loaded;
+            }
+            catch (const std::exception &e)
+            {
+                std::println(stderr, "Tuning: {}; using defaults", e.what());
+                return std::nullopt;
+            }
+        }();
+        return profile ? &*profile : nullptr;
+    }
+
+private:
+    // Per-user, so profiles do not depend on the working directory; ./tuning when neither
+    // XDG_CONFIG_HOME nor HOME is set
+    static std::filesystem::path config_dir()
+    {
+        if (const char *config = std::getenv("XDG_CONFIG_HOME"); config && *config)
+            return std::filesystem::path(config) / "raytracer";
+        if (const char *home = std::getenv("HOME"); home && *home)
+            return std::filesystem::path(home) / ".config" / "raytracer";
+        return "tuning";
+    }
+
+    static std::string &selection()
+    {
+        static std::string setting;
+        return setting;
+    }
+};
+
+// Caps the worker threads of parallel algorithms while alive (0 = no cap). Limits nest, the
+// smallest winning. Without TBB's global_control, e.g. on MSVC's own parallel algorithms,
+// it does nothing.
+class thread_limit
+{
+public:
+    explicit thread_limit(int threads)
+    {
+#if RT_HAS_TBB_CONTROL
+        if (threads > 0)
+            control.emplace(tbb::global_control::max_allowed_parallelism, static_cast<size_t>(threads));
+#else
+        (void)threads;
+#endif
+    }
+
+private:
+#if RT_HAS_TBB_CONTROL
+    std::optional<tbb::global_control> control;
+#endif
+};
@@ -1,21 +1,59 @@
 #pragma once
 
+#include "precision.h"
+
 #include <cmath>
-float random_real();
-float random_real(float min, float max);
+real random_real();
+real random_real(real min, real max);
 
-using real = float;
+// SIMD backend: with SSE available (every x86-64 target), vec3 arithmetic is done on all four
+// lanes at once with explicit intrinsics instead of relying on auto-vectorization. Define
+// RT_SCALAR_MATH to force the portable scalar code; double precision (precision.h) always
+// uses it. Constant evaluation always takes the scalar path, so everything stays usable in
+// constexpr contexts.
+#if !defined(RT_SCALAR_MATH) && !defined(RT_PRECISION_DOUBLE) && (defined(__SSE2__) || defined(_M_X64))
+#define RT_SIMD_SSE 1
+#include <immintrin.h>
+#endif
 
 struct alignas(16) vec3
 {
     real x{0}, y{0}, z{0};
-    real _pad{0}; // To make the struct 16 bytes exactly
+    real _pad{0}; // To make the struct 16 bytes exactly; kept at zero by every operation
 
     constexpr vec3() = default;
-    constexpr vec3(real x, real y, real z) : x{x}, y{y}, z{z} {}
+    constexpr vec3(real x, real y, real z) : x{x}, y{y}, z{z}
+    {
+#if RT_SIMD_SSE
+        // Building the register directly avoids a store-forwarding stall when the
+        // components were just computed as scalars and the vector is loaded right after
+        if !consteval
+        {
+            _mm_store_ps(&this->x, _mm_setr_ps(x, y, z, 0.0f));
+        }
+#endif
+    }
+
+#if RT_SIMD_SSE
+    // Lane 3 of `v` is stored as-is; callers are responsible for passing zero there
+    explicit vec3(__m128 v) noexcept { _mm_store_ps(&x, v); }
 
-    [[nodiscard]] constexpr vec3 operator-() const noexcept { return {-x, -y, -z}; }
+    [[nodiscard]] __m128 simd() const noexcept { return _mm_load_ps(&x); }
+#endif
+
+    [[nodiscard]] constexpr vec3 operator-() const noexcept
+    {
+#if RT_SIMD_SSE
+        if !consteval
+        {
+            return vec3(_mm_xor_ps(simd(), _mm_set1_ps(-0.0f)));
+        }
+#endif
+        return {-x, -y, -z};
+    }
 
+    // Selects the member rather than indexing past &x, which is undefined behavior; compilers
+    // fold the selects when i is known and turn them into conditional moves when it is not
     [[nodiscard]] constexpr real operator[](int i) const noexcept
     {
         return (i == 0) ? x : (i == 1) ? y
@@ -30,6 +68,13 @@ struct alignas(16) vec3
 
     constexpr vec3 &operator+=(const vec3 &v) noexcept
     {
+#if RT_SIMD_SSE
+        if !consteval
+        {
+            _mm_store_ps(&x, _mm_add_ps(simd(), v.simd()));
+            return *this;
+        }
+#endif
         x += v.x;
         y += v.y;
         z += v.z;
@@ -38,6 +83,13 @@ struct alignas(16) vec3
 
     constexpr vec3 &operator*=(real t) noexcept
     {
+#if RT_SIMD_SSE
+        if !consteval
+        {
+            _mm_store_ps(&x, _mm_mul_ps(simd(), _mm_set1_ps(t)));
+            return *this;
+        }
+#endif
         x *= t;
         y *= t;
         z *= t;
@@ -50,14 +102,11 @@ struct alignas(16) vec3
     {
         return std::sqrt(length_squared());
     }
-    [[nodiscard]] constexpr real length_squared() const noexcept
-    {
-        return x * x + y * y + z * z;
-    }
+    [[nodiscard]] constexpr real length_squared() const noexcept;
 
     [[nodiscard]] constexpr bool near_zero() const noexcept
     {
-        static constexpr real s = 1e-4f;
+        constexpr real s = 1e-4f;
         return (std::abs(x) < s) && (std::abs(y) < s) && (std::abs(z) < s);
     }
 
@@ -77,25 +126,68 @@ struct alignas(16) vec3
 using point3 = vec3; // 3D point
 using color = vec3;  // RGB color
 
+#if RT_SIMD_SSE
+namespace simd_detail
+{
+    // Sum of lanes 0-2, ignoring lane 3
+    [[nodiscard]] inline float horizontal_add3(__m128 v) noexcept
+    {
+        __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_movehl_ps(v, v);
+        return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(v, y), z));
+    }
+
+    // Lanes 0-2 of `v`, lane 3 cleared
+    [[nodiscard]] inline __m128 clear_lane3(__m128 v) noexcept
+    {
+        return _mm_and_ps(v, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+    }
+}
+#endif
+
 // Utility Functions
 
 [[nodiscard]] constexpr vec3 operator+(const vec3 &u, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_add_ps(u.simd(), v.simd()));
+    }
+#endif
     return {u.x + v.x, u.y + v.y, u.z + v.z};
 }
 
 [[nodiscard]] constexpr vec3 operator-(const vec3 &u, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_sub_ps(u.simd(), v.simd()));
+    }
+#endif
     return {u.x - v.x, u.y - v.y, u.z - v.z};
 }
 
 [[nodiscard]] constexpr vec3 operator*(const vec3 &u, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_mul_ps(u.simd(), v.simd()));
+    }
+#endif
     return {u.x * v.x, u.y * v.y, u.z * v.z};
 }
 
 [[nodiscard]] constexpr vec3 operator*(real t, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_mul_ps(_mm_set1_ps(t), v.simd()));
+    }
+#endif
     return {t * v.x, t * v.y, t * v.z};
 }
 
@@ -111,19 +203,89 @@ using color = vec3;  // RGB color
 
 [[nodiscard]] constexpr real dot(const vec3 &u, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+#if defined(__SSE4_1__)
+        return _mm_cvtss_f32(_mm_dp_ps(u.simd(), v.simd(), 0x71));
+#else
+        return simd_detail::horizontal_add3(_mm_mul_ps(u.simd(), v.simd()));
+#endif
+    }
+#endif
     return u.x * v.x + u.y * v.y + u.z * v.z;
 }
 
+[[nodiscard]] constexpr real vec3::length_squared() const noexcept
+{
+    return dot(*this, *this);
+}
+
 [[nodiscard]] constexpr vec3 cross(const vec3 &u, const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        // cross(u, v) = (u * v.yzx - u.yzx * v).yzx; lane 3 cancels to zero
+        __m128 a = u.simd(), b = v.simd();
+        __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+        return vec3(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+    }
+#endif
     return {u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z, u.x * v.y - u.y * v.x};
 }
 
 [[nodiscard]] constexpr vec3 unit_vector(const vec3 &v) noexcept
 {
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        // Exact sqrt and divide rather than _mm_rsqrt_ps, whose 12-bit estimate shows up as noise
+        __m128 a = v.simd();
+        __m128 length = _mm_sqrt_ps(_mm_set1_ps(dot(v, v)));
+        return vec3(_mm_div_ps(a, length));
+    }
+#endif
     return v / v.length();
 }
 
+// Component-wise minimum and maximum
+[[nodiscard]] constexpr vec3 min(const vec3 &u, const vec3 &v) noexcept
+{
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_min_ps(u.simd(), v.simd()));
+    }
+#endif
+    return {u.x < v.x ? u.x : v.x, u.y < v.y ? u.y : v.y, u.z < v.z ? u.z : v.z};
+}
+
+[[nodiscard]] constexpr vec3 max(const vec3 &u, const vec3 &v) noexcept
+{
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(_mm_max_ps(u.simd(), v.simd()));
+    }
+#endif
+    return {u.x > v.x ? u.x : v.x, u.y > v.y ? u.y : v.y, u.z > v.z ? u.z : v.z};
+}
+
+// Component-wise 1/v (infinite for zero components), with the pad lane kept at zero
+[[nodiscard]] constexpr vec3 reciprocal(const vec3 &v) noexcept
+{
+#if RT_SIMD_SSE
+    if !consteval
+    {
+        return vec3(simd_detail::clear_lane3(_mm_div_ps(_mm_set1_ps(1.0f), v.simd())));
+    }
+#endif
+    return {1.0f / v.x, 1.0f / v.y, 1.0f / v.z};
+}
+
 [[nodiscard]] inline vec3 random_in_unit_disk() noexcept
 {
     while (true)
@@ -162,8 +324,8 @@ using color = vec3;  // RGB color
 
 [[nodiscard]] constexpr vec3 refract(const vec3 &uv, const vec3 &n, real etai_over_etat) noexcept
 {
-    auto cos_theta = std::min(dot(-uv, n), 1.0f);
+    auto cos_theta = std::min<real>(dot(-uv, n), 1);
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
     vec3 r_out_parallel = -std::sqrt(std::abs(1.0f - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
-}
\ No newline at end of file
+}
@@ -0,0 +1,339 @@
+// Behavior tests for the render paths that tools and services rely on. Plain checks, no
+// framework: every failed CHECK is printed and the exit status is 1 if any failed.
+//
+//   behavior_tests [--filter substring]
+//
+// Images are written under images/tests/ in the working directory. The thread-count tests
+// compare 1 thread with all of them, so they only prove something on a multi-core machine.
+
+#include "../src/look_dev.h"
+#include "../src/render_session.h"
+#include "../src/scene_file.h"
+#include "../src/sequence.h"
+#include "../scenes/cornell_box.h"
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <print>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int checks = 0, failures = 0;
+
+static void check(bool ok, const char *condition, int line)
+{
+    checks++;
+    if (!ok)
+    {
+        failures++;
+        std::println(stderr, "  FAILED line {}: {}", line, condition);
+    }
+}
+
+#define CHECK(condition) check(static_cast<bool>(condition), #condition, __LINE__)
+
+// True if `expression` throws an `Exception`
+#define CHECK_THROWS(expression, Exception)                         \
+    do                                                              \
+    {                                                               \
+        bool thrown = false;                                        \
+        try                                                         \
+        {                                                           \
+            (void)(expression);                                     \
+        }                                                           \
+        catch (const Exception &)                                   \
+        {                                                           \
+            thrown = true;                                          \
+        }                                                           \
+        check(thrown, #expression " throws " #Exception, __LINE__); \
+    } while (false)
+
+// A small glass sphere under a lamp: quick to render, with caustics for the photon map
+static const char *glass_scene = R"(
+camera image_width 48
+camera samples_per_pixel 4
+camera lookfrom 0 1 2
+camera lookat 0 0 -1
+material ground lambertian 0.5 0.5 0.5
+material glass dielectric 1.5
+material lamp diffuse_light 8 8 8
+sphere 0 -100.5 -1 100 ground
+sphere 0 0 -1 0.5 glass
+sphere 0 2 -1 0.5 lamp
+)";
+
+static scene_description load(const std::string &extra = "")
+{
+    std::istringstream in(glass_scene + extra);
+    return parse_scene(in, "<test>");
+}
+
+static std::string slurp(const std::filesystem::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), {}};
+}
+
+static bool same_pixels(const std::vector<Pixel> &a, const std::vector<Pixel> &b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Pixel)) == 0;
+}
+
+// batch_render's call: the framebuffer overload, with the output named by the scene file
+static void float_output_through_batch_path()
+{
+    auto [loaded, output] = load("output tests/glass.pfm\n");
+    auto &[world, cam] = loaded;
+    std::vector<Pixel> pixels;
+    cam.render(world, output, pixels);
+
+    auto file = slurp("images/tests/glass.pfm");
+    const size_t values = static_cast<size_t>(cam.image_width) * cam.output_height() * 3;
+    CHECK(file.starts_with("PF\n"));
+    CHECK(file.size() > values * sizeof(float));
+    CHECK(pixels.empty()); // Streamed, so the framebuffer is left alone
+}
+
+static void band_rows_scene_key()
+{
+    auto [loaded, output] = load("camera band_rows 8\n");
+    CHECK(loaded.cam.band_rows == 8);
+    std::ostringstream text;
+    write_scene(text, loaded, output);
+    CHECK(text.str().find("camera band_rows 8\n") != std::string::npos);
+
+    // Bands must not change the image
+    auto whole = load();
+    whole.value.cam.render(whole.value.world, "tests/whole.ppm");
+    loaded.cam.render(loaded.world, "tests/banded.ppm");
+    CHECK(slurp("images/tests/whole.ppm") == slurp("images/tests/banded.ppm"));
+}
+
+static void photon_map_same_on_any_thread_count()
+{
+    auto s = load("camera caustic_photons 20000\n").value;
+    std::vector<Pixel> one, all;
+    s.cam.threads = 1;
+    auto stats = s.cam.render_pixels(s.world, one);
+    s.cam.threads = 0;
+    s.cam.render_pixels(s.world, all);
+    CHECK(stats.photons > 0);
+    CHECK(same_pixels(one, all));
+
+    // A prebuilt BVH knows nothing of the lights, so they must be passed along
+    auto bvh = s.cam.build_acceleration(s.world);
+    camera fresh = load("camera caustic_photons 20000\n").value.cam;
+    CHECK_THROWS(fresh.render_prebuilt(*bvh, one), std::invalid_argument);
+    fresh.set_caustic_sources(photon_sources::gather(s.world));
+    CHECK(fresh.render_prebuilt(*bvh, one).photons > 0);
+    CHECK(same_pixels(one, all));
+}
+
+static void texture_cache_capacity_restored_after_budget()
+{
+    auto &cache = tile_cache::shared();
+    auto texture = image_texture::build(512, 512, std::vector<color>(512 * 512, color(0.5, 0.25, 0.125)));
+    hittable_list world;
+    world.add(std::make_shared<sphere>(point3(0, 0, -1), 0.5, std::make_shared<textured_lambertian>(texture)));
+    camera cam;
+    cam.image_width = 32;
+    cam.samples_per_pixel = 2;
+    cam.memory_budget = 8u << 20; // Less than the default cache, so the budget shrinks it
+
+    const size_t before = cache.stats().capacity;
+    std::vector<Pixel> pixels;
+    auto stats = cam.render_pixels(world, pixels);
+    CHECK(stats.textures.capacity < before);
+    CHECK(cache.stats().capacity == before);
+
+    cam.render(world, "tests/textured.ppm", pixels);
+    CHECK(cache.stats().capacity == before);
+}
+
+static void whole_frame_settings_refused_when_streaming()
+{
+    auto s = load("camera band_rows 8\ncamera time_budget 1\n").value;
+    CHECK_THROWS(s.cam.render(s.world, "tests/budget.ppm"), std::invalid_argument);
+    s.cam.time_budget = 0;
+    s.cam.path_guiding = true;
+    CHECK_THROWS(s.cam.render(s.world, "tests/guided.pfm"), std::invalid_argument);
+}
+
+static void progressive_preview_in_subdirectory()
+{
+    auto s = load().value;
+    s.cam.render_progressive(s.world, "tests/preview/shot.png");
+    CHECK(std::filesystem::exists("images/tests/preview/shot.png"));
+    CHECK(!std::filesystem::exists("images/tests/preview/shot.png.partial.png"));
+    CHECK_THROWS(s.cam.render_progressive(s.world, "tests/preview/shot.pfm"), std::invalid_argument);
+}
+
+// A cache file with a node pointing outside the tree is rebuilt, not traversed
+static void damaged_bvh_cache_rebuilt()
+{
+    auto s = load().value;
+    const std::filesystem::path dir = "images/tests/bvh_cache";
+    std::filesystem::remove_all(dir);
+    auto built = cached_bvh(s.world, dir);
+    const auto path = std::filesystem::directory_iterator(dir)->path();
+
+    auto bytes = slurp(path);
+    flat_bvh_detail::header h;
+    flat_bvh_detail::node root;
+    std::memcpy(&h, bytes.data(), sizeof(h));
+    std::memcpy(&root, bytes.data() + h.nodes_offset, sizeof(root));
+    CHECK(root.count == 0);
+    root.offset = h.node_count + 5;
+    std::memcpy(bytes.data() + h.nodes_offset, &root, sizeof(root));
+    std::ofstream(path, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+    CHECK_THROWS(flat_bvh::open(path), std::runtime_error);
+    auto rebuilt = cached_bvh(s.world, dir);
+    CHECK(rebuilt && rebuilt->content_hash() == built->content_hash());
+    CHECK(flat_bvh::open(path)->content_hash() == built->content_hash());
+}
+
+// A texture file whose level table disagrees with its sizes is refused before any tile is read
+static void damaged_texture_file_refused()
+{
+    const std::filesystem::path path = "images/tests/flat.rttex";
+    image_texture::build(100, 60, std::vector<color>(100 * 60, color(0.5, 0.5, 0.5)))->save(path);
+    CHECK(image_texture::open(path)->level_count() == 7);
+
+    auto patched = [&](auto &&change)
+    {
+        auto bytes = slurp(path);
+        auto table = reinterpret_cast<texture_detail::level *>(bytes.data() + sizeof(texture_detail::header));
+        change(table);
+        const std::filesystem::path damaged = "images/tests/damaged.rttex";
+        std::ofstream(damaged, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        return damaged;
+    };
+    CHECK_THROWS(image_texture::open(patched([](auto *l) { l[0].tiles_x = 1; })), std::runtime_error);
+    CHECK_THROWS(image_texture::open(patched([](auto *l) { l[1].width = 100; })), std::runtime_error);
+    CHECK_THROWS(image_texture::open(patched([](auto *l) { l[2].offset += 2; })), std::runtime_error);
+}
+
+// Only render() and render_pixels() plan for a memory budget; the other paths refuse one
+static void memory_budget_refused_where_not_planned()
+{
+    auto s = load("camera memory_budget 100000000\n").value;
+    std::vector<Pixel> pixels;
+    CHECK(s.cam.render_pixels(s.world, pixels).rays > 0);
+    auto bvh = s.cam.build_acceleration(s.world);
+    CHECK_THROWS(s.cam.render_prebuilt(*bvh, pixels), std::invalid_argument);
+    CHECK_THROWS(s.cam.render_progressive(s.world, "tests/budget_preview.png"), std::invalid_argument);
+    CHECK_THROWS(look_dev_session(s.world, s.cam), std::invalid_argument);
+    render_session session(s.world);
+    CHECK_THROWS(session.add_view(s.cam), std::invalid_argument);
+}
+
+// Look-dev replays cached hits of a fixed sample count, so no setting may render in rounds
+static void look_dev_refuses_round_settings()
+{
+    auto s = load("camera target_error 0.01\n").value;
+    CHECK_THROWS(look_dev_session(s.world, s.cam), std::invalid_argument);
+    s.cam.target_error = 0;
+    look_dev_session session(s.world, s.cam);
+    CHECK(session.render().rays > 0);
+}
+
+// The static kernel renders plain whole frames; anything else is refused before rendering
+static void static_render_settings_checked_first()
+{
+    camera cam;
+    cam.image_width = 16;
+    cam.samples_per_pixel = 1;
+    CHECK_THROWS(cam.render_static(cornell_box, "tests/static.pfm"), std::invalid_argument);
+    cam.band_rows = 4;
+    CHECK_THROWS(cam.render_static(cornell_box, "tests/static.ppm"), std::invalid_argument);
+    cam.band_rows = 0;
+    cam.target_error = 0.01f;
+    CHECK_THROWS(cam.render_static(cornell_box, "tests/static.ppm"), std::invalid_argument);
+    CHECK(!std::filesystem::exists("images/tests/static.ppm"));
+    cam.target_error = 0;
+    CHECK(cam.render_static(cornell_box, "tests/static.ppm").rays > 0);
+}
+
+// A frame that cannot be saved ends the sequence with its exception, not std::terminate
+static void sequence_save_failure_rethrown()
+{
+    auto s = load("camera image_width 16\ncamera samples_per_pixel 1\n").value;
+    std::vector<camera_keyframe> keys{camera_keyframe::from(s.cam)};
+    std::filesystem::remove_all("images/tests/sequence");
+    sequence_renderer renderer;
+    renderer.name_pattern = "tests/sequence/frame_{}.pfm";
+    CHECK_THROWS(renderer.render(s.world, s.cam, keys, 3), std::invalid_argument);
+    CHECK(!std::filesystem::exists("images/tests/sequence/frame_0.pfm"));
+
+    std::filesystem::create_directories("images/tests/sequence/frame_1.ppm"); // In the way of frame 1
+    renderer.name_pattern = "tests/sequence/frame_{}.ppm";
+    CHECK_THROWS(renderer.render(s.world, s.cam, keys, 4), std::runtime_error);
+    CHECK(std::filesystem::exists("images/tests/sequence/frame_0.ppm"));
+    std::filesystem::remove("images/tests/sequence/frame_1.ppm");
+    CHECK(renderer.render(s.world, s.cam, keys, 2).size() == 2);
+}
+
+// Shutter times are fractions of the sphere motion from time 0 to 1
+static void shutter_interval_checked()
+{
+    CHECK_THROWS(load("camera shutter_close 1.5\n"), std::runtime_error);
+    CHECK_THROWS(load("camera shutter_open 0.8\ncamera shutter_close 0.2\n"), std::runtime_error);
+    auto s = load("camera shutter_open 0.2\ncamera shutter_close 0.8\n").value;
+    CHECK(s.cam.shutter_open == 0.2f && s.cam.shutter_close == 0.8f);
+
+    std::vector<Pixel> pixels;
+    s.cam.shutter_open = -0.5f;
+    CHECK_THROWS(s.cam.render_pixels(s.world, pixels), std::invalid_argument);
+    s.cam.shutter_open = 0.9f;
+    CHECK_THROWS(s.cam.render_pixels(s.world, pixels), std::invalid_argument);
+}
+
+int main(int argc, char **argv)
+{
+    std::string_view filter = argc == 3 && std::string_view(argv[1]) == "--filter" ? argv[2] : "";
+    if (argc != 1 && filter.empty())
+    {
+        std::println(stderr, "Usage: behavior_tests [--filter substring]");
+        return 2;
+    }
+
+    const std::pair<const char *, std::function<void()>> tests[] = {
+        {"float_output_through_batch_path", float_output_through_batch_path},
+        {"band_rows_scene_key", band_rows_scene_key},
+        {"photon_map_same_on_any_thread_count", photon_map_same_on_any_thread_count},
+        {"texture_cache_capacity_restored_after_budget", texture_cache_capacity_restored_after_budget},
+        {"whole_frame_settings_refused_when_streaming", whole_frame_settings_refused_when_streaming},
+        {"progressive_preview_in_subdirectory", progressive_preview_in_subdirectory},
+        {"damaged_bvh_cache_rebuilt", damaged_bvh_cache_rebuilt},
+        {"damaged_texture_file_refused", damaged_texture_file_refused},
+        {"memory_budget_refused_where_not_planned", memory_budget_refused_where_not_planned},
+        {"look_dev_refuses_round_settings", look_dev_refuses_round_settings},
+        {"static_render_settings_checked_first", static_render_settings_checked_first},
+        {"sequence_save_failure_rethrown", sequence_save_failure_rethrown},
+        {"shutter_interval_checked", shutter_interval_checked},
+    };
+    for (const auto &[name, test] : tests)
+    {
+        if (!std::string_view(name).contains(filter))
+            continue;
+        std::println("{}", name);
+        try
+        {
+            test();
+        }
+        catch (const std::exception &e)
+        {
+            checks++;
+            failures++;
+            std::println(stderr, "  FAILED: threw {}", e.what());
+        }
+    }
+
+    std::println("{} checks, {} failed", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+// Finds the tile size, worker thread count and BVH leaf size that render fastest on this
+// machine, and saves them as its tuning profile (src/tuning.h), which later renders load.
+//
+//   autotune [--scenes a,b] [--width W] [--spp N] [--repeats N] [--seed N] [--out FILE] [--dry-run]
+//
+// Every combination of tile sizes 8, 16, 32 and 64, BVH leaf sizes 2, 4 and 8, and all
+// hardware threads or half of them (with more than 4) renders each bundled scene `repeats`
+// times at reduced settings. A combination scores its total rays over its total seconds,
+// taking each scene's fastest repeat. The winner goes to --out, by default <host>.profile in
+// the user's config directory (~/.config/raytracer); --dry-run only prints the ranking. The
+// profile records the build flags and kernel level (src/cpu_dispatch.h) it was measured
+// with, and renders of another build or level skip it; RT_ISA picks the level to tune for.
+
+#include "../scenes/registry.h"
+#include "../src/build_info.h"
+#include "../src/cpu_dispatch.h"
+#include "../src/tuning.h"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <print>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct candidate
+{
+    int tile_size, threads, bvh_leaf_size;
+    uint64_t rays = 0;
+    double seconds = 0;
+
+    [[nodiscard]] double mrays_s() const { return seconds > 0 ? rays / seconds / 1'000'000.0 : 0; }
+};
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> scenes; // Empty means all
+    int width = 240, spp = 4, repeats = 2;
+    uint64_t seed = 1;
+    std::string out = machine_profile::default_path().string();
+    bool dry_run = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--scenes" && has_value)
+        {
+            std::stringstream list{std::string(argv[++i])};
+            for (std::string name; std::getline(list, name, ',');)
+            {
+                ok = ok && find_scene(name) != nullptr;
+                scenes.push_back(name);
+            }
+        }
+        else if (arg == "--width" && has_value)
+            ok = parse_number(argv[++i], width) && width > 0;
+        else if (arg == "--spp" && has_value)
+            ok = parse_number(argv[++i], spp) && spp > 0;
+        else if (arg == "--repeats" && has_value)
+            ok = parse_number(argv[++i], repeats) && repeats > 0;
+        else if (arg == "--seed" && has_value)
+            ok = parse_number(argv[++i], seed);
+        else if (arg == "--out" && has_value)
+            out = argv[++i];
+        else if (arg == "--dry-run")
+            dry_run = true;
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::println(stderr, "Invalid argument: {}", arg);
+            return 2;
+        }
+    }
+
+    // Calibration settings are all explicit; a stale profile must not leak into them
+    machine_profile::select("off");
+
+    const int hardware = static_cast<int>(std::max(hardware_threads(), 1u));
+    std::vector<int> thread_counts{hardware};
+    if (hardware > 4)
+        thread_counts.push_back(hardware / 2);
+
+    std::vector<candidate> grid;
+    for (int tile : {8, 16, 32, 64})
+        for (int threads : thread_counts)
+            for (int leaf : {2, 4, 8})
+                grid.push_back({tile, threads, leaf});
+
+    std::println("Host: {} | CPU: {} | {} threads", host_name(), cpu_model(), hardware);
+    std::println("Build: {} | {} | kernels {}", compiler_info(), build_flags(), cpu_dispatch::describe());
+    std::println("Settings: width {} | {} spp | {} repeats | {} configurations\n", width, spp, repeats, grid.size());
+
+    std::vector<Pixel> pixels;
+    for (const auto &entry : scene_registry)
+    {
+        if (!scenes.empty() && std::find(scenes.begin(), scenes.end(), entry.name) == scenes.end())
+            continue;
+
+        seed_random(seed);
+        auto [world, cam] = entry.generate();
+        cam.image_width = width;
+        cam.samples_per_pixel = spp;
+        cam.seed = seed;
+        // The plain tile render; round-based features measure the same kernel
+        cam.time_budget = 0;
+        cam.caustic_photons = 0;
+        cam.path_guiding = false;
+        cam.target_error = 0;
+        cam.memory_budget = 0;
+        cam.bvh_cache_dir.clear();
+
+        std::println(stderr, "Calibrating on {}", entry.name);
+        for (int leaf : {2, 4, 8})
+        {
+            cam.bvh_leaf_size = leaf;
+            auto bvh = cam.build_acceleration(world); // Built once per leaf size, outside the timings
+            for (auto &c : grid)
+            {
+                if (c.bvh_leaf_size != leaf)
+                    continue;
+                cam.tile_size = c.tile_size;
+                cam.threads = c.threads;
+                camera::render_stats best;
+                for (int run = 0; run < repeats; run++)
+                {
+                    auto stats = cam.render_prebuilt(*bvh, pixels);
+                    if (run == 0 || stats.render_seconds < best.render_seconds)
+                        best = stats;
+                }
+                c.rays += best.rays;
+                c.seconds += best.render_seconds;
+            }
+        }
+    }
+
+    std::sort(grid.begin(), grid.end(), [](const candidate &a, const candidate &b)
+              { return a.mrays_s() > b.mrays_s(); });
+    std::println("{:>6} {:>8} {:>6} {:>10}", "tile", "threads", "leaf", "MRays/s");
+    for (const auto &c : grid)
+        std::println("{:>6} {:>8} {:>6} {:>10.3f}", c.tile_size, c.threads, c.bvh_leaf_size, c.mrays_s());
+
+    const auto &best = grid.front();
+    machine_profile profile;
+    profile.tile_size = best.tile_size;
+    profile.threads = best.threads == hardware ? 0 : best.threads; // 0 keeps up with a changed thread count
+    profile.bvh_leaf_size = best.bvh_leaf_size;
+    profile.mrays_s = best.mrays_s();
+    profile.host = host_name();
+    profile.build = machine_profile::current_build();
+    std::println("\nBest: tile {} | {} threads | leaf {} | {:.3f} MRays/s", best.tile_size, best.threads,
+                 best.bvh_leaf_size, best.mrays_s());
+    if (dry_run)
+        return 0;
+
+    try
+    {
+        profile.save(out);
+    }
+    catch (const std::exception &e)
+    {
+        std::println(stderr, "autotune: {}", e.what());
+        return 1;
+    }
+    std::println("Profile: {}", out);
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Renders scene files back-to-back in one process, reusing the thread pool and framebuffer.
+//
+//   batch_render [--spp N] [--width W] [--bvh-cache DIR] [--budget SECONDS] [--caustics PHOTONS] [--guide] [--target-error E] [--texture-cache MB] [--memory-budget MB] [--bands ROWS] [--tuning FILE|off] [--isa LEVEL] [--preview] [--list FILE] scene_or_job_files...
+//   batch_render --export DIR [--seed N]
+//
+// --list reads one scene file path per line ('#' comments allowed). A job that fails to load
+// or render is reported and skipped; the exit status is 1 if any job failed.
+// --bvh-cache keeps each scene's BVH in DIR (see src/flat_bvh.h) so repeat renders skip the build.
+// --budget stops each render after SECONDS, with whatever samples per pixel fit (see camera::time_budget).
+// --caustics traces PHOTONS caustic photons per pass (see camera::caustic_photons).
+// --guide turns on path guiding (camera::path_guiding); --target-error reports the samples per
+// pixel needed for relative RMS error E, e.g. 0.01 (camera::target_error).
+// --texture-cache caps the decoded texture tiles held in memory (see src/texture.h; default 64).
+// --memory-budget fails any render needing more than MB, after trying cheaper representations
+// (camera::memory_budget).
+// --bands streams each image to disk in bands of ROWS rows (camera::band_rows).
+// --tuning reads the machine profile from FILE instead of this host's default profile, or none with
+// "off" (see src/tuning.h and tools/autotune.cpp).
+// --isa runs the kernels compiled for LEVEL (sse4.2, avx2 or avx512) instead of the widest this
+// CPU supports, e.g. to compare them (see src/cpu_dispatch.h).
+// --preview renders coarse to fine, rewriting each output after every stage
+// (camera::render_progressive), so a first image appears within milliseconds.
+// --export writes every compiled-in scene (scenes/registry.h) as DIR/<name>.scene.
+
+#include "../scenes/registry.h"
+#include "../src/scene_file.h"
+
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <string>
+#include <vector>
+
+static int export_scenes(const std::filesystem::path &dir, uint64_t seed)
+{
+    std::filesystem::create_directories(dir);
+    for (const auto &entry : scene_registry)
+    {
+        // Scenes with random layouts are frozen as generated from this seed
+        seed_random(seed);
+        auto path = dir / (std::string(entry.name) + ".scene");
+        int skipped = save_scene(entry.generate(), path, std::string(entry.name) + ".png");
+        std::println("Exported {}{}", path.string(),
+                     skipped ? std::format(" ({} non-sphere objects skipped)", skipped) : "");
+    }
+    return 0;
+}
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> jobs;
+    std::string export_dir, bvh_cache_dir;
+    uint64_t seed = 1;
+    int spp = 0, width = 0;
+    double budget = 0;
+    int photons = 0;
+    bool guide = false;
+    float target_error = 0;
+    bool preview = false;
+    size_t texture_cache_mb = 0;
+    size_t memory_budget_mb = 0;
+    int band_rows = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+
+        if (arg == "--export" && has_value)
+            export_dir = argv[++i];
+        else if (arg == "--seed" && has_value)
+            ok = parse_number(argv[++i], seed);
+        else if (arg == "--spp" && has_value)
+            ok = parse_number(argv[++i], spp);
+        else if (arg == "--width" && has_value)
+            ok = parse_number(argv[++i], width);
+        else if (arg == "--bvh-cache" && has_value)
+            bvh_cache_dir = argv[++i];
+        else if (arg == "--budget" && has_value)
+            ok = parse_number(argv[++i], budget);
+        else if (arg == "--caustics" && has_value)
+            ok = parse_number(argv[++i], photons);
+        else if (arg == "--guide")
+            guide = true;
+        else if (arg == "--target-error" && has_value)
+            ok = parse_number(argv[++i], target_error);
+        else if (arg == "--texture-cache" && has_value)
+            ok = parse_number(argv[++i], texture_cache_mb);
+        else if (arg == "--memory-budget" && has_value)
+            ok = parse_number(argv[++i], memory_budget_mb);
+        else if (arg == "--bands" && has_value)
+            ok = parse_number(argv[++i], band_rows) && band_rows > 0;
+        else if (arg == "--tuning" && has_value)
+            machine_profile::select(argv[++i]);
+        else if (arg == "--isa" && has_value)
+            cpu_dispatch::select(argv[++i]);
+        else if (arg == "--preview")
+            preview = true;
+        else if (arg == "--list" && has_value)
+        {
+            std::ifstream list(argv[++i]);
+            ok = static_cast<bool>(list);
+            for (std::string line; std::getline(list, line);)
+            {
+                line.erase(std::min(line.find('#'), line.size()));
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty())
+                    jobs.push_back(line);
+            }
+        }
+        else if (!arg.starts_with("--"))
+            jobs.emplace_back(arg);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::println(stderr, "Invalid argument: {}", arg);
+            return 2;
+        }
+    }
+
+    if (!export_dir.empty())
+        return export_scenes(export_dir, seed);
+
+    if (jobs.empty())
+    {
+        std::println(stderr, "Usage: batch_render [--spp N] [--width W] [--bvh-cache DIR] [--budget SECONDS] [--caustics PHOTONS] [--guide] [--target-error E] [--texture-cache MB] [--memory-budget MB] [--bands ROWS] [--tuning FILE|off] [--isa LEVEL] [--preview] [--list FILE] scene_files...");
+        std::println(stderr, "       batch_render --export DIR [--seed N]");
+        return 2;
+    }
+
+    if (texture_cache_mb > 0)
+        tile_cache::shared().set_capacity(texture_cache_mb << 20);
+
+    // One framebuffer for the whole batch; it only grows
+    std::vector<Pixel> pixels;
+    int failed = 0;
+    auto batch_start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        std::println(stderr, "[{}/{}] {}", i + 1, jobs.size(), jobs[i]);
+        try
+        {
+            auto [loaded, output] = load_scene(jobs[i]);
+            auto &[world, cam] = loaded;
+            if (spp > 0)
+                cam.samples_per_pixel = spp;
+            if (width > 0)
+                cam.image_width = width;
+            cam.bvh_cache_dir = bvh_cache_dir;
+            if (budget > 0)
+                cam.time_budget = budget;
+            if (photons > 0)
+                cam.caustic_photons = photons;
+            if (guide)
+                cam.path_guiding = true;
+            if (target_error > 0)
+                cam.target_error = target_error;
+            if (memory_budget_mb > 0)
+                cam.memory_budget = memory_budget_mb << 20;
+            if (band_rows > 0)
+                cam.band_rows = band_rows;
+            if (preview)
+                cam.render_progressive(world, output);
+            else
+                cam.render(world, output, pixels);
+        }
+        catch (const std::exception &e)
+        {
+            std::println(stderr, "  failed: {}", e.what());
+            failed++;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - batch_start;
+    std::println(stderr, "Batch: {} jobs, {} failed, {:.2f}s", jobs.size(), failed, elapsed.count());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,455 @@
+// Distributed tile rendering: a coordinator leases image tiles to worker processes over TCP
+// and merges the returned sample sums into the final image. POSIX only.
+//
+//   distributed_render coordinator (--scene FILE | --builtin NAME [--seed N]) [--port P]
+//                      [--spp N] [--width W] [--output FILE] [--tile N] [--timeout S]
+//                      [--local N] [--isa LEVEL] [--verify]
+//   distributed_render worker HOST:PORT [--name NAME] [--crash-after N]
+//
+// The coordinator sends every worker the scene in the scene file format, then leases tiles,
+// two at a time per worker. A worker that disconnects, or stays silent for longer than
+// --timeout seconds per tile it holds, is dropped and its tiles are leased again. Workers
+// return the per-pixel sample sums as raw `real` values (float32, or float64 with
+// -DRT_PRECISION_DOUBLE; all nodes must share the build's precision and byte order, and a
+// result of the wrong size drops its worker), which the coordinator resolves exactly as
+// camera::render does; with per-pixel seeding the image is bit-identical to a single-process
+// render with the same seed, which --verify checks. Only spheres have a scene file form, so
+// scenes with other objects are refused.
+// --local N spawns N workers on this host. Workers run the coordinator's kernel level (see
+// src/cpu_dispatch.h), since levels with FMA round differently; one whose CPU lacks it quits.
+// --isa sets that level, e.g. the widest one every render node supports.
+// Scenes with a time budget, caustic photons, path guiding or a target error are refused: they
+// render the whole frame in rounds, which tiles cannot share.
+//
+// Protocol: "hello NAME THREADS" (worker), "scene BYTES LEVEL" + scene text, then
+// "lease ID X Y W H" / "result ID BYTES" + W*H*3 reals, and finally "done".
+
+#include "../scenes/registry.h"
+#include "../src/scene_file.h"
+#include "net.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/wait.h>
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+class coordinator
+{
+public:
+    // Throws std::invalid_argument if the scene has objects workers cannot be sent
+    coordinator(scene s, int tile_size, double timeout)
+        : world(std::move(s.world)), cam(s.cam), timeout(timeout)
+    {
+        std::ostringstream text;
+        if (int skipped = write_scene(text, scene(world, cam)))
+            throw std::invalid_argument(std::format("{} objects of the scene are not spheres, which are all workers can be sent", skipped));
+        scene_text = text.str();
+
+        width = cam.image_width;
+        height = cam.output_height();
+        sums.resize(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; y += tile_size)
+            for (int x = 0; x < width; x += tile_size)
+                tiles.push_back({x, y, std::min(tile_size, width - x), std::min(tile_size, height - y)});
+        finished.assign(tiles.size(), false);
+        for (int i = 0; i < static_cast<int>(tiles.size()); i++)
+            pending.push_back(i);
+        remaining = static_cast<int>(tiles.size());
+    }
+
+    // Accepts workers on `listen_fd` until every tile is back, then returns the image
+    std::vector<Pixel> run(int listen_fd)
+    {
+        std::vector<std::thread> handlers;
+        std::thread acceptor([&]
+                             {
+                                 while (true)
+                                 {
+                                     int fd = ::accept(listen_fd, nullptr, nullptr);
+                                     if (fd < 0 && errno == EINTR)
+                                         continue;
+                                     if (fd < 0)
+                                         break;
+                                     std::lock_guard lock(mutex);
+                                     handlers.emplace_back([this, fd]
+                                                           { serve(fd); });
+                                 } });
+
+        {
+            std::unique_lock lock(mutex);
+            changed.wait(lock, [this]
+                         { return remaining == 0; });
+        }
+        ::shutdown(listen_fd, SHUT_RDWR);
+        acceptor.join();
+        for (auto &t : handlers)
+            t.join();
+
+        std::vector<Pixel> pixels(sums.size());
+        for (size_t i = 0; i < sums.size(); i++)
+            pixels[i] = cam.resolve(sums[i]);
+        return pixels;
+    }
+
+    void report() const
+    {
+        for (const auto &[name, count] : tiles_by_worker)
+            std::println(stderr, "  {}: {} tiles", name, count);
+        std::println(stderr, "  {} tiles leased again after worker failures", releases);
+    }
+
+    hittable_list world;
+    camera cam;
+
+private:
+    struct lease
+    {
+        int x, y, w, h;
+    };
+
+    double timeout;
+    std::string scene_text;
+    int width, height;
+    std::vector<lease> tiles;
+    std::vector<color> sums;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<bool> finished;
+    std::deque<int> pending;
+    int remaining;
+    int releases = 0;
+    std::map<std::string, int> tiles_by_worker;
+
+    void serve(int fd)
+    {
+        net::stream io(fd);
+        net::set_receive_timeout(fd, timeout);
+
+        std::string line, name = "?";
+        int threads = 0;
+        if (io.read_line(line) && line.starts_with("hello "))
+            std::istringstream(line.substr(6)) >> name >> threads;
+        bool alive = io.write(std::format("scene {} {}\n", scene_text.size(), cpu_dispatch::name(cpu_dispatch::active()))) && io.write(scene_text);
+        std::println(stderr, "Worker connected: {} ({} threads)", name, threads);
+
+        std::vector<int> outstanding;
+        std::string payload;
+        while (alive)
+        {
+            // Keep two leases in flight so the worker never waits on the network
+            std::string message;
+            {
+                std::unique_lock lock(mutex);
+                changed.wait(lock, [&]
+                             { return remaining == 0 || !pending.empty() || !outstanding.empty(); });
+                if (remaining == 0)
+                    break;
+                while (outstanding.size() < 2 && !pending.empty())
+                {
+                    int id = pending.front();
+                    pending.pop_front();
+                    outstanding.push_back(id);
+                    const auto &t = tiles[id];
+                    message += std::format("lease {} {} {} {} {}\n", id, t.x, t.y, t.w, t.h);
+                }
+            }
+            if (!message.empty() && !io.write(message))
+                break;
+
+            // The worker renders its leases in turn, so the next result may wait on all of them
+            net::set_receive_timeout(fd, timeout * static_cast<double>(std::max<size_t>(outstanding.size(), 1)));
+            int id;
+            size_t bytes;
+            if (!io.read_line(line) || std::sscanf(line.c_str(), "result %d %zu", &id, &bytes) != 2 ||
+                std::find(outstanding.begin(), outstanding.end(), id) == outstanding.end())
+                break;
+            const auto &t = tiles[id];
+            if (size_t expected = static_cast<size_t>(t.w) * t.h * 3 * sizeof(real); bytes != expected)
+            {
+                std::println(stderr, "Worker {}: {} bytes for a {}x{} tile, expected {} (another precision?)", name, bytes,
+                             t.w, t.h, expected);
+                break;
+            }
+            if (!io.read_bytes(bytes, payload))
+                break;
+
+            std::lock_guard lock(mutex);
+            std::erase(outstanding, id);
+            if (!finished[id])
+            {
+                const auto *values = reinterpret_cast<const real *>(payload.data());
+                for (int r = 0; r < t.h; r++)
+                    for (int c = 0; c < t.w; c++, values += 3)
+                        sums[(t.y + r) * width + t.x + c] = color(values[0], values[1], values[2]);
+                finished[id] = true;
+                remaining--;
+                tiles_by_worker[name]++;
+                changed.notify_all();
+            }
+        }
+
+        std::lock_guard lock(mutex);
+        if (remaining == 0)
+        {
+            io.write("done\n");
+            return;
+        }
+
+        // Failed or timed out: hand its unfinished tiles to the others
+        std::println(stderr, "Worker lost: {} ({} tiles leased again)", name, outstanding.size());
+        for (int id : outstanding)
+        {
+            if (!finished[id])
+            {
+                pending.push_front(id);
+                releases++;
+            }
+        }
+        changed.notify_all();
+    }
+};
+
+static int run_worker(const std::string &address, std::string name, int crash_after)
+{
+    auto colon = address.rfind(':');
+    int port = 0;
+    if (colon == std::string::npos || !parse_number(std::string_view(address).substr(colon + 1), port))
+    {
+        std::println(stderr, "Expected HOST:PORT, got {}", address);
+        return 2;
+    }
+
+    // The coordinator may still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++)
+    {
+        fd = net::connect_tcp(address.substr(0, colon), port);
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0)
+    {
+        std::println(stderr, "Cannot reach coordinator at {}", address);
+        return 1;
+    }
+
+    net::stream io(fd);
+    if (name.empty())
+        name = std::format("{}/{}", host_name(), ::getpid());
+    io.write(std::format("hello {} {}\n", name, hardware_threads()));
+
+    std::string line, text;
+    size_t bytes = 0;
+    char level[16] = {};
+    if (!io.read_line(line) || std::sscanf(line.c_str(), "scene %zu %15s", &bytes, level) != 2 || !io.read_bytes(bytes, text))
+        return 1;
+
+    // Tiles must come out as the coordinator's own render would: same kernels, same rounding
+    cpu_dispatch::select(level);
+    if (cpu_dispatch::name(cpu_dispatch::active()) != level)
+    {
+        std::println(stderr, "Worker {}: cannot run the coordinator's {} kernels; leaving", name, level);
+        return 1;
+    }
+    std::istringstream in(text);
+    auto [world, cam] = parse_scene(in, "<coordinator>").value;
+    auto bvh = cam.build_acceleration(world);
+
+    std::vector<color> sums;
+    std::vector<real> packed;
+    int leases = 0;
+    while (io.read_line(line))
+    {
+        int id, x, y, w, h;
+        if (line == "done")
+            return 0;
+        if (std::sscanf(line.c_str(), "lease %d %d %d %d %d", &id, &x, &y, &w, &h) != 5)
+            return 1;
+        if (crash_after > 0 && leases++ == crash_after)
+            std::_Exit(3); // Simulated node failure, without a goodbye
+
+        cam.render_region(*bvh, x, y, w, h, sums);
+        packed.clear();
+        for (const auto &c : sums)
+            packed.insert(packed.end(), {c.x, c.y, c.z}); // As summed, so resolving them matches a local render
+        io.write(std::format("result {} {}\n", id, packed.size() * sizeof(real)));
+        io.write({reinterpret_cast<const char *>(packed.data()), packed.size() * sizeof(real)});
+    }
+    return 1; // Coordinator went away before the end
+}
+
+static int usage()
+{
+    std::println(stderr, "Usage: distributed_render coordinator (--scene FILE | --builtin NAME [--seed N]) [--port P]");
+    std::println(stderr, "           [--spp N] [--width W] [--output FILE] [--tile N] [--timeout S] [--local N] [--isa LEVEL] [--verify]");
+    std::println(stderr, "       distributed_render worker HOST:PORT [--name NAME] [--crash-after N]");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage();
+    std::string_view mode = argv[1];
+
+    if (mode == "worker")
+    {
+        if (argc < 3)
+            return usage();
+        std::string name;
+        int crash_after = 0;
+        for (int i = 3; i + 1 < argc; i += 2)
+        {
+            std::string_view arg = argv[i];
+            if (arg == "--name")
+                name = argv[i + 1];
+            else if (arg != "--crash-after" || !parse_number(argv[i + 1], crash_after))
+                return usage();
+        }
+        return run_worker(argv[2], name, crash_after);
+    }
+    if (mode != "coordinator")
+        return usage();
+
+    std::string scene_path, builtin, output;
+    uint64_t seed = 1;
+    int port = 0, spp = 0, width = 0, tile_size = 32, local = 0;
+    double timeout = 60.0;
+    bool verify = false;
+    for (int i = 2; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--verify")
+            verify = true;
+        else if (arg == "--scene" && has_value)
+            scene_path = argv[++i];
+        else if (arg == "--builtin" && has_value)
+            builtin = argv[++i];
+        else if (arg == "--output" && has_value)
+            output = argv[++i];
+        else if (arg == "--seed" && has_value)
+            ok = parse_number(argv[++i], seed);
+        else if (arg == "--port" && has_value)
+            ok = parse_number(argv[++i], port);
+        else if (arg == "--spp" && has_value)
+            ok = parse_number(argv[++i], spp);
+        else if (arg == "--width" && has_value)
+            ok = parse_number(argv[++i], width);
+        else if (arg == "--tile" && has_value)
+            ok = parse_number(argv[++i], tile_size) && tile_size > 0;
+        else if (arg == "--timeout" && has_value)
+            ok = parse_number(argv[++i], timeout);
+        else if (arg == "--local" && has_value)
+            ok = parse_number(argv[++i], local);
+        else if (arg == "--isa" && has_value)
+            cpu_dispatch::select(argv[++i]);
+        else
+            ok = false;
+        if (!ok)
+            return usage();
+    }
+    if (scene_path.empty() == builtin.empty())
+        return usage();
+
+    auto loaded = [&]() -> std::optional<scene_description>
+    {
+        if (!scene_path.empty())
+            return load_scene(scene_path);
+        auto entry = find_scene(builtin);
+        if (!entry)
+            return std::nullopt;
+        seed_random(seed);
+        return scene_description{entry->generate(), std::string(builtin) + ".png"};
+    }();
+    if (!loaded)
+    {
+        std::println(stderr, "Unknown scene: {}", builtin);
+        return 2;
+    }
+    if (spp > 0)
+        loaded->value.cam.samples_per_pixel = spp;
+    if (width > 0)
+        loaded->value.cam.image_width = width;
+    if (output.empty())
+        output = loaded->output;
+    if (loaded->value.cam.renders_in_rounds())
+    {
+        std::println(stderr, "Time budgets, caustic photons, path guiding and target errors need a whole-frame render; "
+                             "remove them from the scene");
+        return 2;
+    }
+
+    std::optional<coordinator> built;
+    try
+    {
+        built.emplace(std::move(loaded->value), tile_size, timeout);
+    }
+    catch (const std::invalid_argument &e)
+    {
+        std::println(stderr, "Cannot distribute {}: {}", output, e.what());
+        return 2;
+    }
+    auto &coord = *built;
+    int listen_fd = net::listen_tcp(port);
+    std::println(stderr, "Coordinator listening on port {}", port);
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < local; i++)
+    {
+        pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            auto address = std::format("127.0.0.1:{}", port);
+            auto name = std::format("local-{}", i);
+            ::execl("/proc/self/exe", argv[0], "worker", address.c_str(), "--name", name.c_str(), nullptr);
+            ::execlp(argv[0], argv[0], "worker", address.c_str(), "--name", name.c_str(), nullptr);
+            std::_Exit(127);
+        }
+        children.push_back(pid);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto pixels = coord.run(listen_fd);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    ::close(listen_fd);
+    for (pid_t pid : children)
+        ::waitpid(pid, nullptr, 0);
+
+    camera::render_stats stats;
+    stats.render_seconds = elapsed.count();
+    stats.rays = static_cast<uint64_t>(pixels.size()) * coord.cam.samples_per_pixel;
+    coord.cam.save(pixels, output, stats);
+    coord.report();
+
+    if (!verify)
+        return 0;
+    std::vector<Pixel> reference;
+    coord.cam.render_pixels(coord.world, reference);
+    size_t differing = 0;
+    for (size_t i = 0; i < pixels.size(); i++)
+        differing += std::memcmp(&pixels[i], &reference[i], sizeof(Pixel)) != 0;
+    std::println(stderr, "Verify: {}", differing ? std::format("{} pixels differ from a local render", differing)
+                                                 : std::string("identical to a local render"));
+    return differing ? 1 : 0;
+}
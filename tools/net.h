@@ -0,0 +1,219 @@
+#pragma once
+
+// Minimal blocking socket helpers shared by the service tools. POSIX only.
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace net
+{
+    inline constexpr std::string_view default_socket = "/tmp/raytracer.sock";
+
+    [[noreturn]] inline void fail(const std::string &what)
+    {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    inline sockaddr_un unix_address(std::string_view path)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("socket path too long: " + std::string(path));
+        path.copy(addr.sun_path, path.size());
+        return addr;
+    }
+
+    // Returns a connected socket, or -1 if nothing is listening at `path`
+    inline int connect_unix(std::string_view path)
+    {
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            fail("socket");
+        auto addr = unix_address(path);
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Listens at `path`, replacing a stale socket file left by a crashed process.
+    // Throws if another process is already listening there.
+    inline int listen_unix(std::string_view path)
+    {
+        if (int existing = connect_unix(path); existing >= 0)
+        {
+            ::close(existing);
+            throw std::runtime_error("already serving on " + std::string(path));
+        }
+        ::unlink(std::string(path).c_str());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            fail("socket");
+        auto addr = unix_address(path);
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            fail("bind " + std::string(path));
+        if (::listen(fd, 16) < 0)
+            fail("listen");
+        return fd;
+    }
+
+    // Listens on all interfaces; port 0 picks a free port, returned through `port`
+    inline int listen_tcp(int &port)
+    {
+        int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+        if (fd < 0)
+            fail("socket");
+        int off = 0, on = 1;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // Accept IPv4 too
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(static_cast<uint16_t>(port));
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+            fail("bind port " + std::to_string(port));
+        if (::listen(fd, 64) < 0)
+            fail("listen");
+
+        socklen_t length = sizeof(addr);
+        ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length);
+        port = ntohs(addr.sin6_port);
+        return fd;
+    }
+
+    // Returns a connected socket with Nagle disabled, or -1 if the host does not answer
+    inline int connect_tcp(const std::string &host, int port)
+    {
+        addrinfo hints{}, *found = nullptr;
+        hints.ai_socktype = SOCK_STREAM;
+        if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+            return -1;
+
+        int fd = -1;
+        for (auto *a = found; a && fd < 0; a = a->ai_next)
+        {
+            fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) < 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+
+        if (fd >= 0)
+        {
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        return fd;
+    }
+
+    // Makes reads on `fd` fail after `seconds` without data (0 waits forever)
+    inline void set_receive_timeout(int fd, double seconds)
+    {
+        timeval tv{};
+        tv.tv_sec = static_cast<time_t>(seconds);
+        tv.tv_usec = static_cast<suseconds_t>((seconds - tv.tv_sec) * 1e6);
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    // Buffered line/byte reader and writer over a connected socket. Owns the descriptor.
+    class stream
+    {
+    public:
+        explicit stream(int fd) : fd(fd) {}
+        stream(const stream &) = delete;
+        stream &operator=(const stream &) = delete;
+        ~stream()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        // Reads up to '\n' (not included). Returns false on EOF or error.
+        bool read_line(std::string &line)
+        {
+            while (true)
+            {
+                if (auto end = buffer.find('\n', start); end != std::string::npos)
+                {
+                    line.assign(buffer, start, end - start);
+                    start = end + 1;
+                    return true;
+                }
+                if (!fill())
+                    return false;
+            }
+        }
+
+        // Reads exactly `n` bytes. Returns false on EOF or error.
+        bool read_bytes(size_t n, std::string &out)
+        {
+            while (buffer.size() - start < n)
+                if (!fill())
+                    return false;
+            out.assign(buffer, start, n);
+            start += n;
+            return true;
+        }
+
+        // Writes everything or returns false (peer gone); never raises SIGPIPE
+        bool write(std::string_view data)
+        {
+            while (!data.empty())
+            {
+                auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                data.remove_prefix(static_cast<size_t>(n));
+            }
+            return true;
+        }
+
+        // Unblocks a reader on another thread; the descriptor stays owned until destruction
+        void shutdown() { ::shutdown(fd, SHUT_RDWR); }
+
+        [[nodiscard]] int descriptor() const { return fd; }
+
+    private:
+        int fd;
+        std::string buffer;
+        size_t start = 0;
+
+        bool fill()
+        {
+            // Drop consumed bytes before growing the buffer
+            buffer.erase(0, start);
+            start = 0;
+
+            char chunk[64 * 1024];
+            ssize_t n;
+            do
+                n = ::recv(fd, chunk, sizeof(chunk), 0);
+            while (n < 0 && errno == EINTR);
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+            return true;
+        }
+    };
+}
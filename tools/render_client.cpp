@@ -0,0 +1,173 @@
+// Command-line client for render_daemon.
+//
+//   render_client [--socket PATH] submit SCENE [--priority N] [--spp N] [--width W]
+//                 [--output FILE] [--camera "FIELD VALUES"]... [--fetch FILE] [--detach]
+//   render_client [--socket PATH] cancel ID | status | shutdown
+//
+// submit waits for the job and prints its progress unless --detach is given. --fetch streams
+// the finished tiles back and writes the assembled image to FILE as well. Relative output
+// names are saved under the daemon's images/ directory, as with camera::render.
+
+#include "../external/stb_image_write.h"
+#include "../src/color.h"
+#include "net.h"
+
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <print>
+#include <sstream>
+#include <vector>
+
+static int usage()
+{
+    std::println(stderr, "Usage: render_client [--socket PATH] submit SCENE [--priority N] [--spp N] [--width W]");
+    std::println(stderr, "                     [--output FILE] [--camera \"FIELD VALUES\"]... [--fetch FILE] [--detach]");
+    std::println(stderr, "       render_client [--socket PATH] cancel ID | status | shutdown");
+    return 2;
+}
+
+// Follows one job until it finishes; returns the process exit status
+static int wait_for_job(net::stream &io, const std::string &fetch_path)
+{
+    std::vector<Pixel> image;
+    int width = 0, height = 0;
+    std::string line, payload;
+
+    while (io.read_line(line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        uint64_t id;
+        fields >> kind >> id;
+
+        if (kind == "started")
+        {
+            fields >> width >> height;
+            if (!fetch_path.empty())
+                image.assign(static_cast<size_t>(width) * height, Pixel{});
+        }
+        else if (kind == "progress")
+        {
+            int done, total;
+            fields >> done >> total;
+            std::print(stderr, "\rJob {}: {}/{} tiles", id, done, total);
+        }
+        else if (kind == "tile")
+        {
+            int x, y, w, h;
+            size_t bytes;
+            fields >> x >> y >> w >> h >> bytes;
+            if (!io.read_bytes(bytes, payload))
+                break;
+            for (int row = 0; row < h && !image.empty(); row++)
+                std::memcpy(&image[(y + row) * width + x], payload.data() + row * w * sizeof(Pixel), w * sizeof(Pixel));
+        }
+        else if (kind == "done")
+        {
+            std::string path;
+            double seconds, mrays;
+            fields >> path >> seconds >> mrays;
+            std::println(stderr, "\nJob {}: {} | {:.2f}s | {:.2f} MRays/s", id, path, seconds, mrays);
+            if (!fetch_path.empty())
+            {
+                stbi_write_png(fetch_path.c_str(), width, height, 3, image.data(), width * 3);
+                std::println(stderr, "Fetched: {}", fetch_path);
+            }
+            return 0;
+        }
+        else if (kind == "failed" || kind == "cancelled" || kind == "error")
+        {
+            std::println(stderr, "\n{}", line);
+            return 1;
+        }
+    }
+    std::println(stderr, "\nConnection to the daemon lost");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    std::string socket_path(net::default_socket);
+    std::vector<std::string_view> args(argv + 1, argv + argc);
+    if (args.size() >= 2 && args[0] == "--socket")
+    {
+        socket_path = args[1];
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    if (args.empty())
+        return usage();
+
+    std::string request;
+    std::string fetch_path;
+    bool detach = false;
+    auto command = args[0];
+
+    if (command == "submit" && args.size() >= 2)
+    {
+        request = "job\nscene " + std::filesystem::absolute(args[1]).string() + "\n";
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            auto arg = args[i];
+            bool has_value = i + 1 < args.size();
+            if (arg == "--detach")
+                detach = true;
+            else if (arg == "--fetch" && has_value)
+            {
+                fetch_path = args[++i];
+                request += "tiles 1\n";
+            }
+            else if ((arg == "--priority" || arg == "--spp" || arg == "--width" ||
+                      arg == "--output" || arg == "--camera") &&
+                     has_value)
+                request += std::format("{} {}\n", arg.substr(2), args[++i]);
+            else
+                return usage();
+        }
+        request += "end\n";
+    }
+    else if (command == "cancel" && args.size() == 2)
+        request = std::format("cancel {}\n", args[1]);
+    else if ((command == "status" || command == "shutdown") && args.size() == 1)
+        request = std::string(command) + "\n";
+    else
+        return usage();
+
+    int fd = net::connect_unix(socket_path);
+    if (fd < 0)
+    {
+        std::println(stderr, "No render_daemon listening on {}", socket_path);
+        return 2;
+    }
+    net::stream io(fd);
+    io.write(request);
+
+    std::string line;
+    if (command == "submit")
+    {
+        if (!io.read_line(line) || !line.starts_with("queued "))
+        {
+            std::println(stderr, "Unexpected reply: {}", line);
+            return 1;
+        }
+        std::println("{}", line.substr(7)); // Job id, for scripts
+        return detach ? 0 : wait_for_job(io, fetch_path);
+    }
+    if (command == "status")
+    {
+        while (io.read_line(line) && line != "end")
+            std::println("{}", line);
+        return 0;
+    }
+    if (command == "cancel")
+    {
+        // Silence means the cancel was accepted; the submitter gets the "cancelled" reply
+        ::shutdown(io.descriptor(), SHUT_WR);
+        if (io.read_line(line))
+        {
+            std::println(stderr, "{}", line);
+            return 1;
+        }
+    }
+    return 0;
+}
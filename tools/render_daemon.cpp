@@ -0,0 +1,436 @@
+// Long-running render service. Jobs arrive over a UNIX-domain socket, are queued by
+// priority and rendered one at a time on the shared thread pool; loaded scenes and their
+// BVHs stay cached between jobs. POSIX only.
+//
+//   render_daemon [--socket PATH] [--cache N] [--bvh-cache DIR]
+//
+// Protocol: text lines, except tile payloads. Requests:
+//
+//   job                            followed by option lines, then "end":
+//     scene PATH                     scene file (required)
+//     priority N                     higher runs first (default 0), FIFO among equals
+//     spp N | width W                overrides
+//     camera <field> <values...>     any camera field, as in scene files
+//     output FILE                    default: the scene's own output; 8-bit formats only
+//     tiles 1                        stream finished tiles back
+//   cancel ID
+//   status                         one "job ID STATE PRIORITY SCENE" line per job, then "end"
+//   shutdown
+//
+// Replies to the submitting connection: "queued ID", "started ID WIDTH HEIGHT",
+// "progress ID DONE TOTAL", "tile ID X Y W H BYTES" followed by BYTES of row-major RGB,
+// "done ID PATH SECONDS MRAYS_S", "failed ID MESSAGE", "cancelled ID", "error MESSAGE".
+//
+// Jobs render whole 8-bit frames from the cached BVH, so float outputs (.pfm, .hdr),
+// band_rows and memory_budget fail the job before it is started.
+
+#include "../src/scene_file.h"
+#include "net.h"
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <format>
+#include <list>
+#include <map>
+#include <mutex>
+#include <print>
+#include <sstream>
+#include <thread>
+
+struct connection
+{
+    net::stream io;
+    std::mutex write_mutex;
+
+    explicit connection(int fd) : io(fd) {}
+
+    // Messages from the render and tile threads must not interleave
+    bool send(std::string_view message)
+    {
+        std::lock_guard lock(write_mutex);
+        return io.write(message);
+    }
+};
+
+struct job
+{
+    uint64_t id = 0;
+    int priority = 0;
+    std::string scene_path, output;
+    int spp = 0, width = 0;
+    bool stream_tiles = false;
+    std::vector<std::string> camera_lines;
+    std::shared_ptr<connection> client;
+    std::atomic<bool> cancel{false};
+    std::string state = "queued"; // Guarded by render_daemon::mutex
+};
+
+class render_daemon
+{
+public:
+    size_t cache_limit = 8;
+    std::string bvh_cache_dir;
+
+    void serve(std::string_view socket_path)
+    {
+        listen_fd = net::listen_unix(socket_path);
+        std::println(stderr, "Listening on {}", socket_path);
+
+        std::thread renderer([this]
+                             { render_loop(); });
+
+        std::list<handler> handlers;
+        while (true)
+        {
+            int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break; // Listening socket shut down
+            }
+
+            // Let go of connections that have closed since the last one came in
+            for (auto it = handlers.begin(); it != handlers.end();)
+            {
+                if (!it->finished)
+                {
+                    ++it;
+                    continue;
+                }
+                it->thread.join();
+                it = handlers.erase(it);
+            }
+            auto client = std::make_shared<connection>(fd);
+            {
+                std::lock_guard lock(mutex);
+                std::erase_if(clients, [](const std::weak_ptr<connection> &c)
+                              { return c.expired(); });
+                clients.push_back(client);
+            }
+            auto &h = handlers.emplace_back();
+            h.thread = std::thread([this, client, &h]
+                                   {
+                                       handle(client);
+                                       h.finished = true; });
+        }
+
+        renderer.join();
+        {
+            std::lock_guard lock(mutex);
+            for (auto &c : clients)
+                if (auto alive = c.lock())
+                    alive->io.shutdown();
+        }
+        for (auto &h : handlers)
+            h.thread.join();
+        ::close(listen_fd);
+        ::unlink(std::string(socket_path).c_str());
+    }
+
+private:
+    struct handler
+    {
+        std::thread thread;
+        std::atomic<bool> finished{false}; // handle() has returned; join without waiting
+    };
+
+    struct cached_scene
+    {
+        std::filesystem::file_time_type modified;
+        scene_description description;
+        std::shared_ptr<hittable> bvh;
+        photon_sources sources; // For caustic photons, which a job may turn on
+        uint64_t last_used = 0;
+    };
+
+    int listen_fd = -1;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<std::shared_ptr<job>> queue; // Pending jobs, in submission order
+    std::shared_ptr<job> running;
+    std::vector<std::weak_ptr<connection>> clients;
+    uint64_t next_id = 1;
+    bool stopping = false;
+
+    // Only touched by the render thread
+    std::map<std::string, cached_scene> scenes;
+    uint64_t use_counter = 0;
+
+    void handle(const std::shared_ptr<connection> &client)
+    {
+        std::string line;
+        while (client->io.read_line(line))
+        {
+            std::istringstream fields(line);
+            std::string command;
+            fields >> command;
+
+            if (command == "job")
+                submit(read_job(client));
+            else if (command == "cancel")
+            {
+                uint64_t id = 0;
+                fields >> id;
+                if (!cancel(id))
+                    client->send(std::format("error no pending or running job {}\n", id));
+            }
+            else if (command == "status")
+                client->send(status());
+            else if (command == "shutdown")
+            {
+                stop();
+                break;
+            }
+            else if (!command.empty())
+                client->send(std::format("error unknown command '{}'\n", command));
+        }
+    }
+
+    std::shared_ptr<job> read_job(const std::shared_ptr<connection> &client)
+    {
+        auto j = std::make_shared<job>();
+        j->client = client;
+        std::string line;
+        while (client->io.read_line(line) && line != "end")
+        {
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+            if (key == "scene")
+                std::getline(fields >> std::ws, j->scene_path);
+            else if (key == "output")
+                std::getline(fields >> std::ws, j->output);
+            else if (key == "priority")
+                fields >> j->priority;
+            else if (key == "spp")
+                fields >> j->spp;
+            else if (key == "width")
+                fields >> j->width;
+            else if (key == "tiles")
+                fields >> j->stream_tiles;
+            else if (key == "camera")
+                j->camera_lines.push_back(line.substr(line.find("camera") + 6));
+        }
+        return j;
+    }
+
+    void submit(const std::shared_ptr<job> &j)
+    {
+        {
+            std::lock_guard lock(mutex);
+            j->id = next_id++;
+            queue.push_back(j);
+        }
+        j->client->send(std::format("queued {}\n", j->id));
+        wake.notify_one();
+    }
+
+    bool cancel(uint64_t id)
+    {
+        std::shared_ptr<job> dropped;
+        {
+            std::lock_guard lock(mutex);
+            if (running && running->id == id)
+            {
+                running->cancel = true; // The render thread reports it
+                return true;
+            }
+            auto it = std::find_if(queue.begin(), queue.end(), [id](const auto &j)
+                                   { return j->id == id; });
+            if (it == queue.end())
+                return false;
+            dropped = *it;
+            queue.erase(it);
+        }
+        dropped->client->send(std::format("cancelled {}\n", id));
+        return true;
+    }
+
+    std::string status()
+    {
+        std::lock_guard lock(mutex);
+        std::string out;
+        auto line = [&out](const job &j)
+        { out += std::format("job {} {} {} {}\n", j.id, j.state, j.priority, j.scene_path); };
+        if (running)
+            line(*running);
+        for (const auto &j : queue)
+            line(*j);
+        return out + "end\n";
+    }
+
+    void stop()
+    {
+        std::vector<std::shared_ptr<job>> dropped;
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            if (running)
+                running->cancel = true;
+            dropped.swap(queue);
+        }
+        for (const auto &j : dropped)
+            j->client->send(std::format("cancelled {}\n", j->id));
+        wake.notify_one();
+        ::shutdown(listen_fd, SHUT_RDWR); // Ends the accept loop
+    }
+
+    void render_loop()
+    {
+        std::vector<Pixel> pixels; // Shared framebuffer, only grows
+        while (true)
+        {
+            std::shared_ptr<job> j;
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [this]
+                          { return stopping || !queue.empty(); });
+                if (stopping)
+                    return;
+                // Highest priority first; max_element keeps the earliest of equals
+                auto it = std::max_element(queue.begin(), queue.end(), [](const auto &a, const auto &b)
+                                           { return a->priority < b->priority; });
+                j = *it;
+                queue.erase(it);
+                j->state = "running";
+                running = j;
+            }
+
+            std::string result;
+            try
+            {
+                result = render(*j, pixels);
+            }
+            catch (const std::exception &e)
+            {
+                result = std::format("failed {} {}\n", j->id, e.what());
+            }
+            j->client->send(result);
+
+            std::lock_guard lock(mutex);
+            running.reset();
+        }
+    }
+
+    cached_scene &load(const std::string &path)
+    {
+        auto modified = std::filesystem::last_write_time(path);
+        auto it = scenes.find(path);
+        if (it == scenes.end() || it->second.modified != modified)
+        {
+            // Evict the least recently used scene to stay within the cache limit
+            if (it == scenes.end() && scenes.size() >= cache_limit)
+                scenes.erase(std::min_element(scenes.begin(), scenes.end(), [](const auto &a, const auto &b)
+                                              { return a.second.last_used < b.second.last_used; }));
+
+            auto description = load_scene(path);
+            camera builder = description.value.cam;
+            builder.bvh_cache_dir = bvh_cache_dir;
+            auto bvh = builder.build_acceleration(description.value.world);
+            auto sources = photon_sources::gather(description.value.world);
+            it = scenes.insert_or_assign(path, cached_scene{modified, std::move(description), std::move(bvh), std::move(sources)}).first;
+            std::println(stderr, "Loaded {} ({} objects)", path, it->second.description.value.world.objects.size());
+        }
+        it->second.last_used = ++use_counter;
+        return it->second;
+    }
+
+    std::string render(job &j, std::vector<Pixel> &pixels)
+    {
+        if (j.scene_path.empty())
+            throw std::runtime_error("job has no scene");
+        auto &entry = load(j.scene_path);
+
+        camera cam = entry.description.value.cam;
+        for (const auto &line : j.camera_lines)
+        {
+            std::istringstream fields(line);
+            std::string field;
+            fields >> field;
+            if (!scene_file_detail::read_camera_field(cam, field, fields) || fields.fail())
+                throw std::runtime_error("bad camera override '" + line + "'");
+        }
+        if (j.spp > 0)
+            cam.samples_per_pixel = j.spp;
+        if (j.width > 0)
+            cam.image_width = j.width;
+        auto output = j.output.empty() ? entry.description.output : j.output;
+        cam.set_caustic_sources(entry.sources);
+        if (is_float_image(output))
+            throw std::runtime_error(output + ": float formats are not supported; use an 8-bit format");
+        if (cam.band_rows > 0)
+            throw std::runtime_error("band_rows is not supported: jobs render the whole frame");
+        if (cam.memory_budget > 0)
+            throw std::runtime_error("memory_budget is not supported: the scene's BVH is already built");
+
+        j.client->send(std::format("started {} {} {}\n", j.id, cam.image_width, cam.output_height()));
+        cam.cancel = &j.cancel;
+        cam.on_tile = [&j, &pixels, width = cam.image_width](const camera::tile_event &t)
+        {
+            std::string message = std::format("progress {} {} {}\n", j.id, t.done, t.total);
+            if (j.stream_tiles)
+            {
+                message += std::format("tile {} {} {} {} {} {}\n", j.id, t.x, t.y, t.width, t.height,
+                                       t.width * t.height * sizeof(Pixel));
+                for (int row = t.y; row < t.y + t.height; row++)
+                    message.append(reinterpret_cast<const char *>(&pixels[row * width + t.x]), t.width * sizeof(Pixel));
+            }
+            j.client->send(message);
+        };
+
+        auto stats = cam.render_prebuilt(*entry.bvh, pixels);
+        if (stats.cancelled)
+            return std::format("cancelled {}\n", j.id);
+
+        cam.on_tile = nullptr;
+        auto path = cam.save(pixels, output, stats);
+        return std::format("done {} {} {:.3f} {:.3f}\n", j.id, path.string(), stats.render_seconds, stats.mrays_s());
+    }
+};
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+int main(int argc, char **argv)
+{
+    render_daemon daemon;
+    std::string socket_path(net::default_socket);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = has_value;
+
+        if (arg == "--socket" && has_value)
+            socket_path = argv[++i];
+        else if (arg == "--cache" && has_value)
+            ok = parse_number(argv[++i], daemon.cache_limit) && daemon.cache_limit > 0;
+        else if (arg == "--bvh-cache" && has_value)
+            daemon.bvh_cache_dir = argv[++i];
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::println(stderr, "Usage: render_daemon [--socket PATH] [--cache N] [--bvh-cache DIR]");
+            return 2;
+        }
+    }
+
+    try
+    {
+        daemon.serve(socket_path);
+    }
+    catch (const std::exception &e)
+    {
+        std::println(stderr, "render_daemon: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Renders a keyframed camera animation of one scene, reusing the BVH for every frame and
+// encoding each frame on an I/O thread while the next one renders.
+//
+//   render_sequence (--scene FILE | --builtin NAME [--seed N]) [--frames N] [--spp N] [--width W]
+//                   [--keys FILE | --orbit TURNS] [--pattern NAME_{:04}.png]
+//
+// A keys file has one "<frame> <field> <values...>" entry per line ('#' comments allowed),
+// where field is lookfrom, lookat, vfov or focus_dist. Entries with the same frame form one
+// keyframe; fields a keyframe leaves out keep the previous keyframe's value (the scene
+// camera's, for the first). --orbit circles the scene camera around lookat instead.
+
+#include "../scenes/registry.h"
+#include "../src/scene_file.h"
+#include "../src/sequence.h"
+
+#include <charconv>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <print>
+#include <sstream>
+
+static bool parse_number(std::string_view text, auto &value)
+{
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+// Throws std::runtime_error on malformed entries
+static std::vector<camera_keyframe> load_keys(const std::string &path, const camera &cam)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("cannot open keys file " + path);
+
+    // Collect field lines per frame first; frames may appear in any order
+    std::map<real, std::vector<std::string>> entries;
+    int line_number = 0;
+    for (std::string line; std::getline(in, line);)
+    {
+        line_number++;
+        line.erase(std::min(line.find('#'), line.size()));
+        std::istringstream fields(line);
+        real frame;
+        std::string rest;
+        if (!(fields >> frame))
+        {
+            if (line.find_first_not_of(" \t\r") != std::string::npos)
+                throw std::runtime_error(std::format("{}:{}: expected a frame number", path, line_number));
+            continue;
+        }
+        std::getline(fields, rest);
+        entries[frame].push_back(rest);
+    }
+
+    std::vector<camera_keyframe> keys;
+    auto current = camera_keyframe::from(cam);
+    for (const auto &[frame, lines] : entries)
+    {
+        current.frame = frame;
+        for (const auto &text : lines)
+        {
+            std::istringstream fields(text);
+            std::string field;
+            fields >> field;
+            if (field == "lookfrom")
+                fields >> current.lookfrom.x >> current.lookfrom.y >> current.lookfrom.z;
+            else if (field == "lookat")
+                fields >> current.lookat.x >> current.lookat.y >> current.lookat.z;
+            else if (field == "vfov")
+                fields >> current.vfov;
+            else if (field == "focus_dist")
+                fields >> current.focus_dist;
+            else
+                throw std::runtime_error(std::format("{}: frame {}: unknown field '{}'", path, frame, field));
+            if (fields.fail())
+                throw std::runtime_error(std::format("{}: frame {}: malformed {}", path, frame, field));
+        }
+        keys.push_back(current);
+    }
+    if (keys.empty())
+        throw std::runtime_error("no keyframes in " + path);
+    return keys;
+}
+
+int main(int argc, char **argv)
+{
+    std::string scene_path, builtin, keys_path;
+    sequence_renderer renderer;
+    uint64_t seed = 1;
+    int frames = 24, spp = 0, width = 0;
+    real turns = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--scene" && has_value)
+            scene_path = argv[++i];
+        else if (arg == "--builtin" && has_value)
+            builtin = argv[++i];
+        else if (arg == "--keys" && has_value)
+            keys_path = argv[++i];
+        else if (arg == "--pattern" && has_value)
+            renderer.name_pattern = argv[++i];
+        else if (arg == "--seed" && has_value)
+            ok = parse_number(argv[++i], seed);
+        else if (arg == "--frames" && has_value)
+            ok = parse_number(argv[++i], frames) && frames > 0;
+        else if (arg == "--spp" && has_value)
+            ok = parse_number(argv[++i], spp);
+        else if (arg == "--width" && has_value)
+            ok = parse_number(argv[++i], width);
+        else if (arg == "--orbit" && has_value)
+            ok = parse_number(argv[++i], turns);
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            std::println(stderr, "Invalid argument: {}", arg);
+            return 2;
+        }
+    }
+    if (scene_path.empty() == builtin.empty())
+    {
+        std::println(stderr, "Usage: render_sequence (--scene FILE | --builtin NAME [--seed N]) [--frames N] [--spp N]");
+        std::println(stderr, "                       [--width W] [--keys FILE | --orbit TURNS] [--pattern NAME_{{:04}}.png]");
+        return 2;
+    }
+
+    try
+    {
+        std::optional<scene> loaded;
+        if (!scene_path.empty())
+            loaded = load_scene(scene_path).value;
+        else if (auto entry = find_scene(builtin))
+        {
+            seed_random(seed);
+            loaded = entry->generate();
+        }
+        else
+            throw std::runtime_error("unknown scene " + builtin);
+
+        auto &[world, cam] = *loaded;
+        if (spp > 0)
+            cam.samples_per_pixel = spp;
+        if (width > 0)
+            cam.image_width = width;
+
+        auto keys = !keys_path.empty() ? load_keys(keys_path, cam)
+                    : (turns != 0)     ? orbit_keys(camera_keyframe::from(cam), turns, frames)
+                                       : std::vector{camera_keyframe::from(cam)};
+        renderer.render(world, cam, keys, frames);
+    }
+    catch (const std::exception &e)
+    {
+        std::println(stderr, "render_sequence: {}", e.what());
+        return 1;
+    }
+    return 0;
+}